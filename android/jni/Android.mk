@@ -23,18 +23,30 @@ include $(CLEAR_VARS)
 LOCAL_MODULE    	:= collector_android
 LOCAL_SRC_FILES 	:=  \
                     ../../interface.cpp \
+                    ../../trace.cpp \
+                    ../../output.cpp \
+                    ../../sysread.cpp \
                     ../../collectors/collector_utility.cpp \
                     ../../collectors/cputemp.cpp \
+                    ../../collectors/thermal.cpp \
                     ../../collectors/ferret.cpp \
                     ../../collectors/rusage.cpp \
                     ../../collectors/streamline.cpp \
                     ../../collectors/streamline_annotate.cpp \
                     ../../collectors/memory.cpp \
                     ../../collectors/cpufreq.cpp \
+                    ../../collectors/cpuidle.cpp \
+                    ../../collectors/cpustat.cpp \
                     ../../collectors/gpufreq.cpp \
+                    ../../collectors/devfreq.cpp \
+                    ../../collectors/gpu_utilisation.cpp \
                     ../../collectors/perf.cpp \
                     ../../collectors/power.cpp \
                     ../../collectors/procfs_stat.cpp \
+                    ../../collectors/psi.cpp \
+                    ../../collectors/schedstat.cpp \
+                    ../../collectors/sysfs.cpp \
+                    ../../collectors/vmstat.cpp \
                     ../../collectors/hwcpipe.cpp \
                     ../../collectors/mali_counters.cpp \
                     ../../external/jsoncpp/src/lib_json/json_writer.cpp \
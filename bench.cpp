@@ -0,0 +1,808 @@
+// Micro-benchmarks for the hot paths of libcollector. Each benchmark repeats one operation until
+// enough time has passed to measure it, and reports the time, heap allocations and read/write
+// system calls per operation. Collectors that do not work on this machine are reported as skipped;
+// those that only need a file to read are run against a fake sysfs tree in a temporary directory.
+
+#include "interface.hpp"
+#include "output.hpp"
+#include "collectors/ferret.hpp"
+#ifndef __APPLE__
+#include "collectors/perf.hpp"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <ftw.h>
+#include <new>
+#include <map>
+#include <set>
+#include <atomic>
+#include <chrono>
+
+// ---------- Counting ----------
+
+static std::atomic<uint64_t> allocations(0);
+
+// Not inlined, so that the compiler does not mistake the free() below for a mismatched one
+__attribute__((noinline)) void* operator new(size_t size)
+{
+    allocations++;
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+__attribute__((noinline)) void* operator new[](size_t size) { return operator new(size); }
+__attribute__((noinline)) void operator delete(void* p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete[](void* p) noexcept { free(p); }
+
+static int64_t getTimeNs()
+{
+    return static_cast<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// Read and write system calls made by this process, from /proc/self/io. Other system calls, such
+// as open and close, are not counted there.
+class SyscallCounter
+{
+public:
+    SyscallCounter() : mFD(open("/proc/self/io", O_RDONLY))
+    {
+        if (mFD >= 0)
+        {
+            const int64_t first = count();
+            mSelf = count() - first;
+        }
+    }
+    ~SyscallCounter() { if (mFD >= 0) close(mFD); }
+
+    bool available() const { return mFD >= 0; }
+    int64_t count()
+    {
+        char buf[512];
+        const ssize_t len = pread(mFD, buf, sizeof(buf) - 1, 0);
+        if (len <= 0) return 0;
+        buf[len] = '\0';
+        const char* r = strstr(buf, "syscr:");
+        const char* w = strstr(buf, "syscw:");
+        return (r ? strtoll(r + 6, nullptr, 10) : 0) + (w ? strtoll(w + 6, nullptr, 10) : 0);
+    }
+    /// Calls made by count() itself
+    int64_t self() const { return mSelf; }
+
+private:
+    int mFD;
+    int64_t mSelf = 0;
+};
+
+// ---------- Runner ----------
+
+struct BenchResult
+{
+    std::string name;
+    uint64_t iterations = 0;
+    double nsPerOp = 0.0;
+    double allocsPerOp = 0.0;
+    double syscallsPerOp = 0.0;
+    std::string skipped; // why the benchmark could not run here, if it did not
+};
+
+class Bench
+{
+public:
+    Bench(int64_t targetNs, const std::vector<std::string>& filters) : mTargetNs(targetNs), mFilters(filters) {}
+
+    bool selected(const std::string& name) const
+    {
+        if (mFilters.empty()) return true;
+        for (const std::string& f : mFilters) if (name.find(f) != std::string::npos) return true;
+        return false;
+    }
+
+    /// Time op(), doubling the number of iterations until a run takes long enough
+    template<typename F> void run(const std::string& name, F op)
+    {
+        run(name, op, [this]() { return mSyscalls.count(); }, mSyscalls.self(), mSyscalls.available());
+    }
+
+    /// The same, with system calls counted by syscalls() instead, for calls that /proc/self/io
+    /// does not see. overhead is the number of calls that syscalls() itself makes, and is
+    /// subtracted from each measurement.
+    template<typename F, typename C> void run(const std::string& name, F op, C syscalls, int64_t overhead = 0, bool counting = true)
+    {
+        if (!selected(name)) return;
+        op(); // warm up caches and lazily opened files
+        BenchResult r;
+        r.name = name;
+        for (uint64_t n = 1; ; n *= 2)
+        {
+            const uint64_t allocs = allocations;
+            const int64_t before = syscalls();
+            const int64_t start = getTimeNs();
+            for (uint64_t i = 0; i < n; i++)
+            {
+                op();
+            }
+            const int64_t elapsed = getTimeNs() - start;
+            const int64_t calls = syscalls() - before - overhead;
+            if (elapsed >= mTargetNs || n >= MAX_ITERATIONS)
+            {
+                r.iterations = n;
+                r.nsPerOp = (double)elapsed / n;
+                r.allocsPerOp = (double)(allocations - allocs) / n;
+                r.syscallsPerOp = counting ? (double)calls / n : NAN;
+                break;
+            }
+        }
+        mResults.push_back(r);
+    }
+
+    void skip(const std::string& name, const std::string& reason)
+    {
+        if (!selected(name)) return;
+        BenchResult r;
+        r.name = name;
+        r.skipped = reason;
+        mResults.push_back(r);
+    }
+
+    const std::vector<BenchResult>& results() const { return mResults; }
+
+private:
+    // Keeps collectors that store every sample from growing without bounds
+    static const uint64_t MAX_ITERATIONS = 1 << 22;
+
+    int64_t mTargetNs;
+    std::vector<std::string> mFilters;
+    SyscallCounter mSyscalls;
+    std::vector<BenchResult> mResults;
+};
+
+// ---------- Fake filesystem ----------
+
+static int removeEntry(const char* path, const struct stat*, int, struct FTW*)
+{
+    return remove(path);
+}
+
+// Temporary directory of files, removed with everything in it when done
+class FakeTree
+{
+public:
+    FakeTree()
+    {
+        char path[] = "/tmp/collector_bench.XXXXXX";
+        if (mkdtemp(path)) mRoot = path;
+    }
+    ~FakeTree()
+    {
+        if (!mRoot.empty()) nftw(mRoot.c_str(), removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+
+    bool valid() const { return !mRoot.empty(); }
+    const std::string& root() const { return mRoot; }
+
+    /// Path of a file in the tree, making directories as needed
+    std::string path(const std::string& relative)
+    {
+        for (size_t pos = relative.find('/'); pos != std::string::npos; pos = relative.find('/', pos + 1))
+        {
+            mkdir((mRoot + "/" + relative.substr(0, pos)).c_str(), 0700);
+        }
+        return mRoot + "/" + relative;
+    }
+
+    /// Create a file with the given contents
+    std::string write(const std::string& relative, const std::string& contents)
+    {
+        const std::string p = path(relative);
+        FILE* fp = fopen(p.c_str(), "w");
+        if (fp)
+        {
+            fwrite(contents.data(), 1, contents.size(), fp);
+            fclose(fp);
+        }
+        return p;
+    }
+
+private:
+    std::string mRoot;
+};
+
+// ---------- Benchmarks ----------
+
+class BenchSysfsCollector : public SysfsCollector
+{
+public:
+    using SysfsCollector::SysfsCollector;
+    bool parseText(const char* buffer) { return parse(buffer); }
+};
+
+static void benchSysfs(Bench& bench, FakeTree& tree)
+{
+    // Read through the sysroot, as collectors do on a recorded tree
+    const std::string previousRoot = collectorSysroot();
+    setCollectorSysroot(tree.root());
+    Json::Value config;
+    BenchSysfsCollector c(config, "battery_temperature", { "/sys/class/power_supply/battery/temp" });
+    const bool ready = c.init() && c.start();
+    setCollectorSysroot(previousRoot);
+    if (!ready)
+    {
+        bench.skip("sysfs_parse", "cannot open fake sysfs file");
+        bench.skip("sysfs_collect", "cannot open fake sysfs file");
+        return;
+    }
+    bench.run("sysfs_parse", [&c]() { c.parseText("31500\n"); });
+    bench.run("sysfs_collect", [&c]() { c.collect(0); });
+    c.stop();
+    c.deinit();
+}
+
+// The sysfs files of a phone with four CPUs in two frequency policies, a Mali GPU, thermal zones and
+// devfreq devices, and 32 threads of this process for Ferret, in the tree
+static void writeFakeSysfs(FakeTree& tree)
+{
+    const std::string cpu = "sys/devices/system/cpu/";
+    for (int policy : { 0, 2 })
+    {
+        const std::string dir = cpu + "cpufreq/policy" + std::to_string(policy) + "/";
+        tree.write(dir + "related_cpus", std::to_string(policy) + " " + std::to_string(policy + 1) + "\n");
+        tree.write(dir + "scaling_cur_freq", "1800000\n");
+        tree.write(dir + "stats/time_in_state", "600000 1000\n1200000 500\n1800000 2000\n");
+    }
+    for (int core = 0; core < 4; core++)
+    {
+        const std::string dir = cpu + "cpu" + std::to_string(core) + "/";
+        tree.write(dir + "cpufreq/scaling_cur_freq", "1800000\n");
+        tree.write(dir + "cpufreq/stats/total_trans", "1234\n");
+        tree.write(dir + "cpuidle/state0/name", "WFI\n");
+        tree.write(dir + "cpuidle/state0/time", "1000000\n");
+        tree.write(dir + "cpuidle/state0/usage", "5000\n");
+        tree.write(dir + "cpuidle/state1/name", "cpu-sleep\n");
+        tree.write(dir + "cpuidle/state1/time", "9000000\n");
+        tree.write(dir + "cpuidle/state1/usage", "700\n");
+    }
+    tree.write("sys/devices/platform/mali.0/power/runtime_active_time", "100000\n");
+    tree.write("sys/devices/platform/mali.0/power/runtime_suspended_time", "50000\n");
+    tree.write("sys/devices/platform/mali.0/clock", "800\n");
+    for (int zone = 0; zone < 4; zone++)
+    {
+        const std::string dir = "sys/class/thermal/thermal_zone" + std::to_string(zone) + "/";
+        tree.write(dir + "type", zone < 2 ? "cpu-thermal\n" : "gpu-thermal\n");
+        tree.write(dir + "temp", "45000\n");
+    }
+    tree.write("sys/class/thermal/cooling_device0/type", "thermal-cpufreq-0\n");
+    tree.write("sys/class/thermal/cooling_device0/cur_state", "2\n");
+    tree.write("sys/class/thermal/cooling_device0/max_state", "7\n");
+    const std::string transStat = "     From  :   To\n"
+                                  "           : 100000000 200000000   time(ms)\n"
+                                  "* 100000000:         0         4       300\n"
+                                  "  200000000:         3         0       100\n"
+                                  "Total transition : 7\n";
+    for (const char* device : { "13000000.mali", "exynos5-busfreq-mif", "exynos5-busfreq-int" })
+    {
+        tree.write(std::string("sys/class/devfreq/") + device + "/cur_freq", "200000000\n");
+        tree.write(std::string("sys/class/devfreq/") + device + "/trans_stat", transStat);
+    }
+    tree.write("sys/devices/17000030.devfreq_disp/devfreq/17000030.devfreq_disp/cur_freq", "400000000\n");
+    tree.write("sys/class/power_supply/battery/temp", "31500\n");
+    const std::string task = "proc/" + std::to_string(getpid()) + "/task/";
+    for (int thread = 0; thread < 32; thread++)
+    {
+        const std::string tid = std::to_string(getpid() + thread);
+        tree.write(task + tid + "/stat", tid + " (worker_" + std::to_string(thread) + ") S 1 1234 0 0 -1 4194368 5000 0 0 0 700 300 0 0 20 0 32 0 100 0 0\n");
+    }
+}
+
+// collect() of the built-in collectors that work with this config, or only of those in 'only' if
+// given. Returns the others, with why they could not be run.
+static std::map<std::string, std::string> runCollectors(Bench& bench, const Json::Value& config, const std::set<std::string>* only)
+{
+    std::map<std::string, std::string> failed;
+    Collection collection(config);
+    for (const std::string& name : collection.unavailable())
+    {
+        if (!only || only->count(name)) failed[name] = "not available on this machine";
+    }
+    for (const std::string& name : collection.available())
+    {
+        const std::string benchName = "collect/" + name;
+        if ((only && !only->count(name)) || !bench.selected(benchName))
+        {
+            continue;
+        }
+        if (name == "malicounters")
+        {
+            // Its collect() ends the process when the GPU has been idle
+            failed[name] = "cannot sample an idle GPU";
+            continue;
+        }
+        Collector* c = collection.collector(name);
+        if (!c->init())
+        {
+            failed[name] = "failed to initialize";
+            continue;
+        }
+        if (!c->start())
+        {
+            failed[name] = "failed to start";
+            c->deinit();
+            continue;
+        }
+        int64_t now = getTimeNs() / 1000;
+        bench.run(benchName, [c, &now]() { c->collect(now++); });
+        c->stop();
+        c->deinit();
+    }
+    return failed;
+}
+
+// collect() of every built-in collector: those that work on this machine, and then those that
+// only need sysfs files on the fake tree. With a sysroot, only on the files under it.
+static void benchCollectors(Bench& bench, FakeTree& tree, const std::string& sysroot)
+{
+    // Their file reads are counted in /proc/self/io, which does not see reads done by io_uring
+    const bool uring = SysReadBatch::uringEnabled();
+    SysReadBatch::setUringEnabled(false);
+    const std::string previousRoot = collectorSysroot();
+    Json::Value config;
+    config["ferret"]["output_dir"] = tree.root();
+    config["ferret"]["threaded"] = false;
+    std::map<std::string, std::string> failed;
+    if (!sysroot.empty())
+    {
+        config["sysroot"] = sysroot;
+        failed = runCollectors(bench, config, nullptr);
+    }
+    else
+    {
+        std::set<std::string> missing;
+        for (const auto& pair : runCollectors(bench, config, nullptr))
+        {
+            missing.insert(pair.first);
+        }
+        config["sysroot"] = tree.root();
+        Json::Value& metrics = config["sysfs"]["metrics"];
+        metrics[0]["name"] = "temp";
+        metrics[0]["path"] = "/sys/class/thermal/thermal_zone*/temp";
+        metrics[0]["scale"] = 0.001;
+        metrics[1]["name"] = "gpu_active";
+        metrics[1]["path"] = "/sys/devices/platform/mali.0/power/runtime_active_time";
+        metrics[1]["mode"] = "rate";
+        failed = runCollectors(bench, config, &missing);
+    }
+    setCollectorSysroot(previousRoot);
+    for (const auto& pair : failed)
+    {
+        bench.skip("collect/" + pair.first, pair.second);
+    }
+    SysReadBatch::setUringEnabled(uring);
+}
+
+// Reading all files of one tick: 12 CPU frequencies and the stat files of 150 threads, as Ferret
+// does on a phone running a game, the old way with read() and lseek(), and with SysReader
+static void benchSysRead(Bench& bench, FakeTree& tree)
+{
+    const std::string stat = "1234 (GameThread) S 1 1234 0 0 -1 4194368 5000 0 0 0 700 300 0 0 20 0 150 0 100 0 0\n";
+    std::vector<std::string> files;
+    for (int cpu = 0; cpu < 12; cpu++)
+    {
+        files.push_back(tree.write("sysread/cpu" + std::to_string(cpu) + "/scaling_cur_freq", "1800000\n"));
+    }
+    for (int task = 0; task < 150; task++)
+    {
+        files.push_back(tree.write("sysread/task/" + std::to_string(1000 + task) + "/stat", stat));
+    }
+    const std::string suffix = "/" + std::to_string(files.size());
+
+    std::vector<int> fds;
+    for (const std::string& f : files)
+    {
+        fds.push_back(open(f.c_str(), O_RDONLY));
+    }
+    int64_t calls = 0;
+    bench.run("sysread/read_lseek" + suffix, [&fds, &calls]()
+    {
+        char buf[1024];
+        for (int fd : fds)
+        {
+            if (read(fd, buf, sizeof(buf)) > 0) lseek(fd, 0, SEEK_SET);
+            calls += 2;
+        }
+    }, [&calls]() { return calls; });
+    for (int fd : fds)
+    {
+        close(fd);
+    }
+
+    const bool uring = SysReadBatch::uringEnabled();
+    for (bool useUring : { false, true })
+    {
+        const std::string name = std::string(useUring ? "sysread/io_uring" : "sysread/pread") + suffix;
+        SysReadBatch::setUringEnabled(useUring);
+        SysReader reader;
+        for (const std::string& f : files)
+        {
+            reader.add(f);
+        }
+        SysReadBatch batch;
+        std::vector<SysReader*> readers(1, &reader);
+        batch.read(readers);
+        batch.finish();
+        if (useUring && !batch.usingUring())
+        {
+            bench.skip(name, "io_uring is not available");
+            continue;
+        }
+        bench.run(name, [&batch, &readers, &reader]()
+        {
+            batch.read(readers);
+            reader.read();
+            batch.finish();
+        }, []() { return (int64_t)SysReadBatch::syscalls(); });
+    }
+    SysReadBatch::setUringEnabled(uring);
+}
+
+static void benchFerret(Bench& bench, FakeTree& tree)
+{
+    char stat[4096];
+    const int fd = open("/proc/self/stat", O_RDONLY);
+    const ssize_t len = fd >= 0 ? read(fd, stat, sizeof(stat) - 1) : -1;
+    if (fd >= 0) close(fd);
+    if (len > 0)
+    {
+        stat[len] = '\0';
+        char buf[sizeof(stat)];
+        std::string row;
+        bench.run("ferret_parse_stat", [&]()
+        {
+            memcpy(buf, stat, len + 1); // parsing modifies the buffer
+            row.clear();
+            ferret_parse_stat(buf, row);
+        });
+    }
+    else
+    {
+        bench.skip("ferret_parse_stat", "cannot read /proc/self/stat");
+    }
+
+    if (bench.selected("ferret_collect"))
+    {
+        // The stat files of the threads of this process in the fake tree, which collect() looks
+        // for again on every call
+        const std::string previousRoot = collectorSysroot();
+        setCollectorSysroot(tree.root());
+        Json::Value config;
+        config["ferret"]["output_dir"] = tree.root();
+        config["ferret"]["threaded"] = false;
+        FerretCollector c(config, "ferret");
+        if (c.init() && c.start() && c.collect(getTimeNs() / 1000))
+        {
+            bench.run("ferret_collect", [&c]()
+            {
+                c.collect(getTimeNs() / 1000);
+            });
+            c.stop();
+        }
+        else
+        {
+            bench.skip("ferret_collect", "cannot open fake sysfs files");
+        }
+        c.deinit();
+        setCollectorSysroot(previousRoot);
+    }
+
+    if (!bench.selected("ferret_postprocess"))
+    {
+        return;
+    }
+    // One second of samples at 100 Hz for 8 threads on 4 CPUs, in the format of the Ferret trace
+    std::string data = "I _SC_CLK_TCK 100\nI CPUList 0 1 2 3\nI WatchList\n"
+                       "I Status pid comm ppid utime stime cutime cstime num_threads starttime processor\n";
+    for (int sample = 0; sample < 100; sample++)
+    {
+        data += "T " + _to_string(1000000 + sample * 10000) + "\n";
+        data += "F 0 1800000 1 1800000 2 2400000 3 2400000\n";
+        for (int thread = 0; thread < 8; thread++)
+        {
+            data += "S " + _to_string(1000 + thread) + " (worker_" + _to_string(thread) + ") 1 " + _to_string(sample * (thread + 1) / 8)
+                  + " " + _to_string(sample / 8) + " 0 0 8 100 " + _to_string(thread % 4) + "\n";
+        }
+    }
+    const std::string file = tree.write("ferret.data", data);
+    bench.run("ferret_postprocess", [&file]() { postprocess_ferret_data(file, {}); });
+}
+
+// Stores a counter in each of a number of metrics
+class SyntheticCollector : public Collector
+{
+public:
+    using Collector::Collector;
+
+    virtual bool init() override
+    {
+        mHandles.clear();
+        for (int i = 0; i < METRICS; i++) mHandles.push_back(registerMetric("metric" + _to_string(i)));
+        return true;
+    }
+    virtual bool collect(int64_t) override
+    {
+        mValue++;
+        for (int i = 0; i < METRICS; i++) add(mHandles[i], mValue * (i + 1));
+        return true;
+    }
+    virtual bool available() override { return true; }
+
+    static const int METRICS = 8;
+
+private:
+    std::vector<MetricHandle> mHandles;
+    int64_t mValue = 0;
+};
+
+static void benchResults(Bench& bench, FakeTree& tree)
+{
+    const int frames = 10000;
+    Json::Value config;
+    config["synthetic"] = Json::objectValue;
+    {
+        Collection collection(config);
+        collection.addCollector(new SyntheticCollector(config, "synthetic"));
+        collection.initialize();
+        collection.start();
+        bench.run("collection_collect", [&collection]() { collection.collect(); });
+        collection.stop();
+    }
+
+    Collection collection(config);
+    collection.addCollector(new SyntheticCollector(config, "synthetic"));
+    collection.initialize();
+    collection.start();
+    for (int i = 0; i < frames; i++)
+    {
+        collection.collect();
+    }
+    collection.stop();
+
+    // Each operation writes all frames
+    const std::string json = tree.path("results.json");
+    const std::string csv = tree.path("results.csv");
+    const std::string mtv = tree.path("results_mtv.csv");
+    bench.run("results_10k_frames", [&collection]() { collection.results(); });
+    bench.run("write_json_10k_frames", [&]() { collection.writeJSON(json); });
+    bench.run("write_csv_10k_frames", [&]() { collection.writeCSV(csv); });
+    bench.run("write_csv_mtv_10k_frames", [&]() { collection.writeCSV_MTV(mtv); });
+}
+
+static void benchPerfScope(Bench& bench)
+{
+#ifndef __APPLE__
+    if (!bench.selected("perf_scope"))
+    {
+        return;
+    }
+    // Per API counters are only opened for threads named like the replayer's
+    pthread_setname_np(pthread_self(), "patrace-bench");
+    Json::Value config;
+    config["perf"]["required"] = true;
+    Collection collection(config, true);
+    if (!collection.initialize())
+    {
+        bench.skip("perf_scope", "cannot open perf counters");
+        return;
+    }
+    collection.start();
+    const int tid = syscall(SYS_gettid);
+    bench.run("perf_scope", [&collection, tid]()
+    {
+        collection.collect_scope_start(1, COLLECT_REPLAY_THREADS, tid);
+        collection.collect_scope_stop(1, COLLECT_REPLAY_THREADS, tid);
+    });
+    collection.stop();
+#else
+    bench.skip("perf_scope", "no perf counters on this platform");
+#endif
+}
+
+// ---------- Output ----------
+
+static void writeText(OutputBuffer& out, const std::vector<BenchResult>& results)
+{
+    char line[256];
+    snprintf(line, sizeof(line), "%-36s %12s %12s %12s %12s\n", "benchmark", "iterations", "ns/op", "allocs/op", "syscalls/op");
+    out.write(line, strlen(line));
+    for (const BenchResult& r : results)
+    {
+        if (r.skipped.empty())
+        {
+            snprintf(line, sizeof(line), "%-36s %12llu %12.1f %12.2f %12.2f\n", r.name.c_str(), (unsigned long long)r.iterations,
+                     r.nsPerOp, r.allocsPerOp, r.syscallsPerOp);
+        }
+        else
+        {
+            snprintf(line, sizeof(line), "%-36s skipped: %s\n", r.name.c_str(), r.skipped.c_str());
+        }
+        out.write(line, strlen(line));
+    }
+}
+
+static void writeJSON(OutputBuffer& out, const std::vector<BenchResult>& results)
+{
+    JsonStream json(out);
+    json.beginObject();
+    for (const BenchResult& r : results)
+    {
+        json.key(r.name);
+        json.beginObject();
+        if (r.skipped.empty())
+        {
+            json.key("iterations");
+            json.value(static_cast<uint64_t>(r.iterations));
+            json.key("ns_per_op");
+            json.value(r.nsPerOp);
+            json.key("allocs_per_op");
+            json.value(r.allocsPerOp);
+            json.key("syscalls_per_op");
+            json.value(r.syscallsPerOp);
+        }
+        else
+        {
+            json.key("skipped");
+            json.value(r.skipped);
+        }
+        json.endObject();
+    }
+    json.endObject();
+}
+
+static void writeCSV(OutputBuffer& out, const std::vector<BenchResult>& results)
+{
+    std::string text;
+    CsvLine line(text);
+    line.field(std::string("benchmark"));
+    line.field(std::string("iterations"));
+    line.field(std::string("ns_per_op"));
+    line.field(std::string("allocs_per_op"));
+    line.field(std::string("syscalls_per_op"));
+    line.field(std::string("skipped"));
+    line.end();
+    for (const BenchResult& r : results)
+    {
+        line.field(r.name);
+        line.field(static_cast<uint64_t>(r.iterations));
+        line.field(r.nsPerOp);
+        line.field(r.allocsPerOp);
+        line.field(r.syscallsPerOp);
+        line.field(r.skipped);
+        line.end();
+    }
+    out.write(text);
+}
+
+// ---------- Main ----------
+
+void usage(int status)
+{
+    static const char message[] =
+        "usage: collector_bench [-h] [-v] [-f text|json|csv] [-o OUTPUT] [-t MILLISECONDS] [-r SYSROOT]\n"
+        "                       [FILTER...]\n\n"
+        "Benchmarks collect() of every built-in collector that works on this machine, parsing,\n"
+        "postprocessing and the writing of results. Reports time, heap allocations and read/write\n"
+        "system calls per operation.\n"
+        "\n"
+        "    -h  Display this message\n"
+        "    -v  Show log output of the library while benchmarking\n"
+        "    -f  Output format: text (default), json or csv\n"
+        "    -o  Write results to this file instead of standard output\n"
+        "    -t  Minimum time to run each benchmark for, in milliseconds (default 200)\n"
+        "    -r  Read sysfs and procfs files of collectors under this root, such as one replayed by sysrec,\n"
+        "        instead of those of this machine and a fake sysfs tree for the collectors it lacks\n"
+        "    FILTER  Only run benchmarks whose name contains one of these\n"
+        "\n";
+
+    fputs( message, stderr );
+    exit( status );
+}
+
+int main(int argc, char **argv)
+{
+    extern char *optarg;
+    extern int optind;
+    int c;
+
+    std::string format = "text";
+    std::string output = "/dev/stdout";
+    int targetMs = 200;
+    bool verbose = false;
+    std::string sysroot;
+
+    while( ( c = getopt(argc, argv, "hvf:o:t:r:") ) != -1 )
+    {
+        switch( c )
+        {
+            case 'h':
+                usage( 0 );
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            case 'f':
+                format = optarg;
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 't':
+                targetMs = atoi( optarg );
+                break;
+            case 'r':
+                sysroot = optarg;
+                break;
+            default:
+                usage( 2 );
+                break;
+        }
+    }
+
+    if( format != "text" && format != "json" && format != "csv" )
+    {
+        fprintf( stderr, "ERROR: unknown format %s\n", format.c_str() );
+        usage( 2 );
+    }
+
+    FakeTree tree;
+    if( !tree.valid() )
+    {
+        fprintf( stderr, "ERROR: cannot create a temporary directory\n" );
+        return 1;
+    }
+
+    // The library logs to standard output, which may be where our results go
+    fflush( stdout );
+    const int savedStdout = dup( STDOUT_FILENO );
+    if( !verbose )
+    {
+        const int devnull = open( "/dev/null", O_WRONLY );
+        dup2( devnull, STDOUT_FILENO );
+        close( devnull );
+    }
+
+    Bench bench( (int64_t)targetMs * 1000000, std::vector<std::string>( argv + optind, argv + argc ) );
+    SysReadBatch::setCountSyscalls( true );
+    writeFakeSysfs( tree );
+    benchSysfs( bench, tree );
+    benchSysRead( bench, tree );
+    benchCollectors( bench, tree, sysroot );
+    benchFerret( bench, tree );
+    benchResults( bench, tree );
+    benchPerfScope( bench );
+
+    fflush( stdout );
+    dup2( savedStdout, STDOUT_FILENO );
+    close( savedStdout );
+
+    OutputBuffer out;
+    if( !out.open( output ) )
+    {
+        return 1;
+    }
+    if( format == "json" )
+    {
+        writeJSON( out, bench.results() );
+    }
+    else if( format == "csv" )
+    {
+        writeCSV( out, bench.results() );
+    }
+    else
+    {
+        writeText( out, bench.results() );
+    }
+    return out.close() ? 0 : 1;
+}
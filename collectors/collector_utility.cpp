@@ -1,5 +1,6 @@
 #include "collector_utility.hpp"
 
+#include <ctype.h>
 #include <dirent.h>
 #include <string.h>
 #include <string>
@@ -271,3 +272,76 @@ bool file_exists(const std::string& name)
   struct stat buffer;   
   return (stat(name.c_str(), &buffer) == 0); 
 }
+
+
+std::string readFirstLine(const std::string& path)
+{
+    char buf[256];
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return std::string();
+    }
+    const ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0)
+    {
+        return std::string();
+    }
+    buf[len] = '\0';
+    return std::string(buf, strcspn(buf, "\n"));
+}
+
+
+std::string sanitizeMetricName(const std::string& name)
+{
+    std::string result = name;
+    for (char& c : result)
+    {
+        if (!isalnum((unsigned char)c) && c != '_' && c != '-') c = '_';
+    }
+    return result;
+}
+
+
+const char* findKeyValue(const char* text, const char* key, size_t length)
+{
+    for (const char* line = text; *line; )
+    {
+        if (strncmp(line, key, length) == 0)
+        {
+            const char* p = line + length;
+            if (*p == ':') return p + 1;
+            if (*p == ' ' || *p == '\t') return p;
+        }
+        line = strchr(line, '\n');
+        if (!line) break;
+        line++;
+    }
+    return nullptr;
+}
+
+
+std::vector<std::string> listDirectory(const std::string& path, const std::string& prefix)
+{
+    std::vector<std::string> names;
+    DIR* dir = opendir(path.c_str());
+    if (!dir)
+    {
+        return names;
+    }
+    while (struct dirent* entry = readdir(dir))
+    {
+        if (entry->d_name[0] != '.' && strncmp(entry->d_name, prefix.c_str(), prefix.size()) == 0)
+        {
+            names.push_back(entry->d_name);
+        }
+    }
+    closedir(dir);
+    // Natural order, so that thermal_zone10 comes after thermal_zone9
+    std::sort(names.begin(), names.end(), [](const std::string& a, const std::string& b)
+    {
+        return a.size() != b.size() ? a.size() < b.size() : a < b;
+    });
+    return names;
+}
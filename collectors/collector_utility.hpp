@@ -11,6 +11,30 @@ void splitString(const char* s, char delimiter, std::vector<std::string>& tokens
 bool DDKHasInstrCompiledIn(const std::string &keyword);
 std::string getMidgardInstrConfigPath();
 std::string getMidgardInstrOutputPath();
+/// First line of a small file such as a sysfs attribute, without the newline, or empty on failure
+std::string readFirstLine(const std::string& path);
+/// Names of the entries of a directory that start with prefix, shorter names first
+std::vector<std::string> listDirectory(const std::string& path, const std::string& prefix = "");
+/// Replace characters that do not survive CSV headers and JSON keys unquoted in a metric name
+std::string sanitizeMetricName(const std::string& name);
+/// Text following 'key' and then ':' or blanks at the start of a line, as in /proc/meminfo or
+/// /proc/vmstat, or null if no line has it
+const char* findKeyValue(const char* text, const char* key, size_t length);
+/// Parse the next unsigned number, skipping blanks and newlines before it, and move p past it.
+/// Much cheaper than strtoull(), since sysfs and procfs never have signs, other bases or locales.
+inline bool parseNumber(const char*& p, uint64_t& value)
+{
+    while (*p == ' ' || *p == '\t' || *p == '\n') p++;
+    if (*p < '0' || *p > '9') return false;
+    uint64_t v = 0;
+    while (*p >= '0' && *p <= '9')
+    {
+        v = v * 10 + (*p - '0');
+        p++;
+    }
+    value = v;
+    return true;
+}
 
 
 // Hack to workaround strange missing support for std::to_string in Android
@@ -4,63 +4,140 @@
 #include <errno.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <algorithm>
+
+static inline bool nextNumber(const char*& p, int64_t& value)
+{
+    uint64_t v;
+    if (!parseNumber(p, v)) return false;
+    value = v;
+    return true;
+}
+
+// Parse the next "frequency time" line of a time_in_state file, moving p past it
+static inline bool nextState(const char*& p, int64_t& freq, int64_t& times)
+{
+    return nextNumber(p, freq) && nextNumber(p, times);
+}
+
+bool CPUFreqCollector::addPolicy(const std::string& path, int number, const std::vector<int>& cpus)
+{
+    const std::string freqPath = sysPath(path + "/scaling_cur_freq");
+    if (access(freqPath.c_str(), R_OK) != 0)
+    {
+        return false;
+    }
+    const int tis = mReader.add(sysPath(path + "/stats/time_in_state"), 1024);
+    const int cf = tis < 0 ? mReader.add(freqPath, 64) : -1;
+    if (tis < 0 && cf < 0)
+    {
+        return false;
+    }
+    mPolicies.emplace_back();
+    CPUFreqPolicy& p = mPolicies.back();
+    p.freq_file = cf;
+    p.freq_path = freqPath;
+    p.time_in_state = tis;
+    p.number = number;
+    p.cpus = cpus;
+    return true;
+}
 
 bool CPUFreqCollector::init()
 {
     // Just in case, clean up...
     deinit();
+    mPolicies.clear();
     mCores.clear();
 
-    // find all CPU cores
-    std::string filename_cf = "/sys/devices/system/cpu/cpu0/cpufreq/scaling_cur_freq";
-    int core = 0;
-    FILE *cf = fopen(filename_cf.c_str(), "r");
-    while (cf)
+    // find all policies, and the cores that belong to them
+    const std::string policyDir = "/sys/devices/system/cpu/cpufreq/";
+    for (const std::string& name : listDirectory(sysPath(policyDir), "policy"))
     {
-        long freq = 0;
-        long times = 0;
-        std::string filename_tis = "/sys/devices/system/cpu/cpu" + _to_string(core) + "/cpufreq/stats/time_in_state";
-        FILE *tis = fopen(filename_tis.c_str(), "r");
-        mCores.emplace_back(tis, cf, core, "cpu_" + _to_string(core));
-        while (tis && fscanf(tis, "%ld %ld\n", &freq, &times) == 2)
+        const int number = atoi(name.c_str() + strlen("policy"));
+        std::vector<int> cpus;
+        const std::string related = readFirstLine(sysPath(policyDir + name + "/related_cpus"));
+        const char* p = related.c_str();
+        int64_t cpu = 0;
+        while (nextNumber(p, cpu))
         {
-            mCores.back().frequencies.push_back(freq);
+            cpus.push_back(cpu);
         }
+        if (cpus.empty())
+        {
+            cpus.push_back(number);
+        }
+        addPolicy(policyDir + name, number, cpus);
+    }
+    const bool clusters = !mPolicies.empty();
 
-        core++;
-        std::string filename_cf = "/sys/devices/system/cpu/cpu" + _to_string(core) + "/cpufreq/scaling_cur_freq";
-        cf = fopen(filename_cf.c_str(), "r");
+    // older kernels only have per-core directories
+    for (int core = 0; !clusters; core++)
+    {
+        if (!addPolicy("/sys/devices/system/cpu/cpu" + _to_string(core) + "/cpufreq", core, std::vector<int>(1, core)))
+        {
+            break;
+        }
     }
-    return core > 0;
-}
 
-bool CPUFreqCollector::deinit()
-{
+    for (unsigned i = 0; i < mPolicies.size(); i++)
+    {
+        for (int cpu : mPolicies[i].cpus)
+        {
+            Core c;
+            c.core = cpu;
+            c.corename = "cpu_" + _to_string(cpu);
+            c.policy = i;
+            mCores.push_back(c);
+        }
+    }
+    std::sort(mCores.begin(), mCores.end(), [](const Core& a, const Core& b) { return a.core < b.core; });
+    mCores.erase(std::unique(mCores.begin(), mCores.end(), [](const Core& a, const Core& b) { return a.core == b.core; }), mCores.end());
     for (Core& c : mCores)
     {
-        if (c.time_in_state)
+        c.handle = registerMetric(c.corename, true); // kHz fits in 32 bits
+    }
+    for (CPUFreqPolicy& p : mPolicies)
+    {
+        if (clusters)
         {
-            fclose(c.time_in_state);
-            c.time_in_state = nullptr;
+            p.handle = registerMetric("cluster_" + _to_string(p.number), true);
         }
-        fclose(c.freq_file);
-        c.freq_file = nullptr;
+        if (mDebug) DBG_LOG("%s: Policy %d has %u cores, %s time_in_state\n", mName.c_str(), p.number, (unsigned)p.cpus.size(), p.time_in_state >= 0 ? "with" : "without");
+    }
+    mHighestAvg = registerMetric("highest_avg", true);
+    return !mCores.empty();
+}
+
+bool CPUFreqCollector::deinit()
+{
+    mReader.clear();
+    for (CPUFreqPolicy& p : mPolicies)
+    {
+        p.time_in_state = -1;
+        p.freq_file = -1;
     }
     return true;
 }
 
 bool CPUFreqCollector::start()
 {
-    for (Core& c : mCores)
+    mReader.read();
+    for (CPUFreqPolicy& p : mPolicies)
     {
-        long freq = 0;
-        long times = 0;
-        if (c.time_in_state)
+        p.frequencies.clear();
+        p.times.clear();
+        p.last = -1;
+        if (p.time_in_state >= 0)
         {
-            rewind(c.time_in_state);
-            while (fscanf(c.time_in_state, "%ld %ld\n", &freq, &times) == 2)
+            int64_t freq = 0;
+            int64_t times = 0;
+            const char* s = mReader.data(p.time_in_state);
+            while (nextState(s, freq, times))
             {
-                c.times.push_back(times);
+                p.frequencies.push_back(freq);
+                p.times.push_back(times);
             }
         }
     }
@@ -69,56 +146,61 @@ bool CPUFreqCollector::start()
 
 bool CPUFreqCollector::collect(int64_t /* now */)
 {
+    mReader.read(); // all policies at once, unless already read together with other collectors
     int64_t highest_avg = 0;
-    for (Core& c : mCores)
+    for (CPUFreqPolicy& p : mPolicies)
     {
-        long freq = 0;
         int64_t sum = 0;
         int64_t values = 0;
-        if (c.time_in_state)
+        if (p.time_in_state >= 0)
         {
-            int idx = 0;
-            long times = 0;
-            rewind(c.time_in_state);
-            while (fscanf(c.time_in_state, "%ld %ld\n", &freq, &times) == 2)
+            unsigned idx = 0;
+            int64_t freq = 0;
+            int64_t times = 0;
+            const char* s = mReader.data(p.time_in_state);
+            while (idx < p.times.size() && nextState(s, freq, times))
             {
-                const int64_t relative = times - c.times[idx]; // want value relative to last sampling point
-                sum += relative * c.frequencies[idx];
+                const int64_t relative = times - p.times[idx]; // want value relative to last sampling point
+                sum += relative * p.frequencies[idx];
                 values += relative;
-                c.times[idx] = times;
+                p.times[idx] = times;
                 idx++;
             }
         }
         else
         {
-            rewind(c.freq_file);
-            while (fscanf(c.freq_file, "%ld\n", &freq) == 1)
-            {
-                sum = freq;
-                values = 1;
-            }
+            const char* s = mReader.data(p.freq_file);
+            nextNumber(s, sum);
+            values = 1;
         }
         if (sum == 0) // this can happen - time_in_state updates relatively slowly - so reuse previous result
         {
-            if (mResults[c.corename].size() == 0) // no previous result?
+            if (p.last < 0) // no previous result?
             {
-                // Just read the current frequency
-                rewind(c.freq_file);
-                int r = fscanf(c.freq_file, "%ld", &freq);
-                (void)r; // elaborate way to silence compiler
-                sum = freq;
+                // Just use the current frequency. Without time_in_state we already have it, otherwise
+                // read it on demand, as only the first sample needs it.
+                const std::string freq = p.time_in_state >= 0 ? readFirstLine(p.freq_path) : "";
+                const char* s = freq.c_str();
+                nextNumber(s, sum);
             }
             else
             {
-                sum = mResults[c.corename].data().back().i64; // reuse
+                sum = p.last; // reuse
             }
             values = 1;
         }
-        const int64_t avg = sum / values;
-        add(c.corename, avg);
-        highest_avg = avg > highest_avg ? avg : highest_avg;
+        p.last = sum / values;
+        if (p.handle >= 0)
+        {
+            add(p.handle, p.last);
+        }
+        highest_avg = p.last > highest_avg ? p.last : highest_avg;
+    }
+    for (const Core& c : mCores)
+    {
+        add(c.handle, mPolicies[c.policy].last);
     }
-    add("highest_avg", highest_avg);
+    add(mHighestAvg, highest_avg);
     return true;
 }
 
@@ -1,29 +1,37 @@
 #pragma once
 
-#include <cassert>
-#include <list>
+#include <vector>
 
 #include "interface.hpp"
 
+// A cpufreq policy, which is a cluster of cores that always run at the same frequency. Its files
+// are read once per sample, and the result is used for all of its cores.
+struct CPUFreqPolicy
+{
+    int time_in_state = -1; // reader slots
+    int freq_file = -1; // only without time_in_state
+    std::string freq_path; // scaling_cur_freq, for when time_in_state has no answer yet
+    int number = -1; // policy number, which is its first core
+    std::vector<int> cpus; // related_cpus
+    std::vector<int64_t> frequencies; // states
+    std::vector<int64_t> times; // times in state
+    int64_t last = -1; // previous average frequency
+    MetricHandle handle = -1; // cluster result, if the kernel has policies
+};
+
 struct Core
 {
-    FILE *time_in_state = nullptr;
-    FILE *freq_file = nullptr;
     int core = -1; // core number
     std::string corename;
-    std::vector<int> frequencies; // states
-    std::vector<int64_t> times; // times in state
-
-    Core(FILE* tis, FILE* cf, int c, const std::string& n)
-        : time_in_state(tis), freq_file(cf), core(c), corename(n) {}
-
-    ~Core()
-    {
-        assert(time_in_state == nullptr);
-        assert(freq_file == nullptr);
-    }
+    unsigned policy = 0; // index into the policies
+    MetricHandle handle = -1;
 };
 
+// Average frequency in kHz of each core over the sample as "cpu_<core>", the average of each
+// cpufreq policy as "cluster_<policy>", and the highest of those as "highest_avg". Frequencies come
+// from time_in_state where available and scaling_cur_freq otherwise, so each policy needs one file
+// read per sample. Kernels without cpufreq policy directories are read per core, without cluster
+// results.
 class CPUFreqCollector : public Collector
 {
     using Collector::Collector;
@@ -34,7 +42,13 @@ public:
     virtual bool start() override;
     virtual bool collect(int64_t) override;
     virtual bool available() override;
+    virtual SysReader* reader() override { return &mReader; }
 
 private:
-    std::list<Core> mCores;
+    bool addPolicy(const std::string& path, int number, const std::vector<int>& cpus);
+
+    SysReader mReader;
+    std::vector<CPUFreqPolicy> mPolicies;
+    std::vector<Core> mCores;
+    MetricHandle mHighestAvg = -1;
 };
@@ -0,0 +1,135 @@
+#include "cpuidle.hpp"
+
+#include "collector_utility.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <set>
+
+bool CPUIdleCollector::init()
+{
+    deinit();
+    const std::string cpuDir = sysPath("/sys/devices/system/cpu/");
+    for (const std::string& cpu : listDirectory(cpuDir, "cpu"))
+    {
+        if (cpu.size() <= 3 || strspn(cpu.c_str() + 3, "0123456789") != cpu.size() - 3)
+        {
+            continue; // cpufreq, cpuidle and so on
+        }
+        const std::string prefix = "cpu_" + cpu.substr(3) + "_";
+        const std::string dir = cpuDir + cpu + "/cpuidle/";
+        Core core;
+        std::set<std::string> names;
+        for (const std::string& state : listDirectory(dir, "state"))
+        {
+            State s;
+            s.time = mReader.add(dir + state + "/time", 32);
+            if (s.time < 0)
+            {
+                continue;
+            }
+            s.usage = mReader.add(dir + state + "/usage", 32);
+            std::string name = sanitizeMetricName(readFirstLine(dir + state + "/name"));
+            if (name.empty() || !names.insert(name).second)
+            {
+                name = state; // no name, or not a unique one
+            }
+            s.timeHandle = registerMetric(prefix + name, true); // microseconds per sample fit in 32 bits
+            if (s.usage >= 0)
+            {
+                s.usageHandle = registerMetric(prefix + name + "_usage", true);
+            }
+            if (mDebug) DBG_LOG("%s: Reading %s as %s\n", mName.c_str(), (dir + state).c_str(), (prefix + name).c_str());
+            core.states.push_back(s);
+        }
+        if (core.states.empty())
+        {
+            continue; // no cpuidle driver, or an offline core
+        }
+        core.busyHandle = registerMetric(prefix + "busy");
+        mCores.push_back(core);
+    }
+    if (mCores.empty())
+    {
+        return false;
+    }
+    mBusy = registerMetric("busy");
+    return true;
+}
+
+bool CPUIdleCollector::deinit()
+{
+    mReader.clear();
+    mCores.clear();
+    mIdle.clear();
+    return true;
+}
+
+void CPUIdleCollector::update(bool store)
+{
+    mReader.read();
+    mIdle.assign(mCores.size(), 0);
+    for (unsigned i = 0; i < mCores.size(); i++)
+    {
+        for (State& s : mCores[i].states)
+        {
+            const int64_t time = s.timeDelta.update(strtoull(mReader.data(s.time), nullptr, 10));
+            mIdle[i] += time;
+            if (store)
+            {
+                add(s.timeHandle, time);
+            }
+            if (s.usage >= 0)
+            {
+                const int64_t usage = s.usageDelta.update(strtoull(mReader.data(s.usage), nullptr, 10));
+                if (store)
+                {
+                    add(s.usageHandle, usage);
+                }
+            }
+        }
+    }
+}
+
+bool CPUIdleCollector::start()
+{
+    for (Core& c : mCores)
+    {
+        for (State& s : c.states)
+        {
+            s.timeDelta.reset();
+            s.usageDelta.reset();
+        }
+    }
+    update(false);
+    mLastTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    return Collector::start();
+}
+
+bool CPUIdleCollector::collect(int64_t now)
+{
+    update(true);
+    const int64_t elapsed = now - mLastTime;
+    mLastTime = now;
+    double total = 0.0;
+    for (unsigned i = 0; i < mCores.size(); i++)
+    {
+        double busy = 0.0;
+        if (elapsed > 0)
+        {
+            busy = 1.0 - (double)mIdle[i] / elapsed;
+            busy = busy < 0.0 ? 0.0 : busy > 1.0 ? 1.0 : busy; // counters and clock are not read at the same instant
+        }
+        add(mCores[i].busyHandle, busy);
+        total += busy;
+    }
+    add(mBusy, total / mCores.size());
+    return true;
+}
+
+bool CPUIdleCollector::available()
+{
+    return access(sysPath("/sys/devices/system/cpu/cpu0/cpuidle/state0/time").c_str(), R_OK) == 0;
+}
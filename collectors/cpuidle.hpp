@@ -0,0 +1,50 @@
+#pragma once
+
+#include "interface.hpp"
+
+// Idle state residency of every core from /sys/devices/system/cpu/cpu*/cpuidle. For each core
+// and idle state, the microseconds spent in the state during the sample are stored as
+// "cpu_<core>_<state>" and the number of times it was entered as "cpu_<core>_<state>_usage",
+// where state is the name the driver gives it, such as "WFI". The fraction of the sample each
+// core was not idle is "cpu_<core>_busy", and its average over all cores is "busy", which
+// together with cpufreq tells how much work the cores did. All files are read together once per
+// sample.
+class CPUIdleCollector : public Collector
+{
+public:
+    using Collector::Collector;
+
+    virtual bool init() override;
+    virtual bool deinit() override;
+    virtual bool start() override;
+    virtual bool collect(int64_t) override;
+    /// Checks that an idle state of the first core is readable, without opening it
+    virtual bool available() override;
+    virtual SysReader* reader() override { return &mReader; }
+
+private:
+    struct State
+    {
+        int time = -1; // reader slots
+        int usage = -1;
+        CounterDelta timeDelta;
+        CounterDelta usageDelta;
+        MetricHandle timeHandle = -1;
+        MetricHandle usageHandle = -1;
+    };
+
+    struct Core
+    {
+        std::vector<State> states;
+        MetricHandle busyHandle = -1;
+    };
+
+    /// Read all counters, returning the idle time of each core since the previous call
+    void update(bool store);
+
+    SysReader mReader;
+    std::vector<Core> mCores;
+    std::vector<int64_t> mIdle; // per core, from the last update
+    MetricHandle mBusy = -1;
+    int64_t mLastTime = -1;
+};
@@ -0,0 +1,183 @@
+#include "cpustat.hpp"
+
+#include "collector_utility.hpp"
+
+#include <string.h>
+#include <unistd.h>
+
+static const char* kindNames[] = { "user", "system", "irq", "softirq", "iowait", "idle" };
+
+static inline const char* nextLine(const char* p)
+{
+    p = strchr(p, '\n');
+    return p ? p + 1 : nullptr;
+}
+
+// Parse the times of a "cpu" line, after its name, into the kinds we store
+static bool parseTimes(const char* p, uint64_t* times)
+{
+    // user nice system idle iowait irq softirq, then steal and guests, which we do not need
+    uint64_t v[7];
+    for (uint64_t& value : v)
+    {
+        if (!parseNumber(p, value)) return false;
+    }
+    times[0] = v[0] + v[1]; // USER
+    times[1] = v[2]; // SYSTEM
+    times[2] = v[5]; // IRQ
+    times[3] = v[6]; // SOFTIRQ
+    times[4] = v[4]; // IOWAIT
+    times[5] = v[3]; // IDLE
+    return true;
+}
+
+CPUStatCollector::CPUStatCollector(const Json::Value& config, const std::string& name)
+    : Collector(config, name),
+      mTicks(sysconf(_SC_CLK_TCK))
+{
+    if (mTicks <= 0)
+    {
+        mTicks = 100; // the usual USER_HZ
+    }
+}
+
+bool CPUStatCollector::init()
+{
+    deinit();
+    mSlot = mReader.add(sysPath("/proc/stat"), 4096);
+    if (mSlot < 0 || !mReader.read())
+    {
+        DBG_LOG("%s: Cannot read /proc/stat\n", mName.c_str());
+        return false;
+    }
+
+    // Find the cores that are online now
+    std::vector<int> cores;
+    for (const char* line = mReader.data(mSlot); line; line = nextLine(line))
+    {
+        if (strncmp(line, "cpu", 3) == 0 && line[3] >= '0' && line[3] <= '9')
+        {
+            const char* p = line + 3;
+            uint64_t core = 0;
+            parseNumber(p, core);
+            cores.push_back(core);
+        }
+    }
+    mCpus.resize(cores.size() + 1);
+    for (unsigned i = 0; i < mCpus.size(); i++)
+    {
+        const std::string prefix = i == 0 ? "cpu_" : "cpu_" + _to_string(cores[i - 1]) + "_";
+        for (int k = 0; k < KINDS; k++)
+        {
+            mCpus[i].handles[k] = registerMetric(prefix + kindNames[k], true); // milliseconds per sample fit in 32 bits
+        }
+        if (i > 0)
+        {
+            if ((unsigned)cores[i - 1] >= mIndex.size()) mIndex.resize(cores[i - 1] + 1, -1);
+            mIndex[cores[i - 1]] = i;
+        }
+    }
+    mContextSwitchesHandle = registerMetric("context_switches", true);
+    mForksHandle = registerMetric("forks", true);
+    return true;
+}
+
+bool CPUStatCollector::deinit()
+{
+    mReader.clear();
+    mSlot = -1;
+    mCpus.clear();
+    mIndex.clear();
+    return true;
+}
+
+bool CPUStatCollector::update(bool store)
+{
+    if (!mReader.read())
+    {
+        DBG_LOG("%s: Failed to read /proc/stat\n", mName.c_str());
+        return false;
+    }
+    for (Cpu& c : mCpus)
+    {
+        c.seen = false;
+    }
+    uint64_t contextSwitches = 0;
+    uint64_t forks = 0;
+    for (const char* line = mReader.data(mSlot); line; line = nextLine(line))
+    {
+        if (strncmp(line, "cpu", 3) == 0)
+        {
+            const char* p = line + 3;
+            int index = 0;
+            if (*p != ' ')
+            {
+                uint64_t core = 0;
+                parseNumber(p, core);
+                index = core < mIndex.size() ? mIndex[core] : -1;
+            }
+            uint64_t times[KINDS];
+            if (index < 0 || !parseTimes(p, times))
+            {
+                continue; // a core that came online later, which has no metrics
+            }
+            Cpu& c = mCpus[index];
+            c.seen = true;
+            for (int k = 0; k < KINDS; k++)
+            {
+                const int64_t ms = c.deltas[k].update(times[k]) * 1000 / mTicks;
+                if (store) add(c.handles[k], ms);
+            }
+        }
+        else if (strncmp(line, "ctxt ", 5) == 0)
+        {
+            const char* p = line + 5;
+            parseNumber(p, contextSwitches);
+        }
+        else if (strncmp(line, "processes ", 10) == 0)
+        {
+            const char* p = line + 10;
+            parseNumber(p, forks);
+        }
+    }
+    const int64_t contextSwitchesDelta = mContextSwitches.update(contextSwitches);
+    const int64_t forksDelta = mForks.update(forks);
+    if (store)
+    {
+        for (Cpu& c : mCpus)
+        {
+            for (int k = 0; k < KINDS && !c.seen; k++)
+            {
+                add(c.handles[k], 0); // keep all metrics the same length as the sample times
+            }
+        }
+        add(mContextSwitchesHandle, contextSwitchesDelta);
+        add(mForksHandle, forksDelta);
+    }
+    return true;
+}
+
+bool CPUStatCollector::start()
+{
+    for (Cpu& c : mCpus)
+    {
+        for (CounterDelta& d : c.deltas)
+        {
+            d.reset();
+        }
+    }
+    mContextSwitches.reset();
+    mForks.reset();
+    update(false);
+    return Collector::start();
+}
+
+bool CPUStatCollector::collect(int64_t /* now */)
+{
+    return update(true);
+}
+
+bool CPUStatCollector::available()
+{
+    return access(sysPath("/proc/stat").c_str(), R_OK) == 0;
+}
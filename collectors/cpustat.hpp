@@ -0,0 +1,53 @@
+#pragma once
+
+#include "interface.hpp"
+
+// System-wide CPU time from /proc/stat, for all processes and not only ours. For all cores
+// together as "cpu_<kind>" and for each core as "cpu_<core>_<kind>", the milliseconds spent in
+// user (including nice), system, irq, softirq, iowait and idle time during the sample. Cores that
+// are offline during a sample get zeroes. Also "context_switches" and "forks", the number of each
+// during the sample. None of these wrap around, and times that go backwards, as iowait can, give
+// zero for the sample. The file is read once per sample and parsed in place, without allocations.
+class CPUStatCollector : public Collector
+{
+public:
+    CPUStatCollector(const Json::Value& config, const std::string& name);
+
+    virtual bool init() override;
+    virtual bool deinit() override;
+    virtual bool start() override;
+    virtual bool collect(int64_t) override;
+    virtual bool available() override;
+    virtual SysReader* reader() override { return &mReader; }
+
+private:
+    enum Kind { USER, SYSTEM, IRQ, SOFTIRQ, IOWAIT, IDLE, KINDS };
+
+    struct Cpu
+    {
+        Cpu()
+        {
+            for (CounterDelta& d : deltas)
+            {
+                d = CounterDelta(CounterDelta::CLAMP); // iowait can go backwards, see proc(5)
+            }
+        }
+
+        CounterDelta deltas[KINDS];
+        MetricHandle handles[KINDS];
+        bool seen = false; // in the last update, otherwise offline
+    };
+
+    /// Parse the file, storing differences to the previous update if store is set
+    bool update(bool store);
+
+    SysReader mReader;
+    int mSlot = -1;
+    long mTicks;
+    std::vector<Cpu> mCpus; // all cores together first
+    std::vector<int> mIndex; // of each core in mCpus, or -1
+    CounterDelta mContextSwitches{CounterDelta::CLAMP};
+    CounterDelta mForks{CounterDelta::CLAMP};
+    MetricHandle mContextSwitchesHandle = -1;
+    MetricHandle mForksHandle = -1;
+};
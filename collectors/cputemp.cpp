@@ -4,6 +4,8 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <map>
 
 template<typename TK, typename TV>
@@ -33,7 +35,9 @@ CPUTemperatureCollector::CPUTemperatureCollector(const Json::Value& config, cons
 {
 }
 
-bool CPUTemperatureCollector::parse(const char* buffer)
+// Calls f(value) for each number in the file, after any "name:" prefix. Returns false if there are none.
+template<typename F>
+static bool parseTemperatures(const char* buffer, F f)
 {
     const char *end = buffer;
     int count = 0;
@@ -52,9 +56,48 @@ bool CPUTemperatureCollector::parse(const char* buffer)
         }
         end = tmp;
         if (*end != '\0') end++; // skip delimiter, unless at end of string
-        add("cpu_temperature_" + _to_string(count), temp / option_map.at(mSysfsFile));
+        f(temp);
         count++;
     }
     while (end != NULL && *end != '\0');
     return true;
 }
+
+bool CPUTemperatureCollector::init()
+{
+    if (!SysfsCollector::init())
+    {
+        return false;
+    }
+    mDivisor = option_map.at(mSysfsFile);
+
+    // Register a metric for each temperature the file holds now, so that sampling never has to
+    // register one on the sampler thread
+    char buffer[1024];
+    const int fd = open(sysPath(mSysfsFile).c_str(), O_RDONLY);
+    const ssize_t len = fd >= 0 ? read(fd, buffer, sizeof(buffer) - 1) : -1;
+    if (fd >= 0) close(fd);
+    buffer[len > 0 ? len : 0] = '\0';
+    int count = 0;
+    if (!parseTemperatures(buffer, [&count](double) { count++; }))
+    {
+        DBG_LOG("%s: No temperatures in %s: \"%s\"\n", mName.c_str(), mSysfsFile.c_str(), buffer);
+        return false;
+    }
+    mHandles.clear();
+    for (int i = 0; i < count; i++)
+    {
+        mHandles.push_back(registerMetric("cpu_temperature_" + _to_string(i), true));
+    }
+    return true;
+}
+
+bool CPUTemperatureCollector::parse(const char* buffer)
+{
+    size_t i = 0;
+    return parseTemperatures(buffer, [this, &i](double temp)
+    {
+        if (i < mHandles.size()) add(mHandles[i], temp / mDivisor); // values that appeared later are ignored
+        i++;
+    });
+}
@@ -7,6 +7,13 @@ class CPUTemperatureCollector : public SysfsCollector
 public:
     CPUTemperatureCollector(const Json::Value& config, const std::string& name);
 
+    virtual bool init() override;
+
 protected:
     virtual bool parse(const char* buffer) override;
+
+private:
+    /// One handle per temperature value found in the sysfs file at init
+    std::vector<MetricHandle> mHandles;
+    double mDivisor = 1.0;
 };
@@ -0,0 +1,163 @@
+#include "devfreq.hpp"
+
+#include "collector_utility.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char* devfreqClass(const std::string& name)
+{
+    static const struct { const char* pattern; const char* type; } classes[] =
+    {
+        { "gpu", "gpu" }, { "mali", "gpu" }, { "kgsl", "gpu" }, { "g3d", "gpu" }, { "gk20a", "gpu" }, { "pvr", "gpu" },
+        { "disp", "display" }, { "dpu", "display" }, { "mdss", "display" },
+        { "mif", "memory" }, { "ddr", "memory" }, { "dmc", "memory" }, { "bw", "memory" }, { "memlat", "memory" }, { "llcc", "memory" },
+        { "int", "interconnect" }, { "bus", "interconnect" }, { "noc", "interconnect" },
+    };
+    for (const auto& c : classes)
+    {
+        if (name.find(c.pattern) != std::string::npos)
+        {
+            return c.type;
+        }
+    }
+    return "other";
+}
+
+// Rows look like "*  100000000:    0    3    1234", where the star marks the current frequency,
+// followed by transition counts to each frequency and the time spent at this one
+bool parseDevfreqTransStat(const char* text, std::vector<int64_t>& frequencies, std::vector<int64_t>& times)
+{
+    frequencies.clear();
+    times.clear();
+    for (const char* line = text; line && *line; line = strchr(line, '\n'), line = line ? line + 1 : nullptr)
+    {
+        const char* p = line;
+        while (*p == ' ' || *p == '*' || *p == '\t') p++;
+        char* end;
+        const int64_t freq = strtoll(p, &end, 10);
+        if (end == p) continue; // a header, or the total
+        p = end;
+        while (*p == ' ') p++;
+        if (*p != ':') continue;
+        p++;
+        int64_t last = -1;
+        while (true)
+        {
+            const int64_t v = strtoll(p, &end, 10);
+            if (end == p) break;
+            last = v;
+            p = end;
+            while (*p == ' ' || *p == '\t') p++;
+            if (*p == '\n') break;
+        }
+        if (last < 0) continue;
+        frequencies.push_back(freq);
+        times.push_back(last);
+    }
+    return !frequencies.empty();
+}
+
+bool DevfreqCollector::init()
+{
+    deinit();
+    const std::string dir = sysPath("/sys/class/devfreq/");
+    const Json::Value& filter = mConfig["devices"];
+    for (const std::string& name : listDirectory(dir))
+    {
+        bool wanted = !filter.isArray() || filter.size() == 0;
+        for (unsigned i = 0; !wanted && i < filter.size(); i++)
+        {
+            wanted = name.find(filter[i].asString()) != std::string::npos;
+        }
+        if (!wanted)
+        {
+            continue;
+        }
+        Device d;
+        d.name = name;
+        d.curFreq = mReader.add(dir + name + "/cur_freq", 32);
+        if (d.curFreq < 0)
+        {
+            if (mDebug) DBG_LOG("%s: Cannot read the frequency of %s\n", mName.c_str(), name.c_str());
+            continue;
+        }
+        d.transStat = mReader.add(dir + name + "/trans_stat", 1024);
+        d.handle = registerMetric(std::string(devfreqClass(name)) + "_" + name);
+        if (mDebug) DBG_LOG("%s: Found %s, %s trans_stat\n", mName.c_str(), name.c_str(), d.transStat >= 0 ? "with" : "without");
+        mDevices.push_back(d);
+    }
+    return !mDevices.empty();
+}
+
+bool DevfreqCollector::deinit()
+{
+    mReader.clear();
+    mDevices.clear();
+    return true;
+}
+
+bool DevfreqCollector::start()
+{
+    mReader.read();
+    for (Device& d : mDevices)
+    {
+        d.frequencies.clear();
+        d.times.clear();
+        if (d.transStat >= 0 && mReader.length(d.transStat) > 0)
+        {
+            parseDevfreqTransStat(mReader.data(d.transStat), d.frequencies, d.times);
+        }
+    }
+    return Collector::start();
+}
+
+bool DevfreqCollector::collect(int64_t /* now */)
+{
+    mReader.read();
+    for (Device& d : mDevices)
+    {
+        int64_t sum = 0;
+        int64_t total = 0;
+        if (d.transStat >= 0 && mReader.length(d.transStat) > 0 && parseDevfreqTransStat(mReader.data(d.transStat), mFrequencies, mTimes))
+        {
+            if (mFrequencies == d.frequencies) // otherwise the table changed, so start again from here
+            {
+                for (unsigned i = 0; i < mTimes.size(); i++)
+                {
+                    const int64_t relative = mTimes[i] - d.times[i];
+                    if (relative > 0)
+                    {
+                        sum += relative * (mFrequencies[i] / 1000); // kHz, so that this does not overflow
+                        total += relative;
+                    }
+                }
+            }
+            d.frequencies.swap(mFrequencies);
+            d.times.swap(mTimes);
+        }
+        if (total > 0)
+        {
+            add(d.handle, (long long)(sum / total * 1000));
+        }
+        else // no time passed in any state that we know of, so take the current frequency
+        {
+            add(d.handle, strtoll(mReader.data(d.curFreq), nullptr, 10));
+        }
+    }
+    return true;
+}
+
+bool DevfreqCollector::available()
+{
+    const std::string dir = sysPath("/sys/class/devfreq/");
+    for (const std::string& name : listDirectory(dir))
+    {
+        if (access((dir + name + "/cur_freq").c_str(), R_OK) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "interface.hpp"
+
+// Frequencies of every device in /sys/class/devfreq, such as GPUs and memory buses, in Hz. Each is
+// named after its class and device, as in "gpu_13000000.mali" or "memory_17000010.devfreq_mif".
+// The classes are gpu, memory, interconnect, display and other, guessed from the device name.
+//
+// Each sample is the average frequency since the previous one, weighted by the time spent at each
+// frequency according to trans_stat, so that short excursions between samples are not missed.
+// Devices without trans_stat, and samples during which its times did not move, use cur_freq
+// instead. All files are read together once per sample.
+//
+// Configuration:
+//  - devices: Only collect devices whose names contain one of these strings.
+class DevfreqCollector : public Collector
+{
+public:
+    using Collector::Collector;
+
+    virtual bool init() override;
+    virtual bool deinit() override;
+    virtual bool start() override;
+    virtual bool collect(int64_t) override;
+    /// Checks that a devfreq device is readable, without opening it
+    virtual bool available() override;
+    virtual SysReader* reader() override { return &mReader; }
+
+private:
+    struct Device
+    {
+        std::string name;
+        int transStat = -1;
+        int curFreq = -1;
+        std::vector<int64_t> frequencies; // states in trans_stat
+        std::vector<int64_t> times; // time in each state at the previous sample
+        MetricHandle handle = -1;
+    };
+
+    SysReader mReader;
+    std::vector<Device> mDevices;
+    std::vector<int64_t> mFrequencies; // scratch space for parsing
+    std::vector<int64_t> mTimes;
+};
+
+/// Parse the rows of a devfreq trans_stat table into their frequencies and time spent at each.
+/// Returns false if there are none.
+bool parseDevfreqTransStat(const char* text, std::vector<int64_t>& frequencies, std::vector<int64_t>& times);
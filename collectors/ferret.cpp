@@ -46,7 +46,7 @@ pid_stat_spec[] =
 
 void get_cpu_cores( std::vector<int>& cores )
 {
-    const std::string prefix = "/sys/devices/system/cpu/cpu";
+    const std::string prefix = sysPath( "/sys/devices/system/cpu/cpu" );
     const std::string suffix = "/cpufreq/scaling_cur_freq";
 
     for ( size_t i = 0; i < 256; ++i )
@@ -100,7 +100,6 @@ FerretCollector::FerretCollector( const Json::Value& config,
         }
     } else {
         if (mDebug) DBG_LOG( "%s: No cpu filter specified, monitoring all cores by default.\n", mName.c_str() );
-        get_cpu_cores( mCpus );
     }
 
     if( mConfig.isMember( "enable_postprocessing" ) )
@@ -182,17 +181,6 @@ FerretCollector::FerretCollector( const Json::Value& config,
         mIsThreaded = true;
         mSampleRate = 1000 / (2 * mClockTicks);
     }
-
-    /*
-     * Confirm setup
-     */
-
-    std::string cpuWatch = "";
-    for( auto cpu : mCpus )
-    {
-        cpuWatch += " " + _to_string( cpu );
-    }
-    if (mDebug) DBG_LOG( "%s: monitoring CPUs [%s]\n", mName.c_str(), cpuWatch.c_str() + 1 );
 }
 
 
@@ -211,13 +199,31 @@ bool FerretCollector::init( void )
         return mInitSuccess;
     }
 
+    /* The cores are only looked up here, so that merely constructing the collector stays cheap.
+     */
+    if( mCpus.size() == 0 && !mConfig.isMember( "cpus" ) )
+    {
+        get_cpu_cores( mCpus );
+    }
+
+    /*
+     * Confirm setup
+     */
+
+    std::string cpuWatch = "";
+    for( auto cpu : mCpus )
+    {
+        cpuWatch += " " + _to_string( cpu );
+    }
+    if (mDebug) DBG_LOG( "%s: monitoring CPUs [%s]\n", mName.c_str(), cpuWatch.c_str() + 1 );
+
     /* Be optimistic until proven otherwise.
      */
     mInitSuccess = true;
 
     open_cpufreq_fds();
 
-    if( mCpus.size() == 0 || ( mCpufreqFdMap.size() != mCpus.size() ) )
+    if( mCpus.size() == 0 || ( mCpufreqSlotMap.size() != mCpus.size() ) )
     {
         mInitSuccess = false;
 
@@ -284,14 +290,44 @@ bool FerretCollector::deinit( void )
 
 bool FerretCollector::available( void )
 {
-    /* available() is called before init() but we cannot know if we're available until
-     * try to init().
+    /* available() is called before init(), and may be called just to list collectors, so
+     * only check what init() depends on without opening anything.
      */
-    if( !mInitSuccess )
+    if( mInitSuccess )
     {
-        mInitSuccess = init();
+        return true;
     }
-    return mInitSuccess;
+
+    if( mProcessNames.size() && mStatusFd < 0 )
+    {
+        return false;
+    }
+
+#ifdef ANDROID
+    if( mOutputDir.size() == 0 )
+    {
+        return false;
+    }
+#endif
+
+    const std::string prefix = sysPath( "/sys/devices/system/cpu/cpu" );
+    const std::string suffix = "/cpufreq/scaling_cur_freq";
+
+    if( mCpus.size() == 0 )
+    {
+        /* Without a cpu filter, init() monitors every core with a readable frequency.
+         */
+        return !mConfig.isMember( "cpus" ) && access( ( prefix + "0" + suffix ).c_str(), R_OK ) == 0;
+    }
+
+    for( auto cpu : mCpus )
+    {
+        if( access( ( prefix + _to_string( cpu ) + suffix ).c_str(), R_OK ) != 0 )
+        {
+            return false;
+        }
+    }
+    return true;
 }
 
 
@@ -403,25 +439,18 @@ void FerretCollector::collect_freqs( void )
     std::string row_err;
     std::string row_freq;
 
-    for( auto it : mCpufreqFdMap )
+    for( auto it : mCpufreqSlotMap )
     {
         const int cpuNr = it.first;
-        const int fd = it.second;
-
-        const size_t bufsz = 100;
-        char buf[ bufsz + 1 ];
-
-        ssize_t ret = read( fd, buf, bufsz );
+        const int slot = it.second;
+        const ssize_t ret = mReader.length( slot );
 
         if( ret > 0 )
         {
-            lseek( fd, 0, SEEK_SET );
-
             /* Frequencies are always followed by a single unwanted newline.
              */
-            buf[ ret - 1 ] = '\0';
-
-            row_freq += " " + _to_string( cpuNr ) + " " + buf;
+            row_freq += " " + _to_string( cpuNr ) + " ";
+            row_freq.append( mReader.data( slot ), ret - 1 );
         }
         else
         {
@@ -457,7 +486,7 @@ void FerretCollector::collect_freqs( void )
  * @param[in]  buf  A buffer whose content is a stat file.
  * @param[out] row  The output buffer.
  */
-static void parse_stat( char *buf, std::string& row )
+void ferret_parse_stat( char *buf, std::string& row )
 {
     const ssize_t field_max = sizeof( pid_stat_spec ) / sizeof( pid_stat_spec[0] );
 
@@ -545,34 +574,25 @@ static void parse_stat( char *buf, std::string& row )
 
 void FerretCollector::collect_perproc( void )
 {
-    for( auto it = mPidFdMap.begin(); it != mPidFdMap.end(); ++it )
+    for( auto it = mPidSlotMap.begin(); it != mPidSlotMap.end(); ++it )
     {
-        int fd = it->second;
+        const int slot = it->second;
         std::string const& pid = it->first;
 
-        if( fd < 0 )
+        if( slot < 0 )
         {
             /* PID has already exited.
              */
             continue;
         }
 
-        const size_t bufsz = 4096;
-        char buf[ bufsz + 1 ];
-
-        ssize_t ret = read( fd, buf, bufsz );
-
-        if( ret > 0 )
+        if( mReader.length( slot ) > 0 )
         {
-            lseek( fd, 0, SEEK_SET );
-
-            /* NUL terminate the buffer.
-             */
-            buf[ ret ] = '\0';
-
             std::string row;
 
-            parse_stat( buf, row );
+            /* Parsing modifies the buffer, which is read again next time.
+             */
+            ferret_parse_stat( mReader.data( slot ), row );
 
             row.insert( 0, 1, 'S' );
             row += "\n";
@@ -587,7 +607,7 @@ void FerretCollector::collect_perproc( void )
             ssize_t wrote = write( mTraceFd, row.c_str(), row.size() );
 
             (void) wrote;
-            close( fd );
+            mReader.remove( slot );
 
             /* Mark the PID as "gone".
              */
@@ -694,7 +714,7 @@ bool FerretCollector::collect( int64_t now )
     notify( mStatusFd, 1 );
 
     /*
-     * Locate threads for all monitored PIDs, leaving fd's open in mPidFdMap.
+     * Locate threads for all monitored PIDs, leaving fd's open in mPidSlotMap.
      */
 
     enumerate_tasks( mPid );
@@ -710,6 +730,11 @@ bool FerretCollector::collect( int64_t now )
 
     (void) wrote;
 
+    /* Read all CPU frequencies and task stats at once, apart from any
+     * already read together with other collectors for this sample.
+     */
+    mReader.read();
+
     collect_freqs();
     collect_perproc();
 
@@ -721,11 +746,11 @@ bool FerretCollector::collect( int64_t now )
 
     for( auto pid : mPids )
     {
-        if( mPidFdMap.find( pid ) != mPidFdMap.end() )
+        if( mPidSlotMap.find( pid ) != mPidSlotMap.end() )
         {
             assert( active > 0 );
 
-            active -= ( mPidFdMap[ pid ] < 0 );
+            active -= ( mPidSlotMap[ pid ] < 0 );
         }
     }
 
@@ -743,35 +768,27 @@ void FerretCollector::open_cpufreq_fds( void )
 {
     for( auto cpu : mCpus )
     {
-        const std::string prefix = "/sys/devices/system/cpu/cpu";
+        const std::string prefix = sysPath( "/sys/devices/system/cpu/cpu" );
         const std::string suffix = "/cpufreq/scaling_cur_freq";
         const std::string freqFile = prefix + _to_string( cpu ) + suffix;
 
-        if( mCpufreqFdMap.find( cpu ) != mCpufreqFdMap.end() )
+        if( mCpufreqSlotMap.find( cpu ) != mCpufreqSlotMap.end() )
         {
             /* Already open.
              */
             continue;
         }
 
-        int fd = open( freqFile.c_str(), O_RDONLY );
+        const int slot = mReader.add( freqFile, 64 );
 
-        if( fd < 0 )
+        if( slot < 0 )
         {
             DBG_LOG( "%s: failed to open(%s)\n", mName.c_str(), freqFile.c_str() );
             assert( errno != ENFILE );
         }
         else
         {
-            if( lseek( fd, 0, SEEK_SET ) != 0 )
-            {
-                perror( mName.c_str() );
-                close( fd );
-            }
-            else
-            {
-                mCpufreqFdMap[ cpu ] = fd;
-            }
+            mCpufreqSlotMap[ cpu ] = slot;
         }
     }
 }
@@ -779,11 +796,11 @@ void FerretCollector::open_cpufreq_fds( void )
 
 void FerretCollector::close_cpufreq_fds( void )
 {
-    for( auto iter:mCpufreqFdMap )
+    for( auto iter:mCpufreqSlotMap )
     {
-        close( iter.second );
+        mReader.remove( iter.second );
     }
-    mCpufreqFdMap.clear();
+    mCpufreqSlotMap.clear();
 }
 
 
@@ -792,30 +809,22 @@ bool FerretCollector::open_pid_fd( std::string const& prefix, std::string const&
     const std::string suffix = "/stat";
     const std::string statFile = prefix + "/" + pid + suffix;
 
-    if( mPidFdMap.find( pid ) == mPidFdMap.end() )
+    if( mPidSlotMap.find( pid ) == mPidSlotMap.end() )
     {
-        int fd = open( statFile.c_str(), O_RDONLY );
+        const int slot = mReader.add( statFile, 1024 );
 
-        if( fd < 0 )
+        if( slot < 0 )
         {
             DBG_LOG( "%s: failed to open(%s)\n", mName.c_str(), statFile.c_str() );
             assert( errno != ENFILE );
         }
         else
         {
-            if( lseek( fd, 0, SEEK_SET ) != 0 )
-            {
-                perror( mName.c_str() );
-                close( fd );
-            }
-            else
-            {
-                mPidFdMap[ pid ] = fd;
-            }
+            mPidSlotMap[ pid ] = slot;
         }
     }
 
-    bool success = mPidFdMap.find( pid ) != mPidFdMap.end();
+    bool success = mPidSlotMap.find( pid ) != mPidSlotMap.end();
 
     return success;
 }
@@ -823,7 +832,7 @@ bool FerretCollector::open_pid_fd( std::string const& prefix, std::string const&
 
 bool FerretCollector::open_pid_fds( std::string const& pid )
 {
-    const std::string prefix = "/proc";
+    const std::string prefix = sysPath( "/proc" );
 
     bool success = open_pid_fd( prefix, pid );
 
@@ -835,23 +844,23 @@ bool FerretCollector::open_pid_fds( std::string const& pid )
 
 void FerretCollector::close_pid_fds( void )
 {
-    for( auto iter:mPidFdMap )
+    for( auto iter:mPidSlotMap )
     {
-        const int fd = iter.second;
+        const int slot = iter.second;
 
-        if( fd < 0 )
+        if( slot < 0 )
         {
             continue;
         }
-        close( fd );
+        mReader.remove( slot );
     }
-    mPidFdMap.clear();
+    mPidSlotMap.clear();
 }
 
 
 void FerretCollector::enumerate_tasks( std::string const& pid )
 {
-    const std::string prefix = "/proc";
+    const std::string prefix = sysPath( "/proc" );
     const std::string suffix = "/task";
     const std::string taskDir = prefix + "/" + pid + suffix;
 
@@ -884,7 +893,7 @@ void FerretCollector::enumerate_tasks( std::string const& pid )
 
 pid_t FerretCollector::poll_for_named_process( std::string const& name )
 {
-    const std::string procDir = "/proc";
+    const std::string procDir = sysPath( "/proc" );
 
     pid_t found = 0;
 
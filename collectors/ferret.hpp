@@ -64,6 +64,12 @@ Json::Value postprocess_ferret_data(
     const std::vector<std::string>& bannedThreads);
 
 
+/** Extract the fields that Ferret records from a /proc/<pid>/task/<tid>/stat
+ * file in @p buf, which is modified, and append them to @p row.
+ */
+void ferret_parse_stat( char *buf, std::string& row );
+
+
 class FerretCollector : public Collector
 {
 public:
@@ -134,11 +140,19 @@ public:
 
 
     /** Determine if the Ferret collector is available.
+     *
+     * Only checks that the CPU frequencies can be read, without opening
+     * anything, so init() may still fail.
      *
      * @return false if collection cannot continue, true otherwise.
      */
     virtual bool available() override;
 
+
+    /** The CPU frequency and stat files read on every collect().
+     */
+    virtual SysReader* reader() override { return &mReader; }
+
 private:
     /** Poll for a process named @p name, returning its pid.
      *
@@ -189,13 +203,13 @@ private:
      *
      * If a file descriptor for the file does not yet exist open the file.
      *
-     * If successful the mapping of @pid to file descriptor is stored for
+     * If successful the mapping of @pid to its mReader slot is stored for
      * subsequent polling.
      *
      * @param[in] prefix
      * @param[in] pid
      *
-     * @return true if a mapping from @pid to a valid file descriptor exists.
+     * @return true if a mapping from @pid to an open slot exists.
      *
      * @note Asserts that failures to open /proc are not caused by file handle
      * exhaustion.
@@ -217,7 +231,8 @@ private:
     void collect_freqs( void );
 
 
-    /** Collect CPU utilisation for all monitored processes.
+    /** Collect CPU utilisation for all monitored processes from the last read
+     * of reader().
      *
      * When monitored processes exit, close the file descriptor and record an
      * invalid descriptor.
@@ -283,11 +298,15 @@ private:
      */
     std::chrono::seconds mPollTimeout;
 
-    /** Map PIDs to fds for PID status files, or -1 if the process has exited.
+    /** Reads the files below together on every collect().
+     */
+    SysReader mReader;
+
+    /** Map PIDs to mReader slots for PID status files, or -1 if the process has exited.
      */
-    std::map<std::string, int> mPidFdMap;
+    std::map<std::string, int> mPidSlotMap;
 
-    /** Map of CPU numbers to scaling_cur_freq fds.
+    /** Map of CPU numbers to mReader slots for scaling_cur_freq.
      */
-    std::map<int, int> mCpufreqFdMap;
+    std::map<int, int> mCpufreqSlotMap;
 };
@@ -0,0 +1,93 @@
+#include "gpu_utilisation.hpp"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+static const std::vector<std::string> directories =
+{
+    "/sys/devices/platform/mali.0/power/", // mali
+    "/sys/devices/platform/pvrsrvkm.0/power/", // power-vr
+    "/sys/devices/virtual/graphics/fb0/power/", // adreno (but only for framebuffer zero!)
+};
+
+std::vector<std::string> gpuRuntimePaths(const std::string& file)
+{
+    std::vector<std::string> paths;
+    for (const std::string& d : directories)
+    {
+        paths.push_back(d + file);
+    }
+    return paths;
+}
+
+bool GPUUtilisationCollector::init()
+{
+    deinit();
+    mHandle = registerMetric(mName);
+    for (const std::string& d : directories)
+    {
+        mActive = mReader.add(sysPath(d + "runtime_active_time"), 64);
+        mSuspended = mReader.add(sysPath(d + "runtime_suspended_time"), 64);
+        if (mActive >= 0 && mSuspended >= 0)
+        {
+            if (mDebug) DBG_LOG("%s: Reading runtime PM times from %s\n", mName.c_str(), d.c_str());
+            return true;
+        }
+        mReader.clear();
+    }
+    mActive = mSuspended = -1;
+    return false;
+}
+
+bool GPUUtilisationCollector::deinit()
+{
+    mReader.clear();
+    mActive = mSuspended = -1;
+    return true;
+}
+
+bool GPUUtilisationCollector::start()
+{
+    mActiveDelta.reset();
+    mSuspendedDelta.reset();
+    mLast = 0.0;
+    if (mReader.read())
+    {
+        mActiveDelta.update(strtoull(mReader.data(mActive), nullptr, 10));
+        mSuspendedDelta.update(strtoull(mReader.data(mSuspended), nullptr, 10));
+    }
+    return Collector::start();
+}
+
+bool GPUUtilisationCollector::collect(int64_t /* now */)
+{
+    if (!mReader.read())
+    {
+        DBG_LOG("%s: Failed to read runtime PM times\n", mName.c_str());
+        return false;
+    }
+    const uint64_t active = mActiveDelta.update(strtoull(mReader.data(mActive), nullptr, 10));
+    const uint64_t suspended = mSuspendedDelta.update(strtoull(mReader.data(mSuspended), nullptr, 10));
+    if (active + suspended > 0)
+    {
+        mLast = (double)active / (active + suspended);
+    }
+    add(mHandle, mLast);
+    return true;
+}
+
+bool GPUUtilisationCollector::available()
+{
+    if (mActive >= 0)
+    {
+        return true;
+    }
+    for (const std::string& d : directories)
+    {
+        if (access(sysPath(d + "runtime_active_time").c_str(), R_OK) == 0 && access(sysPath(d + "runtime_suspended_time").c_str(), R_OK) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
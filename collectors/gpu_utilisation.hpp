@@ -0,0 +1,32 @@
+#pragma once
+
+#include "interface.hpp"
+
+/// Runtime power management files of the GPU, for Mali, PowerVR and Adreno in that order
+std::vector<std::string> gpuRuntimePaths(const std::string& file);
+
+// Fraction of time the GPU was powered up between samples, computed from its runtime_active_time
+// and runtime_suspended_time counters as active / (active + suspended). When neither counter
+// moved, the previous value is repeated.
+class GPUUtilisationCollector : public Collector
+{
+public:
+    using Collector::Collector;
+
+    virtual bool init() override;
+    virtual bool deinit() override;
+    virtual bool start() override;
+    virtual bool collect(int64_t) override;
+    /// Checks that both files of one GPU are readable, without opening them
+    virtual bool available() override;
+    virtual SysReader* reader() override { return &mReader; }
+
+private:
+    SysReader mReader;
+    int mActive = -1;
+    int mSuspended = -1;
+    CounterDelta mActiveDelta;
+    CounterDelta mSuspendedDelta;
+    double mLast = 0.0;
+    MetricHandle mHandle = -1;
+};
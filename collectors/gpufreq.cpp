@@ -30,6 +30,12 @@ GPUFreqCollector::GPUFreqCollector(const Json::Value& config, const std::string&
     }
 }
 
+bool GPUFreqCollector::init()
+{
+    mFreq = registerMetric("gpufreq", true); // kHz fits in 32 bits
+    return SysfsCollector::init();
+}
+
 bool GPUFreqCollector::parse(const char* buffer)
 {
     const int ONE_MILLION = 1000000;
@@ -59,7 +65,7 @@ bool GPUFreqCollector::parse(const char* buffer)
             freq /= ONE_MILLION;
         }
     }
-    add("gpufreq", freq * 1000);
+    add(mFreq, freq * 1000);
 
     return true;
 }
@@ -9,6 +9,11 @@ class GPUFreqCollector : public SysfsCollector
 public:
     GPUFreqCollector(const Json::Value& config, const std::string& name);
 
+    virtual bool init() override;
+
 protected:
     virtual bool parse(const char* buffer) override;
+
+private:
+    MetricHandle mFreq = -1;
 };
@@ -11,21 +11,26 @@ InfoCapsule::InfoCapsule()
 }
 
 MaliCounterCollector::MaliCounterCollector(const Json::Value& config, const std::string& name):
-    Collector(config, name),
-    infoc(),
-    counter_reader(infoc.info, "/dev/mali0", 1000000){
+    Collector(config, name){
 
 };
 
 bool MaliCounterCollector::init(){
-    if (!infoc.info.valid){
+    if (counter_reader){
+        return true;
+    }
+
+    infoc.reset(new InfoCapsule());
+    if (!infoc->info.valid){
         DBG_LOG("Collector invalid, not initializing\n");
         return false;
     }
 
-    if (!counter_reader.is_alive())
+    counter_reader.reset(new mali_userspace::MaliHWCReader(infoc->info, "/dev/mali0", 1000000));
+    if (!counter_reader->is_alive())
     {
         DBG_LOG("Failed to create HWC reader.\n");
+        counter_reader.reset();
         return false;
     }
 
@@ -48,7 +53,7 @@ bool MaliCounterCollector::init(){
     );
 
 
-    int num_shader_cores = counter_reader.get_num_cores();
+    int num_shader_cores = counter_reader->get_num_cores();
     for (int corenum = 0; corenum < num_shader_cores; ++ corenum){
         build_block_vectors(
             mali_userspace::MALI_NAME_BLOCK_SHADER,
@@ -61,18 +66,23 @@ bool MaliCounterCollector::init(){
     num_counters = header.size();
     counter_buffer.resize(num_counters);
 
+    handles.clear();
+    for (const std::string& name : header){
+        handles.push_back(registerMetric(name, true)); // counters are 32 bits wide
+    }
+
     return true;
 }
 
 
 void MaliCounterCollector::build_block_vectors(mali_userspace::MaliCounterBlockName block, int block_size, const std::string& verbose_block_name, int core){
-    const char * const * names = counter_reader.get_counter_names(block);
+    const char * const * names = counter_reader->get_counter_names(block);
     for (int index = 0; index < block_size; ++index){
         if (names[index][0] != '\0'){
             header.push_back(verbose_block_name + "_" + std::string(names[mali_userspace::MALI_NAME_BLOCK_JM * block_size + index]));
             indices.emplace_back(
                 block,
-                counter_reader.find_counter_index_by_name(
+                counter_reader->find_counter_index_by_name(
                     block,
                     names[index]
                 )
@@ -84,14 +94,8 @@ void MaliCounterCollector::build_block_vectors(mali_userspace::MaliCounterBlockN
 
 bool MaliCounterCollector::available(){
     // Return true if the platform has a mali device (should probably improve this, all mali dev. might not support counters?)
-    int fd = open("/dev/mali0", O_RDWR);
-    if (fd < 0){
-        return false;
-    }
-
-    close(fd);
-
-    return true;
+    // Opening the device creates a driver context, so only check that we could.
+    return access("/dev/mali0", R_OK | W_OK) == 0;
 }
 
 bool MaliCounterCollector::deinit(){
@@ -99,7 +103,7 @@ bool MaliCounterCollector::deinit(){
 }
 
 bool MaliCounterCollector::start(){
-    if (!infoc.info.valid){
+    if (!counter_reader){
         DBG_LOG("Collector invalid, not starting\n");
         return false;
     }
@@ -109,12 +113,12 @@ bool MaliCounterCollector::start(){
     for (size_t index = 0; index < num_counters; ++index){
         int core_index = core_indices[index];
         if (core_index == -1){
-            counter_buffer[index] = counter_reader.get_counters(
+            counter_buffer[index] = counter_reader->get_counters(
                 indices[index].first
             )[indices[index].second];
         }
         else{
-            counter_buffer[index] = counter_reader.get_counters(
+            counter_buffer[index] = counter_reader->get_counters(
                 indices[index].first,
                 core_index
             )[indices[index].second];
@@ -123,7 +127,7 @@ bool MaliCounterCollector::start(){
 
     DBG_LOG("Counters cleared! Waiting for next event...\n");
 
-    if (!counter_reader.wait_next_event()){
+    if (!counter_reader->wait_next_event()){
         DBG_LOG("Could not fetch next event..\n");
         return false;
     }
@@ -134,41 +138,28 @@ bool MaliCounterCollector::start(){
 }
 
 bool MaliCounterCollector::collect(int64_t /* now */){
-    if (!infoc.info.valid){
+    if (!counter_reader){
         return false;
     }
 
     float total_sum = 0;
 
-    //TODO: We can optimize here if we need to
     for (size_t index = 0; index < num_counters; ++index){
         int core_index = core_indices[index];
+        uint32_t value;
         if (core_index == -1){
-            add(
-                header[index],
-                counter_reader.get_counters(
-                    indices[index].first
-                )[indices[index].second]
-            );
-
-            total_sum += counter_reader.get_counters(
-                    indices[index].first
-                )[indices[index].second];
+            value = counter_reader->get_counters(
+                indices[index].first
+            )[indices[index].second];
         }
         else{
-            add(
-                header[index],
-                counter_reader.get_counters(
-                    indices[index].first,
-                    core_index
-                )[indices[index].second]
-            );
-
-            total_sum += counter_reader.get_counters(
-                    indices[index].first,
-                    core_index
-                )[indices[index].second];
+            value = counter_reader->get_counters(
+                indices[index].first,
+                core_index
+            )[indices[index].second];
         }
+        add(handles[index], value);
+        total_sum += value;
     }
 
     if (total_sum == 0){
@@ -2,6 +2,7 @@
 
 #include <string>
 #include <vector>
+#include <memory>
 #include "interface.hpp"
 #include "collector_utility.hpp"
 #include "hwcpipe.hpp"
@@ -30,10 +31,12 @@ public:
     bool available() override;
 
 private:
-	InfoCapsule infoc;
-	mali_userspace::MaliHWCReader counter_reader;
+	// Created by init(), since opening the device may retry for a long time
+	std::unique_ptr<InfoCapsule> infoc;
+	std::unique_ptr<mali_userspace::MaliHWCReader> counter_reader;
 
 	std::vector<std::string> header;
+	std::vector<MetricHandle> handles;
 	std::vector<std::pair<mali_userspace::MaliCounterBlockName, int>> indices;
 	std::vector<int> core_indices;
 
@@ -1,4 +1,5 @@
 #include "memory.hpp"
+#include "collector_utility.hpp"
 
 #include <stdio.h>
 #include <unistd.h>
@@ -14,6 +15,9 @@
 #include <mach/mach.h>
 #endif
 
+#define KEY(_s) _s, sizeof(_s) - 1
+
+#if !defined(__linux__)
 static size_t getCurrentRSS()
 {
 #if defined(_WIN32)
@@ -28,19 +32,10 @@ static size_t getCurrentRSS()
         return (size_t)0L;      /* Can't access? */
     return (size_t)info.resident_size;
 #else
-    long rss = 0L;
-    FILE* fp = NULL;
-    if ( (fp = fopen( "/proc/self/statm", "r" )) == NULL )
-        return (size_t)0L;      /* Can't open? */
-    if ( fscanf( fp, "%*s%ld", &rss ) != 1 )
-    {
-        fclose( fp );
-        return (size_t)0L;      /* Can't read? */
-    }
-    fclose( fp );
-    return (size_t)rss * (size_t)sysconf( _SC_PAGESIZE);
+    return (size_t)0L;
 #endif
 }
+#endif
 
 static size_t getTotalSystemMemory()
 {
@@ -56,9 +51,76 @@ static size_t getFreeSystemMemory()
     return pages * page_size;
 }
 
+// Page faults from /proc/self/stat. Skips past the command, which may contain anything, to the
+// state in field 3 and counts fields from there.
+static void parseFaults(const char* stat, uint64_t& minor, uint64_t& major)
+{
+    const char* p = strrchr(stat, ')');
+    minor = 0;
+    major = 0;
+    for (int field = 3; p && field <= 12; field++) // minflt and majflt are fields 10 and 12
+    {
+        p = strchr(p + 1, ' ');
+        const char* number = p;
+        if (field == 10 && number) parseNumber(number, minor);
+        if (field == 12 && number) parseNumber(number, major);
+    }
+}
+
+int64_t MemoryCollector::value(SysReader& reader, int slot, const char* key, size_t length) const
+{
+    const char* p = slot >= 0 && reader.length(slot) > 0 ? findKeyValue(reader.data(slot), key, length) : nullptr;
+    uint64_t v = 0;
+    return p && parseNumber(p, v) ? (int64_t)v : 0;
+}
+
+// In bytes, counting reclaimable caches as available where the kernel tells us about them
+int64_t MemoryCollector::availableRAM()
+{
+    const int64_t available = value(mReader, mMeminfo, KEY("MemAvailable")); // since Linux 3.14
+    return available > 0 ? available * 1024 : getFreeSystemMemory();
+}
+
 bool MemoryCollector::init()
 {
-    initialAvailableRAM = getFreeSystemMemory();
+    deinit();
+#if defined(__linux__)
+    mStatus = mReader.add(sysPath("/proc/self/status"), 2048);
+    if (mStatus < 0)
+    {
+        DBG_LOG("%s: Cannot open /proc/self/status: %s\n", mName.c_str(), strerror(errno));
+        return false;
+    }
+    mStat = mReader.add(sysPath("/proc/self/stat"), 512);
+    mMeminfo = mReader.add(sysPath("/proc/meminfo"), 2048);
+    mPssInterval = mConfig.get("pss_interval", 1).asUInt();
+    if (mPssInterval > 0)
+    {
+        mRollup = mRollupReader.add(sysPath("/proc/self/smaps_rollup"), 1024); // since Linux 4.14
+    }
+    mReader.read();
+#endif
+    initialAvailableRAM = availableRAM();
+    mMaxRss = registerMetric("memory_max_rss");
+    mCurRss = registerMetric("memory_cur_rss");
+    mUsed = registerMetric("memory_used");
+    if (mStatus >= 0)
+    {
+        mRssAnon = registerMetric("memory_rss_anon");
+        mRssFile = registerMetric("memory_rss_file");
+        mRssShmem = registerMetric("memory_rss_shmem");
+        mSwap = registerMetric("memory_swap");
+        mAvailable = registerMetric("memory_available");
+        if (mStat >= 0)
+        {
+            mMinorFaultsHandle = registerMetric("memory_minor_faults", true);
+            mMajorFaultsHandle = registerMetric("memory_major_faults", true);
+        }
+    }
+    if (mRollup >= 0)
+    {
+        mPssHandle = registerMetric("memory_pss");
+    }
     return true;
 }
 
@@ -69,6 +131,9 @@ bool MemoryCollector::available()
 
 bool MemoryCollector::deinit()
 {
+    mReader.clear();
+    mRollupReader.clear();
+    mStatus = mStat = mMeminfo = mRollup = -1;
     return true;
 }
 
@@ -79,26 +144,70 @@ bool MemoryCollector::start()
         return true;
     }
     mCollecting = true;
+    mSamples = 0;
+    mMinorFaults.reset();
+    mMajorFaults.reset();
+    if (mStatus >= 0)
+    {
+        mReader.read();
+    }
     DBG_LOG("Starting memory per-frame collection (%lu total memory, %lu available, %lu available at init)\n",
-            (unsigned long)(getTotalSystemMemory() / 1024), (unsigned long)(getFreeSystemMemory() / 1024),
+            (unsigned long)(getTotalSystemMemory() / 1024), (unsigned long)(availableRAM() / 1024),
             (unsigned long)(initialAvailableRAM / 1024));
+    if (mStat >= 0 && mReader.length(mStat) > 0)
+    {
+        uint64_t minor;
+        uint64_t major;
+        parseFaults(mReader.data(mStat), minor, major);
+        mMinorFaults.update(minor);
+        mMajorFaults.update(major);
+    }
     return true;
 }
 
 bool MemoryCollector::collect(int64_t /* now */)
 {
+#if !defined(__linux__)
     struct rusage usage;
     if (getrusage(RUSAGE_SELF, &usage) != 0)
     {
         DBG_LOG("Failed to get usage statistics: %s\n", strerror(errno));
         return false;
     }
-    int64_t availableNow = getFreeSystemMemory();
-    int64_t diff = initialAvailableRAM - availableNow;
+    add(mMaxRss, usage.ru_maxrss);
+    add(mCurRss, getCurrentRSS() / 1024);
+    add(mUsed, (initialAvailableRAM - availableRAM()) / 1024);
+#else
+    mReader.read(); // unless already read together with other collectors
+    const int64_t available = availableRAM();
+    add(mMaxRss, value(mReader, mStatus, KEY("VmHWM")));
+    add(mCurRss, value(mReader, mStatus, KEY("VmRSS")));
+    add(mUsed, (initialAvailableRAM - available) / 1024);
+    add(mRssAnon, value(mReader, mStatus, KEY("RssAnon")));
+    add(mRssFile, value(mReader, mStatus, KEY("RssFile")));
+    add(mRssShmem, value(mReader, mStatus, KEY("RssShmem")));
+    add(mSwap, value(mReader, mStatus, KEY("VmSwap")));
+    add(mAvailable, available / 1024);
 
-    add("memory_max_rss", usage.ru_maxrss);
-    add("memory_cur_rss", getCurrentRSS() / 1024);
-    add("memory_used", diff / 1024);
+    if (mStat >= 0)
+    {
+        uint64_t minor;
+        uint64_t major;
+        parseFaults(mReader.data(mStat), minor, major);
+        add(mMinorFaultsHandle, (long long)mMinorFaults.update(minor));
+        add(mMajorFaultsHandle, (long long)mMajorFaults.update(major));
+    }
 
+    if (mRollup >= 0)
+    {
+        if (mSamples % mPssInterval == 0)
+        {
+            mRollupReader.read();
+            mPss = value(mRollupReader, mRollup, KEY("Pss"));
+        }
+        add(mPssHandle, mPss);
+    }
+    mSamples++;
+#endif
     return true;
 }
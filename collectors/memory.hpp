@@ -7,6 +7,21 @@
 
 #include "interface.hpp"
 
+// Memory use of our process and of the system, in kB. On Linux, /proc/self/status, /proc/self/stat
+// and /proc/meminfo are kept open and parsed in place on every sample, and /proc/self/smaps_rollup
+// as often as configured, since the kernel walks all mappings to produce it.
+//  - memory_max_rss, memory_cur_rss: peak and current resident set size
+//  - memory_rss_anon, memory_rss_file, memory_rss_shmem: current resident set size by kind
+//  - memory_swap: swapped out
+//  - memory_pss: proportional set size, which divides shared pages between their users
+//  - memory_available: MemAvailable of the system
+//  - memory_used: how much less memory the system has available than when initialized
+//  - memory_minor_faults, memory_major_faults: page faults during the sample
+// Elsewhere only the first three are collected.
+//
+// Configuration:
+//  - pss_interval: Samples between reads of smaps_rollup, default 1. Samples in between repeat the
+//                  previous value. Zero stops reading it.
 class MemoryCollector : public Collector
 {
 public:
@@ -17,7 +32,35 @@ public:
     virtual bool start() override;
     virtual bool collect(int64_t) override;
     virtual bool available() override;
+    virtual SysReader* reader() override { return mStatus >= 0 ? &mReader : nullptr; }
 
 private:
+    /// Value of a "Key: value kB" line in a file that was read, or zero
+    int64_t value(SysReader& reader, int slot, const char* key, size_t length) const;
+    int64_t availableRAM();
+
     int64_t initialAvailableRAM = 0;
+    MetricHandle mMaxRss = -1;
+    MetricHandle mCurRss = -1;
+    MetricHandle mUsed = -1;
+
+    SysReader mReader; // read every sample
+    SysReader mRollupReader; // read every mPssInterval samples
+    int mStatus = -1; // reader slots
+    int mStat = -1;
+    int mMeminfo = -1;
+    int mRollup = -1;
+    unsigned mPssInterval = 1;
+    unsigned mSamples = 0;
+    int64_t mPss = 0;
+    CounterDelta mMinorFaults;
+    CounterDelta mMajorFaults;
+    MetricHandle mRssAnon = -1;
+    MetricHandle mRssFile = -1;
+    MetricHandle mRssShmem = -1;
+    MetricHandle mSwap = -1;
+    MetricHandle mPssHandle = -1;
+    MetricHandle mAvailable = -1;
+    MetricHandle mMinorFaultsHandle = -1;
+    MetricHandle mMajorFaultsHandle = -1;
 };
@@ -13,6 +13,7 @@
 #else
 #include "perf_event.h"
 #endif
+#include "output.hpp"
 
 static std::map<int, std::vector<struct event>> EVENTS = {
 {0, { {"CPUInstructionRetired", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, false, false, hw_cnt_length::b32, false},
@@ -104,6 +105,7 @@ PerfCollector::PerfCollector(const Json::Value& config, const std::string& name,
 
     mSet = mConfig.get("set", -1).asInt();
     mInherit = mConfig.get("inherit", 1).asInt();
+    mCsvThreads = std::max(1u, config.get("csv_threads", 1).asUInt()); // shared with Collection::writeCSV()
 
     leader.inherited = mInherit;
     leader.cspmu = false;
@@ -158,7 +160,7 @@ PerfCollector::PerfCollector(const Json::Value& config, const std::string& name,
                 e.config = item.get("config", 0).asUInt64();
                 auto type_string = e.device;
 
-                auto event_type_filename = "/sys/devices/" + type_string + "/type";
+                auto event_type_filename = sysPath("/sys/devices/" + type_string + "/type");
 
                 std::ifstream event_type(event_type_filename);
                 if (getline(event_type, type_string))
@@ -625,6 +627,7 @@ bool event_context::deinit()
             close(c.fd);
 
     mCounters.clear();
+    mLists.clear();
     return true;
 }
 
@@ -751,9 +754,9 @@ static std::string getThreadName(int tid)
 {
     std::stringstream comm_path;
     if (tid == 0)
-        comm_path << "/proc/self/comm";
+        comm_path << sysPath("/proc/self/comm");
     else
-        comm_path << "/proc/self/task/" << tid << "/comm";
+        comm_path << sysPath("/proc/self/task/") << tid << "/comm";
 
     std::string name;
     std::ifstream comm_file { comm_path.str() };
@@ -779,7 +782,7 @@ void PerfCollector::create_perf_thread()
     }
 
     DIR *dirp = NULL;
-    if ((dirp = opendir("/proc/self/task")) == NULL)
+    if ((dirp = opendir(sysPath("/proc/self/task").c_str())) == NULL)
         return;
 
     struct dirent *ent = NULL;
@@ -810,43 +813,41 @@ void PerfCollector::create_perf_thread()
     }
 }
 
-static void writeCSV(int tid, std::string name, const CollectorValueResults &results)
+static void writeCSV(int tid, std::string name, const CollectorValueResults &results, unsigned threads)
 {
-    std::stringstream ss;
 #ifdef ANDROID
-    ss << "/sdcard/" << name.c_str() << tid << ".csv";
+    std::string filename = "/sdcard/" + name + _to_string(tid) + ".csv";
 #else
-    ss << name.c_str() << tid << ".csv";
+    std::string filename = name + _to_string(tid) + ".csv";
 #endif
-    std::string filename = ss.str();
     DBG_LOG("writing perf result to %s\n", filename.c_str());
 
-    FILE *fp = fopen(filename.c_str(), "w");
-    if (fp)
+    OutputBuffer out;
+    if (out.open(filename))
     {
         unsigned int number = 0;
+        std::vector<const CollectorValueList*> lists;
         std::string item;
+        CsvLine header(item, ",", true);
         for (const auto& pair : results)
         {
-            item += pair.first + ",";
+            header.field(pair.first);
+            lists.push_back(&pair.second);
             number = pair.second.size();
         }
-        fprintf(fp, "%s\n", item.c_str());
+        header.end();
+        out.write(item);
 
-        for (unsigned int i=0; i<number; i++)
+        writeCsvRows(out, number, [&lists](CsvLine& line, size_t i)
         {
-            std::stringstream css;
-            std::string value;
-            for (const auto& pair : results)
+            for (const CollectorValueList* list : lists)
             {
-                css << pair.second.at(i).i64 << ",";
+                line.field(list->at(i).i64);
             }
-            value = css.str();
-            fprintf(fp, "%s\n", value.c_str());
-        }
+        }, ",", true, threads);
 
-        fsync(fileno(fp));
-        fclose(fp);
+        out.sync();
+        out.close();
     }
     else DBG_LOG("Fail to open %s\n", filename.c_str());
 }
@@ -854,8 +855,8 @@ static void writeCSV(int tid, std::string name, const CollectorValueResults &res
 void PerfCollector::saveResultsFile()
 {
     for (const perf_thread& t : mReplayThreads)
-        writeCSV(t.tid, t.name, t.mResultsPerThread);
+        writeCSV(t.tid, t.name, t.mResultsPerThread, mCsvThreads);
 
     for (const perf_thread& t : mBgThreads)
-        writeCSV(t.tid, t.name, t.mResultsPerThread);
+        writeCSV(t.tid, t.name, t.mResultsPerThread, mCsvThreads);
 }
@@ -101,8 +101,14 @@ public:
 
     inline void update_data(const struct snapshot &snap, CollectorValueResults &result)
     {
+        if (mLists.size() != mCounters.size()) // resolve names once, the map entries are stable
+        {
+            mLists.clear();
+            for (unsigned int i = 0; i < mCounters.size(); i++)
+                mLists.push_back(&result[mCounters[i].name]);
+        }
         for (unsigned int i = 0; i < mCounters.size(); i++)
-            result[mCounters[i].name].push_back(snap.values[i]);
+            mLists[i]->push_back(snap.values[i]);
     }
 
     inline void update_data_scope(uint16_t func_id, struct snapshot &snap_start, struct snapshot &snap_end, CollectorValueResults &result)
@@ -145,6 +151,8 @@ private:
 
     int group;
     std::vector<struct counter> mCounters;
+    // Result list for each counter in mCounters, so that sampling does not look up names
+    std::vector<CollectorValueList*> mLists;
     // Record number of scope calls with perf counter incremental greater than 0 (can happen in multiple bg threads)
     std::vector<int32_t> scope_num_with_perf;
     // Record number of scope calls that actually triggered the collect_scope (happen in 1 thread that calls the collection method)
@@ -182,6 +190,7 @@ public:
 private:
     int mSet = -1;
     int mInherit = 1;
+    unsigned mCsvThreads = 1; // 'csv_threads' of the Collection config
     bool mAllThread = true;
     bool mEnablePerapiPerf = false;
     uint8_t pmu_counter_bits;
@@ -223,13 +232,13 @@ private:
 
                 unsigned int index = 0;
                 uint64_t total = 0;
-                for (const CollectorValue& cv : pair.second.data())
+                pair.second.for_each([&](CollectorValue cv)
                 {
                     uint64_t s = cv.u64;
                     if (need_sum) s += value[pair.first][index++].asUInt64();
                     v[pair.first].append((Json::Value::UInt64)s);
                     total += s;
-                }
+                });
                 value[pair.first] = v[pair.first];
                 value["SUM"][pair.first] = (Json::Value::UInt64)total;
             }
@@ -25,6 +25,13 @@ ProcFSStatCollector::ProcFSStatCollector(const Json::Value& config, const std::s
     }
 }
 
+bool ProcFSStatCollector::init()
+{
+    mCpuTime = registerMetric("cpu_time");
+    mThreads = registerMetric("threads", true);
+    return SysfsCollector::init();
+}
+
 bool ProcFSStatCollector::parse(const char* buffer)
 {
     int pid;
@@ -64,14 +71,14 @@ bool ProcFSStatCollector::parse(const char* buffer)
     if (mLastSampleTime == 0)
     {
         mLastSampleTime = tot_time;
-        add("cpu_time", 0.0f);
+        add(mCpuTime, 0.0f);
     }
     else
     {
-        add("cpu_time", double(tot_time - mLastSampleTime) / double(mTicks));
+        add(mCpuTime, double(tot_time - mLastSampleTime) / double(mTicks));
         mLastSampleTime = tot_time;
     }
-    add("threads", num_threads);
+    add(mThreads, num_threads);
 
     return true;
 }
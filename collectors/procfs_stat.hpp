@@ -8,10 +8,14 @@ class ProcFSStatCollector : public SysfsCollector
 public:
     ProcFSStatCollector(const Json::Value& config, const std::string& name);
 
+    virtual bool init() override;
+
 protected:
     virtual bool parse(const char* buffer) override;
 
 private:
     long mTicks;
     unsigned long mLastSampleTime;
+    MetricHandle mCpuTime = -1;
+    MetricHandle mThreads = -1;
 };
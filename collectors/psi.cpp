@@ -0,0 +1,287 @@
+#include "psi.hpp"
+
+#include "collector_utility.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#include <chrono>
+
+#ifndef CGROUP2_SUPER_MAGIC
+#define CGROUP2_SUPER_MAGIC 0x63677270
+#endif
+
+static const char* kindNames[] = { "some", "full" };
+
+PressureCollector::~PressureCollector()
+{
+    stopWatching();
+    for (Trigger& t : mTriggers)
+    {
+        close(t.fd);
+    }
+}
+
+bool PressureCollector::parse(const char* text, Kind kind, double& avg10, uint64_t& total)
+{
+    for (const char* line = text; line && *line; )
+    {
+        if (strncmp(line, kindNames[kind], 4) == 0 && line[4] == ' ')
+        {
+            const char* a = strstr(line, "avg10=");
+            const char* t = strstr(line, "total=");
+            if (!a || !t) return false;
+            avg10 = strtod(a + 6, nullptr);
+            t += 6;
+            return parseNumber(t, total);
+        }
+        line = strchr(line, '\n');
+        if (line) line++;
+    }
+    return false;
+}
+
+bool PressureCollector::addSource(const std::string& path, const std::string& prefix)
+{
+    Source s;
+    s.slot = mReader.add(sysPath(path), 256);
+    if (s.slot < 0)
+    {
+        if (mDebug) DBG_LOG("%s: Cannot open %s: %s\n", mName.c_str(), path.c_str(), strerror(errno));
+        return false;
+    }
+    mReader.read();
+    for (int k = 0; k < KINDS; k++)
+    {
+        double avg10;
+        uint64_t total;
+        if (parse(mReader.data(s.slot), (Kind)k, avg10, total)) // older kernels have no "full" for cpu
+        {
+            s.avg10[k] = registerMetric(prefix + "_" + kindNames[k] + "_avg10");
+            s.stall[k] = registerMetric(prefix + "_" + kindNames[k] + "_stall", true); // microseconds per sample fit in 32 bits
+        }
+    }
+    if (s.avg10[SOME] < 0)
+    {
+        DBG_LOG("%s: Unexpected contents in %s\n", mName.c_str(), path.c_str());
+        mReader.remove(s.slot);
+        return false;
+    }
+    mSources.push_back(s);
+    return true;
+}
+
+bool PressureCollector::addTrigger(const Json::Value& config)
+{
+    const std::string resource = config.get("resource", "").asString();
+    const std::string kind = config.get("kind", "some").asString();
+    const bool cgroup = config.get("cgroup", false).asBool();
+    const unsigned threshold = config.get("threshold", 0).asUInt();
+    const unsigned window = config.get("window", 2000000).asUInt();
+    if (resource.empty() || (kind != "some" && kind != "full") || threshold == 0 || (cgroup && !mConfig.isMember("cgroup")))
+    {
+        DBG_LOG("%s: Each trigger needs a resource, a threshold, a kind of \"some\" or \"full\", and a cgroup if it asks for one\n", mName.c_str());
+        return false;
+    }
+    const std::string path = cgroup ? mConfig["cgroup"].asString() + "/" + resource + ".pressure" : "/proc/pressure/" + resource;
+    const int fd = open(sysPath(path).c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+    {
+        DBG_LOG("%s: Cannot open %s for a trigger: %s\n", mName.c_str(), path.c_str(), strerror(errno));
+        return false;
+    }
+    // Writing a trigger into anything else, such as a recorded tree, would only overwrite it
+    struct statfs fs;
+    if (fstatfs(fd, &fs) != 0 || (fs.f_type != PROC_SUPER_MAGIC && fs.f_type != CGROUP2_SUPER_MAGIC))
+    {
+        DBG_LOG("%s: %s is not a pressure file of the kernel, so it cannot have triggers\n", mName.c_str(), path.c_str());
+        close(fd);
+        return false;
+    }
+    const std::string text = kind + " " + _to_string(threshold) + " " + _to_string(window);
+    if (write(fd, text.c_str(), text.size() + 1) < 0)
+    {
+        DBG_LOG("%s: Kernel refused trigger \"%s\" for %s: %s%s\n", mName.c_str(), text.c_str(), path.c_str(), strerror(errno),
+                errno == EINVAL ? " (without CAP_SYS_RESOURCE, the window must be a multiple of 2 seconds)" : "");
+        close(fd);
+        return false;
+    }
+    const std::string prefix = (cgroup ? "cgroup_" : "") + resource + "_" + kind;
+    Trigger t;
+    t.fd = fd;
+    t.count = registerMetric(prefix + "_trigger", true);
+    t.time = registerMetric(prefix + "_trigger_time");
+    mTriggers.push_back(t);
+    if (mDebug) DBG_LOG("%s: Trigger \"%s\" set for %s\n", mName.c_str(), text.c_str(), path.c_str());
+    return true;
+}
+
+bool PressureCollector::init()
+{
+    deinit();
+    Json::Value resources = mConfig.get("resources", Json::Value());
+    if (!resources.isArray())
+    {
+        resources = Json::arrayValue;
+        for (const char* r : { "cpu", "memory", "io" })
+        {
+            resources.append(r);
+        }
+    }
+    for (const Json::Value& r : resources)
+    {
+        addSource("/proc/pressure/" + r.asString(), r.asString());
+        if (mConfig.isMember("cgroup"))
+        {
+            addSource(mConfig["cgroup"].asString() + "/" + r.asString() + ".pressure", "cgroup_" + r.asString());
+        }
+    }
+    if (mSources.empty())
+    {
+        DBG_LOG("%s: No pressure stall information, which needs a kernel with CONFIG_PSI\n", mName.c_str());
+        return false;
+    }
+    for (const Json::Value& t : mConfig["triggers"])
+    {
+        addTrigger(t); // carry on without it, since sampled stalls are still useful
+    }
+    return true;
+}
+
+bool PressureCollector::deinit()
+{
+    stopWatching();
+    mReader.clear();
+    mSources.clear();
+    for (Trigger& t : mTriggers)
+    {
+        close(t.fd);
+    }
+    mTriggers.clear();
+    return true;
+}
+
+bool PressureCollector::start()
+{
+    mReader.read();
+    for (Source& s : mSources)
+    {
+        for (int k = 0; k < KINDS; k++)
+        {
+            double avg10;
+            uint64_t total;
+            s.total[k].reset();
+            if (parse(mReader.data(s.slot), (Kind)k, avg10, total))
+            {
+                s.total[k].update(total);
+            }
+        }
+    }
+    for (Trigger& t : mTriggers)
+    {
+        t.events = 0;
+        t.first = -1;
+    }
+    if (!mTriggers.empty() && !mWatcher.joinable() && pipe(mWake) == 0)
+    {
+        mWatcher = std::thread(&PressureCollector::watch, this);
+    }
+    return Collector::start();
+}
+
+bool PressureCollector::stop()
+{
+    stopWatching();
+    return Collector::stop();
+}
+
+void PressureCollector::stopWatching()
+{
+    if (mWatcher.joinable())
+    {
+        const char c = 0;
+        if (write(mWake[1], &c, 1) < 0)
+        {
+            DBG_LOG("%s: Failed to wake trigger thread: %s\n", mName.c_str(), strerror(errno));
+        }
+        mWatcher.join();
+    }
+    for (int& fd : mWake)
+    {
+        if (fd >= 0) close(fd);
+        fd = -1;
+    }
+}
+
+void PressureCollector::watch()
+{
+    std::vector<struct pollfd> fds(mTriggers.size() + 1);
+    for (unsigned i = 0; i < mTriggers.size(); i++)
+    {
+        fds[i].fd = mTriggers[i].fd;
+        fds[i].events = POLLPRI;
+    }
+    fds.back().fd = mWake[0];
+    fds.back().events = POLLIN;
+    while (true)
+    {
+        const int ret = poll(fds.data(), fds.size(), -1);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret < 0 || fds.back().revents) break;
+        const int64_t now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        for (unsigned i = 0; i < mTriggers.size(); i++)
+        {
+            if (fds[i].revents & POLLERR)
+            {
+                DBG_LOG("%s: Trigger %u stopped working\n", mName.c_str(), i);
+                fds[i].fd = -1; // ignored by poll() from now on
+            }
+            else if (fds[i].revents & POLLPRI)
+            {
+                std::lock_guard<std::mutex> lock(mEventLock);
+                Trigger& t = mTriggers[i];
+                if (t.events++ == 0) t.first = now - mStartTime;
+            }
+        }
+    }
+}
+
+bool PressureCollector::collect(int64_t /* now */)
+{
+    mReader.read();
+    for (Source& s : mSources)
+    {
+        for (int k = 0; k < KINDS; k++)
+        {
+            if (s.avg10[k] < 0) continue;
+            double avg10 = 0.0;
+            uint64_t total = 0;
+            int64_t stall = 0;
+            if (parse(mReader.data(s.slot), (Kind)k, avg10, total))
+            {
+                stall = s.total[k].update(total);
+            }
+            add(s.avg10[k], avg10);
+            add(s.stall[k], stall);
+        }
+    }
+    std::lock_guard<std::mutex> lock(mEventLock);
+    for (Trigger& t : mTriggers)
+    {
+        add(t.count, (long long)t.events);
+        add(t.time, (long long)t.first);
+        t.events = 0;
+        t.first = -1;
+    }
+    return true;
+}
+
+bool PressureCollector::available()
+{
+    return access(sysPath("/proc/pressure/cpu").c_str(), R_OK) == 0 || access(sysPath("/proc/pressure/memory").c_str(), R_OK) == 0;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "interface.hpp"
+
+#include <mutex>
+#include <thread>
+
+// Pressure stall information from /proc/pressure, which tells whether tasks were waiting for
+// CPU, memory or IO. For each resource and for "some" and, where the kernel has it, "full" stalls,
+// the kernel's 10 second average in percent is stored as "<resource>_<kind>_avg10", and the
+// microseconds of stall during the sample as "<resource>_<kind>_stall". All files are read
+// together once per sample.
+//
+// Stalls shorter than the sample interval can be caught with PSI triggers, which the kernel
+// signals as soon as stall time within a window exceeds a threshold. For each trigger, the number
+// of times it fired during the sample is stored as "<resource>_<kind>_trigger", and when it first
+// fired, in microseconds since the capture started, as "<resource>_<kind>_trigger_time", or -1.
+//
+// Configuration:
+//  - resources: Which of "cpu", "memory" and "io" to read, default all.
+//  - cgroup: A cgroup v2 directory, such as "/sys/fs/cgroup/benchmark". Its *.pressure files are
+//            read as well, with metric names starting with "cgroup_".
+//  - triggers: A list of objects with these members:
+//      - resource: "cpu", "memory" or "io"
+//      - kind: "some" (default) or "full"
+//      - threshold: Stall microseconds within the window that fire the trigger
+//      - window: Length of the window in microseconds, default 2000000. The kernel accepts 0.5 to
+//                10 seconds, but only multiples of 2 seconds without CAP_SYS_RESOURCE, so the
+//                default works for unprivileged processes.
+//      - cgroup: Watch the cgroup's file instead of the system one, default false.
+class PressureCollector : public Collector
+{
+public:
+    using Collector::Collector;
+    virtual ~PressureCollector();
+
+    virtual bool init() override;
+    virtual bool deinit() override;
+    virtual bool start() override;
+    virtual bool stop() override;
+    virtual bool collect(int64_t) override;
+    /// Checks that the kernel has pressure stall information, without opening it
+    virtual bool available() override;
+    virtual SysReader* reader() override { return &mReader; }
+
+private:
+    enum Kind { SOME, FULL, KINDS };
+
+    struct Source
+    {
+        int slot = -1;
+        MetricHandle avg10[KINDS] = { -1, -1 };
+        MetricHandle stall[KINDS] = { -1, -1 };
+        CounterDelta total[KINDS];
+    };
+
+    struct Trigger
+    {
+        int fd = -1;
+        MetricHandle count = -1;
+        MetricHandle time = -1;
+        uint64_t events = 0; // since the last sample
+        int64_t first = -1; // time of the first of them
+    };
+
+    bool addSource(const std::string& path, const std::string& prefix);
+    bool addTrigger(const Json::Value& config);
+    /// Parse "some avg10=1.00 avg60=2.00 avg300=3.00 total=1234" lines into avg10 and total
+    static bool parse(const char* text, Kind kind, double& avg10, uint64_t& total);
+    void watch();
+    void stopWatching();
+
+    SysReader mReader;
+    std::vector<Source> mSources;
+    std::vector<Trigger> mTriggers;
+    std::mutex mEventLock; // for the events of triggers
+    std::thread mWatcher;
+    int mWake[2] = { -1, -1 }; // pipe that stops the watcher
+};
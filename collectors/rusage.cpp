@@ -8,6 +8,14 @@
 bool RusageCollector::init()
 {
     memset(&prev, 0, sizeof(prev));
+    mKernelCPUTime = registerMetric("KernelCPUTime");
+    mUserCPUTime = registerMetric("UserCPUTime");
+    mPageFaultsNoIO = registerMetric("PageFaultsNoIO");
+    mPageFaultsWithIO = registerMetric("PageFaultsWithIO");
+    mIOBlockOnInput = registerMetric("IOBlockOnInput");
+    mIOBlockOnOutput = registerMetric("IOBlockOnOutput");
+    mVoluntaryContextSwitches = registerMetric("VoluntaryContextSwitches");
+    mInvoluntaryContextSwitches = registerMetric("InvoluntaryContextSwitches");
     return true;
 }
 
@@ -50,14 +58,14 @@ bool RusageCollector::collect(int64_t /* now */)
     timersub(&usage.ru_utime, &prev.ru_utime, &userdiff);
     timersub(&usage.ru_stime, &prev.ru_stime, &kerneldiff);
 
-    add("KernelCPUTime", kerneldiff.tv_sec * 1000 * 1000 + kerneldiff.tv_usec);
-    add("UserCPUTime", userdiff.tv_sec * 1000 * 1000 + userdiff.tv_usec);
-    add("PageFaultsNoIO", usage.ru_minflt - prev.ru_minflt);
-    add("PageFaultsWithIO", usage.ru_majflt - prev.ru_majflt);
-    add("IOBlockOnInput", usage.ru_inblock - prev.ru_inblock);
-    add("IOBlockOnOutput", usage.ru_oublock - prev.ru_oublock);
-    add("VoluntaryContextSwitches", usage.ru_nvcsw - prev.ru_nvcsw);
-    add("InvoluntaryContextSwitches", usage.ru_nivcsw - prev.ru_nivcsw);
+    add(mKernelCPUTime, kerneldiff.tv_sec * 1000 * 1000 + kerneldiff.tv_usec);
+    add(mUserCPUTime, userdiff.tv_sec * 1000 * 1000 + userdiff.tv_usec);
+    add(mPageFaultsNoIO, usage.ru_minflt - prev.ru_minflt);
+    add(mPageFaultsWithIO, usage.ru_majflt - prev.ru_majflt);
+    add(mIOBlockOnInput, usage.ru_inblock - prev.ru_inblock);
+    add(mIOBlockOnOutput, usage.ru_oublock - prev.ru_oublock);
+    add(mVoluntaryContextSwitches, usage.ru_nvcsw - prev.ru_nvcsw);
+    add(mInvoluntaryContextSwitches, usage.ru_nivcsw - prev.ru_nivcsw);
 
     prev = usage;
     return true;
@@ -19,4 +19,12 @@ public:
 
 private:
     struct rusage prev;
+    MetricHandle mKernelCPUTime = -1;
+    MetricHandle mUserCPUTime = -1;
+    MetricHandle mPageFaultsNoIO = -1;
+    MetricHandle mPageFaultsWithIO = -1;
+    MetricHandle mIOBlockOnInput = -1;
+    MetricHandle mIOBlockOnOutput = -1;
+    MetricHandle mVoluntaryContextSwitches = -1;
+    MetricHandle mInvoluntaryContextSwitches = -1;
 };
@@ -0,0 +1,173 @@
+#include "schedstat.hpp"
+
+#include "collector_utility.hpp"
+
+#include <algorithm>
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static const char* fieldNames[] = { "run_ns", "wait_ns", "slices" };
+
+bool SchedstatCollector::init()
+{
+    deinit();
+    const int pid = mConfig.get("pid", (int)getpid()).asInt();
+    mTaskDir = sysPath("/proc/" + _to_string(pid) + "/task/");
+    mRescan = std::max(1u, mConfig.get("rescan", 1).asUInt());
+    for (int f = 0; f < FIELDS; f++)
+    {
+        mTotals[f] = registerMetric(fieldNames[f]);
+    }
+    scan();
+    if (mThreads.empty())
+    {
+        DBG_LOG("%s: No schedstat files in %s, which needs a kernel with CONFIG_SCHED_INFO\n", mName.c_str(), mTaskDir.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool SchedstatCollector::deinit()
+{
+    mReader.clear();
+    mThreads.clear();
+    mRetired.clear();
+    return true;
+}
+
+void SchedstatCollector::scan()
+{
+    DIR* dir = opendir(mTaskDir.c_str());
+    if (!dir)
+    {
+        return; // the process is gone, and so are its threads
+    }
+    while (struct dirent* entry = readdir(dir))
+    {
+        const int tid = atoi(entry->d_name);
+        const auto old = mThreads.find(tid);
+        if (tid <= 0 || (old != mThreads.end() && old->second.slot >= 0))
+        {
+            continue;
+        }
+        const std::string path = mTaskDir + entry->d_name;
+        Thread t;
+        t.slot = mReader.add(path + "/schedstat", 64);
+        if (t.slot < 0)
+        {
+            continue; // exited already
+        }
+        std::string comm = sanitizeMetricName(readFirstLine(path + "/comm"));
+        const std::string prefix = (comm.empty() ? "" : comm + "_") + entry->d_name + "_";
+        for (int f = 0; f < FIELDS; f++)
+        {
+            t.handles[f] = registerMetric(prefix + fieldNames[f]);
+            // The tid was reused under the name of the thread that had it, or of one before that,
+            // whose metric has its zeroes already
+            const auto retired = std::find(mRetired.begin(), mRetired.end(), t.handles[f]);
+            bool filled = retired != mRetired.end();
+            if (filled)
+            {
+                mRetired.erase(retired);
+            }
+            if (old != mThreads.end() && old->second.handles[f] == t.handles[f])
+            {
+                filled = true;
+            }
+            else if (old != mThreads.end())
+            {
+                mRetired.push_back(old->second.handles[f]);
+            }
+            for (unsigned i = 0; i < mSamples && !filled; i++)
+            {
+                add(t.handles[f], 0); // keep all metrics the same length as the sample times
+            }
+        }
+        if (mDebug) DBG_LOG("%s: Watching thread %s\n", mName.c_str(), prefix.c_str());
+        mThreads[tid] = t;
+    }
+    closedir(dir);
+}
+
+void SchedstatCollector::update(bool store)
+{
+    mReader.read(); // failures are threads that exited, handled below
+    int64_t totals[FIELDS] = { 0, 0, 0 };
+    for (auto& pair : mThreads)
+    {
+        Thread& t = pair.second;
+        uint64_t values[FIELDS];
+        bool alive = t.slot >= 0 && mReader.length(t.slot) > 0;
+        const char* p = alive ? mReader.data(t.slot) : "";
+        for (int f = 0; f < FIELDS && alive; f++)
+        {
+            alive = parseNumber(p, values[f]);
+        }
+        if (!alive && t.slot >= 0)
+        {
+            if (mDebug) DBG_LOG("%s: Thread %d exited\n", mName.c_str(), pair.first);
+            mReader.remove(t.slot);
+            t.slot = -1;
+        }
+        for (int f = 0; f < FIELDS; f++)
+        {
+            const int64_t delta = alive && values[f] >= t.last[f] ? values[f] - t.last[f] : 0;
+            if (alive) t.last[f] = values[f];
+            totals[f] += delta;
+            if (store) add(t.handles[f], delta);
+        }
+    }
+    for (int f = 0; f < FIELDS && store; f++)
+    {
+        add(mTotals[f], totals[f]);
+    }
+    for (MetricHandle h : mRetired)
+    {
+        if (store) add(h, 0); // like threads that exited, until the next capture unassigns them
+    }
+}
+
+bool SchedstatCollector::start()
+{
+    // Forget threads that exited during earlier captures, and unassign their metrics so that they
+    // are not reported as empty lists
+    for (auto it = mThreads.begin(); it != mThreads.end(); )
+    {
+        if (it->second.slot >= 0)
+        {
+            ++it;
+            continue;
+        }
+        mRetired.insert(mRetired.end(), std::begin(it->second.handles), std::end(it->second.handles));
+        it = mThreads.erase(it);
+    }
+    for (MetricHandle h : mRetired)
+    {
+        mMetrics[h]->clear();
+        mMetrics[h]->type = CollectorValueList::TYPE_UNASSIGNED;
+    }
+    mRetired.clear();
+    mSamples = 0;
+    scan();
+    update(false);
+    return Collector::start();
+}
+
+bool SchedstatCollector::collect(int64_t /* now */)
+{
+    if (mSamples % mRescan == 0)
+    {
+        scan();
+    }
+    update(true);
+    mSamples++;
+    return true;
+}
+
+bool SchedstatCollector::available()
+{
+    const int pid = mConfig.get("pid", (int)getpid()).asInt();
+    return access(sysPath("/proc/" + _to_string(pid) + "/task").c_str(), R_OK) == 0;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <map>
+
+#include "interface.hpp"
+
+// Scheduler statistics of every thread of a process from /proc/<pid>/task/<tid>/schedstat, in
+// nanoseconds. For each thread, the time it ran during the sample is stored as
+// "<comm>_<tid>_run_ns", the time it was runnable but waiting for a CPU as "<comm>_<tid>_wait_ns",
+// and the number of times it was scheduled in as "<comm>_<tid>_slices". The sums over all threads
+// are "run_ns", "wait_ns" and "slices". Threads that start later get zeroes for the samples
+// before them, and threads that exit get zeroes from then on. A thread that reuses the tid of one
+// that exited is watched from its start like any other. Samples taken per frame are therefore
+// per-frame deltas. Files are kept open and read together once per sample.
+//
+// Configuration:
+//  - pid: Process to watch, default our own.
+//  - rescan: Samples between looking for new threads, default 1.
+class SchedstatCollector : public Collector
+{
+public:
+    using Collector::Collector;
+
+    virtual bool init() override;
+    virtual bool deinit() override;
+    virtual bool start() override;
+    virtual bool collect(int64_t) override;
+    /// Checks that the process exists, without opening its files
+    virtual bool available() override;
+    virtual SysReader* reader() override { return &mReader; }
+
+private:
+    enum Field { RUN, WAIT, SLICES, FIELDS };
+
+    struct Thread
+    {
+        int slot = -1; // or -1 once it has exited
+        uint64_t last[FIELDS] = { 0, 0, 0 };
+        MetricHandle handles[FIELDS] = { -1, -1, -1 };
+    };
+
+    /// Open threads that we do not know yet. Their first sample covers their whole run time.
+    void scan();
+    /// Read all threads, storing differences to the previous update if store is set
+    void update(bool store);
+
+    SysReader mReader;
+    std::string mTaskDir;
+    std::map<int, Thread> mThreads; // by tid
+    std::vector<MetricHandle> mRetired; // of exited threads whose tid was reused under another name, unassigned on start
+    unsigned mRescan = 1;
+    unsigned mSamples = 0; // since start, for filling in the samples before new threads
+    MetricHandle mTotals[FIELDS] = { -1, -1, -1 };
+};
@@ -0,0 +1,273 @@
+#include "sysfs.hpp"
+#include "collector_utility.hpp"
+
+#include <errno.h>
+#include <glob.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+
+static bool hasWildcard(const std::string& s)
+{
+    return s.find_first_of("*?[") != std::string::npos;
+}
+
+// Files matching a path, which may be a glob pattern, as paths under the sysroot
+static std::vector<std::string> expandPath(const std::string& path)
+{
+    std::vector<std::string> paths;
+    if (!hasWildcard(path))
+    {
+        paths.push_back(path);
+        return paths;
+    }
+    const std::string root = sysPath(path).substr(0, sysPath(path).size() - path.size());
+    glob_t g;
+    if (glob(sysPath(path).c_str(), 0, nullptr, &g) == 0)
+    {
+        for (size_t i = 0; i < g.gl_pathc; i++)
+        {
+            paths.push_back(std::string(g.gl_pathv[i]).substr(root.size()));
+        }
+    }
+    globfree(&g);
+    return paths;
+}
+
+// Parts of a path matched by the components of the pattern that have wildcards, joined by '_'
+static std::string wildcardParts(const std::string& pattern, const std::string& path)
+{
+    std::vector<std::string> patternParts;
+    std::vector<std::string> pathParts;
+    splitString(pattern.c_str(), '/', patternParts);
+    splitString(path.c_str(), '/', pathParts);
+    std::string result;
+    for (unsigned i = 0; i < patternParts.size() && i < pathParts.size(); i++)
+    {
+        if (hasWildcard(patternParts[i]))
+        {
+            result += (result.empty() ? "" : "_") + pathParts[i];
+        }
+    }
+    return result;
+}
+
+bool SysfsMetricsCollector::addMetrics(const Json::Value& config)
+{
+    const std::string name = config.get("name", "").asString();
+    const std::string path = config.get("path", "").asString();
+    if (name.empty() || path.empty())
+    {
+        DBG_LOG("%s: Each metric needs a name and a path\n", mName.c_str());
+        return false;
+    }
+
+    Metric m;
+    const std::string format = config.get("format", "int").asString();
+    if (format == "int") m.format = FORMAT_INT;
+    else if (format == "key") { m.format = FORMAT_KEY; m.text = config.get("key", "").asString(); }
+    else if (format == "column") m.format = FORMAT_COLUMN;
+    else if (format == "match")
+    {
+        m.format = FORMAT_MATCH;
+        const std::string pattern = config.get("pattern", "").asString();
+        m.text = pattern.substr(0, pattern.find('%'));
+    }
+    else
+    {
+        DBG_LOG("%s: Unknown format \"%s\" of metric %s\n", mName.c_str(), format.c_str(), name.c_str());
+        return false;
+    }
+    if ((m.format == FORMAT_KEY || m.format == FORMAT_MATCH) && m.text.empty())
+    {
+        DBG_LOG("%s: Metric %s needs a %s\n", mName.c_str(), name.c_str(), m.format == FORMAT_KEY ? "key" : "pattern");
+        return false;
+    }
+    m.line = config.get("line", 0).asInt();
+    m.column = config.get("column", 0).asInt();
+    m.scaled = config.isMember("scale");
+    m.scale = config.get("scale", 1.0).asDouble();
+    if (!m.counter.configure(config, AccumulativeCounter::MODE_ABSOLUTE))
+    {
+        DBG_LOG("%s: Unknown mode \"%s\" of metric %s\n", mName.c_str(), config["mode"].asString().c_str(), name.c_str());
+        return false;
+    }
+
+    const std::vector<std::string> paths = expandPath(path);
+    for (const std::string& p : paths)
+    {
+        auto it = mSlots.find(p);
+        if (it == mSlots.end())
+        {
+            const int slot = mReader.add(sysPath(p));
+            if (slot < 0)
+            {
+                DBG_LOG("%s: Failed to open %s: %s\n", mName.c_str(), p.c_str(), strerror(errno));
+                return false;
+            }
+            it = mSlots.insert(std::make_pair(p, slot)).first;
+        }
+        mList.push_back(m);
+        Metric& added = mList.back();
+        added.slot = it->second;
+        added.name = paths.size() > 1 || hasWildcard(path) ? name + "_" + wildcardParts(path, p) : name;
+        added.handle = registerMetric(added.name);
+        if (mDebug) DBG_LOG("%s: Reading %s from %s\n", mName.c_str(), added.name.c_str(), p.c_str());
+    }
+    if (paths.empty())
+    {
+        DBG_LOG("%s: No files match %s\n", mName.c_str(), path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool SysfsMetricsCollector::init()
+{
+    deinit();
+    const Json::Value& metrics = mConfig["metrics"];
+    if (!metrics.isArray() || metrics.size() == 0)
+    {
+        DBG_LOG("%s: No metrics configured\n", mName.c_str());
+        return false;
+    }
+    for (const Json::Value& m : metrics)
+    {
+        if (!addMetrics(m))
+        {
+            deinit();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SysfsMetricsCollector::deinit()
+{
+    mReader.clear();
+    mSlots.clear();
+    mList.clear();
+    return true;
+}
+
+bool SysfsMetricsCollector::start()
+{
+    bool counters = false;
+    for (Metric& m : mList)
+    {
+        m.counter.reset();
+        counters = counters || m.counter.mode() != AccumulativeCounter::MODE_ABSOLUTE;
+    }
+    if (counters)
+    {
+        const int64_t now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        mReader.read();
+        for (Metric& m : mList)
+        {
+            const char* p = m.counter.mode() != AccumulativeCounter::MODE_ABSOLUTE && mReader.length(m.slot) >= 0 ? findValue(m, mReader.data(m.slot)) : nullptr;
+            char* end = nullptr;
+            const uint64_t counter = p ? strtoull(p, &end, 10) : 0;
+            if (p && end != p) m.counter.update(counter, now);
+        }
+    }
+    return Collector::start();
+}
+
+bool SysfsMetricsCollector::available()
+{
+    const Json::Value& metrics = mConfig["metrics"];
+    if (!metrics.isArray())
+    {
+        return false;
+    }
+    for (const Json::Value& m : metrics)
+    {
+        for (const std::string& p : expandPath(m.get("path", "").asString()))
+        {
+            if (access(sysPath(p).c_str(), R_OK) == 0)
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+const char* SysfsMetricsCollector::findValue(const Metric& m, const char* text) const
+{
+    switch (m.format)
+    {
+    case FORMAT_INT:
+        return text;
+    case FORMAT_KEY:
+        return findKeyValue(text, m.text.c_str(), m.text.size());
+    case FORMAT_COLUMN:
+    {
+        const char* p = text;
+        for (int i = 0; i < m.line && p; i++)
+        {
+            p = strchr(p, '\n');
+            if (p) p++;
+        }
+        for (int i = 0; i < m.column && p; i++)
+        {
+            while (*p == ' ' || *p == '\t') p++;
+            while (*p && *p != ' ' && *p != '\t' && *p != '\n') p++;
+            if (*p != ' ' && *p != '\t') p = nullptr; // line ended first
+        }
+        return p;
+    }
+    case FORMAT_MATCH:
+    {
+        const char* p = strstr(text, m.text.c_str());
+        return p ? p + m.text.size() : nullptr;
+    }
+    }
+    return nullptr;
+}
+
+bool SysfsMetricsCollector::collect(int64_t now)
+{
+    mReader.read();
+    for (Metric& m : mList)
+    {
+        const char* p = mReader.length(m.slot) >= 0 ? findValue(m, mReader.data(m.slot)) : nullptr;
+        char* end = nullptr;
+        double value = 0.0;
+        int64_t integer = 0;
+        if (p && m.counter.mode() == AccumulativeCounter::MODE_ABSOLUTE)
+        {
+            value = strtod(p, &end);
+            integer = strtoll(p, nullptr, 10);
+        }
+        else if (p)
+        {
+            const uint64_t counter = strtoull(p, &end, 10);
+            if (end != p)
+            {
+                value = m.counter.update(counter, now);
+                integer = (int64_t)value;
+            }
+        }
+        if (!p || end == p)
+        {
+            // Keep all metrics the same length as the sample times, but only complain once
+            if (!m.warned)
+            {
+                DBG_LOG("%s: No value for %s in %s\n", mName.c_str(), m.name.c_str(), mReader.path(m.slot).c_str());
+                m.warned = true;
+            }
+            value = 0.0;
+            integer = 0;
+        }
+        if (m.scaled || m.counter.mode() == AccumulativeCounter::MODE_RATE)
+        {
+            add(m.handle, value * m.scale);
+        }
+        else
+        {
+            add(m.handle, (long long)integer);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "interface.hpp"
+
+// Collects metrics from any sysfs or procfs files given in the JSON configuration, so that new
+// sources do not need a change to the library. All files are read together once per sample.
+//
+// Configuration: "metrics" is a list of objects with these members:
+//  - name: Name of the metric. When path matches several files, the parts of each path that
+//          matched a wildcard are appended, for example "temp_thermal_zone3".
+//  - path: File to read, or a glob pattern of files. Looked up under the sysroot.
+//  - format: Where the number is in the file, one of
+//      "int"     the first number in the file (default)
+//      "key"     the number following 'key' at the start of a line, as in /proc/meminfo
+//                ("MemFree:") or /proc/vmstat ("pgfault")
+//      "column"  the whitespace separated 'column' (from 0) on 'line' (from 0, the default)
+//      "match"   the number following the first occurrence of the text in 'pattern' before its
+//                '%', for example "busy: %"
+//  - scale: Factor to multiply values by. Values are stored as floating point if given.
+//  - mode: "absolute" for the value itself (default), "delta" for the difference to the previous
+//          sample of a counter, or "rate" for that difference per second, as in
+//          AccumulativeCounter. The first sample of delta and rate covers the time since start().
+//  - wrap_bits: Width of a counter that wraps around, if it is not 32 or 64 bits.
+class SysfsMetricsCollector : public Collector
+{
+public:
+    using Collector::Collector;
+
+    virtual bool init() override;
+    virtual bool deinit() override;
+    virtual bool start() override;
+    virtual bool collect(int64_t) override;
+    /// Checks that the configuration names a readable file, without opening it
+    virtual bool available() override;
+    virtual SysReader* reader() override { return &mReader; }
+
+private:
+    enum Format { FORMAT_INT, FORMAT_KEY, FORMAT_COLUMN, FORMAT_MATCH };
+
+    struct Metric
+    {
+        std::string name;
+        int slot = -1;
+        Format format = FORMAT_INT;
+        std::string text; // key, or text before the number for FORMAT_MATCH
+        int line = 0;
+        int column = 0;
+        double scale = 1.0;
+        bool scaled = false;
+        AccumulativeCounter counter;
+        MetricHandle handle = -1;
+        bool warned = false; // about unparseable contents
+    };
+
+    bool addMetrics(const Json::Value& config);
+    const char* findValue(const Metric& m, const char* text) const;
+
+    SysReader mReader;
+    std::map<std::string, int> mSlots; // by path, so that metrics of one file share a read
+    std::vector<Metric> mList;
+};
@@ -0,0 +1,107 @@
+#include "thermal.hpp"
+
+#include "collector_utility.hpp"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <map>
+
+void ThermalCollector::addSources(const std::string& prefix, const std::string& file, const std::string& metricPrefix)
+{
+    const std::string dir = sysPath("/sys/class/thermal/");
+    const std::vector<std::string> entries = listDirectory(dir, prefix);
+    std::vector<std::string> types;
+    std::map<std::string, int> count;
+    for (const std::string& e : entries)
+    {
+        std::string type = sanitizeMetricName(readFirstLine(dir + e + "/type"));
+        if (type.empty()) type = e;
+        types.push_back(type);
+        count[type]++;
+    }
+    for (unsigned i = 0; i < entries.size(); i++)
+    {
+        const std::string path = dir + entries[i] + "/" + file;
+        const int slot = mReader.add(path, 32);
+        if (slot < 0)
+        {
+            if (mDebug) DBG_LOG("%s: Cannot open %s\n", mName.c_str(), path.c_str());
+            continue;
+        }
+        std::string name = metricPrefix + types[i];
+        if (count[types[i]] > 1)
+        {
+            name += "_" + entries[i].substr(prefix.size());
+        }
+        const bool temperature = file == "temp";
+        Source s = { slot, registerMetric(name, !temperature), temperature, 0.0 };
+        mSources.push_back(s);
+        if (mDebug) DBG_LOG("%s: Reading %s as %s\n", mName.c_str(), path.c_str(), name.c_str());
+        if (!temperature)
+        {
+            // Limits can change at runtime, for instance with the battery level
+            const int maxSlot = mReader.add(dir + entries[i] + "/max_state", 32);
+            if (maxSlot >= 0)
+            {
+                Source m = { maxSlot, registerMetric(name + "_max", true), false, 0.0 };
+                mSources.push_back(m);
+            }
+        }
+    }
+}
+
+bool ThermalCollector::init()
+{
+    deinit();
+    addSources("thermal_zone", "temp", "temp_");
+    const bool zones = !mSources.empty();
+    if (mConfig.get("cooling_devices", true).asBool())
+    {
+        addSources("cooling_device", "cur_state", "cooling_");
+    }
+    return zones;
+}
+
+bool ThermalCollector::deinit()
+{
+    mReader.clear();
+    mSources.clear();
+    return true;
+}
+
+bool ThermalCollector::collect(int64_t /* now */)
+{
+    mReader.read();
+    for (Source& s : mSources)
+    {
+        char* end = nullptr;
+        const char* text = mReader.data(s.slot);
+        const long value = strtol(text, &end, 10);
+        const bool valid = mReader.length(s.slot) > 0 && end != text;
+        if (s.temperature)
+        {
+            // Sensors that are switched off fail to read. Keep their place with the last reading
+            // rather than a NaN, which would poison the statistics of the whole loop.
+            if (valid) s.last = value / 1000.0; // from millidegrees
+            add(s.handle, s.last);
+        }
+        else
+        {
+            add(s.handle, valid ? value : 0L);
+        }
+    }
+    return true;
+}
+
+bool ThermalCollector::available()
+{
+    const std::string dir = sysPath("/sys/class/thermal/");
+    for (const std::string& e : listDirectory(dir, "thermal_zone"))
+    {
+        if (access((dir + e + "/temp").c_str(), R_OK) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "interface.hpp"
+
+// Temperatures of every thermal zone in /sys/class/thermal, named after each zone's type as
+// "temp_<type>" in degrees Celsius, and the current state of every cooling device as
+// "cooling_<type>", with its maximum state as "cooling_<type>_max". Zones that share a type get
+// their zone number appended. All files are read together once per sample. A zone whose sensor
+// fails to read repeats its last temperature, or gives zero until it is first read.
+//
+// Configuration:
+//  - cooling_devices: Collect cooling device states as well, default true.
+class ThermalCollector : public Collector
+{
+public:
+    using Collector::Collector;
+
+    virtual bool init() override;
+    virtual bool deinit() override;
+    virtual bool collect(int64_t) override;
+    /// Checks that a thermal zone temperature is readable, without opening it
+    virtual bool available() override;
+    virtual SysReader* reader() override { return &mReader; }
+
+private:
+    struct Source
+    {
+        int slot;
+        MetricHandle handle;
+        bool temperature; // or a cooling state
+        double last; // temperature of the last successful read
+    };
+
+    void addSources(const std::string& prefix, const std::string& file, const std::string& metricPrefix);
+
+    SysReader mReader;
+    std::vector<Source> mSources;
+};
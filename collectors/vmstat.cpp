@@ -0,0 +1,148 @@
+#include "vmstat.hpp"
+
+#include "collector_utility.hpp"
+
+#include <string.h>
+#include <unistd.h>
+#include <iterator>
+
+static const char* defaultKeys[] =
+{
+    "pgscan*", "pgsteal*", "allocstall*", "compact_stall", "compact_fail", "compact_success", "pgmajfault", "workingset_refault*",
+};
+
+static bool matches(const std::string& pattern, const char* key, size_t length)
+{
+    if (!pattern.empty() && pattern.back() == '*')
+    {
+        return length >= pattern.size() - 1 && strncmp(key, pattern.c_str(), pattern.size() - 1) == 0;
+    }
+    return length == pattern.size() && strncmp(key, pattern.c_str(), length) == 0;
+}
+
+bool VmstatCollector::init()
+{
+    deinit();
+    std::vector<std::string> patterns;
+    const Json::Value& keys = mConfig["keys"];
+    for (const Json::Value& k : keys)
+    {
+        patterns.push_back(k.asString());
+    }
+    if (!keys.isArray())
+    {
+        patterns.assign(std::begin(defaultKeys), std::end(defaultKeys));
+    }
+    std::vector<std::string> absolute;
+    const Json::Value& gauges = mConfig["absolute"];
+    for (const Json::Value& k : gauges)
+    {
+        absolute.push_back(k.asString());
+    }
+    if (!gauges.isArray())
+    {
+        absolute.push_back("nr_*");
+    }
+
+    mSlot = mReader.add(sysPath("/proc/vmstat"), 8192);
+    if (mSlot < 0 || !mReader.read())
+    {
+        DBG_LOG("%s: Cannot read /proc/vmstat\n", mName.c_str());
+        return false;
+    }
+    unsigned line = 0;
+    for (const char* p = mReader.data(mSlot); *p; line++)
+    {
+        const size_t length = strcspn(p, " \n");
+        for (const std::string& pattern : patterns)
+        {
+            if (matches(pattern, p, length))
+            {
+                Counter c;
+                c.key.assign(p, length);
+                c.line = line;
+                for (const std::string& a : absolute)
+                {
+                    c.absolute = c.absolute || matches(a, p, length);
+                }
+                c.handle = registerMetric(c.key, !c.absolute); // pages per sample fit in 32 bits, but not all pages
+                mCounters.push_back(c);
+                break;
+            }
+        }
+        p = strchr(p, '\n');
+        if (!p) break;
+        p++;
+    }
+    if (mCounters.empty())
+    {
+        DBG_LOG("%s: None of the configured counters are in /proc/vmstat\n", mName.c_str());
+        return false;
+    }
+    if (mDebug) DBG_LOG("%s: Collecting %u counters\n", mName.c_str(), (unsigned)mCounters.size());
+    return true;
+}
+
+bool VmstatCollector::deinit()
+{
+    mReader.clear();
+    mSlot = -1;
+    mCounters.clear();
+    return true;
+}
+
+bool VmstatCollector::update(bool store)
+{
+    if (!mReader.read())
+    {
+        DBG_LOG("%s: Failed to read /proc/vmstat\n", mName.c_str());
+        return false;
+    }
+    const char* text = mReader.data(mSlot);
+    const char* p = text;
+    unsigned line = 0;
+    for (Counter& c : mCounters)
+    {
+        while (p && line < c.line)
+        {
+            p = strchr(p, '\n');
+            if (p) p++;
+            line++;
+        }
+        // Check that the line is still where it was, in case of a sysroot being replayed from
+        // another kernel, and look it up the slow way otherwise
+        const bool moved = !p || strncmp(p, c.key.c_str(), c.key.size()) != 0 || p[c.key.size()] != ' ';
+        const char* value = moved ? findKeyValue(text, c.key.c_str(), c.key.size()) : p + c.key.size();
+        uint64_t counter = 0;
+        if (value)
+        {
+            parseNumber(value, counter);
+        }
+        const int64_t delta = c.delta.update(counter);
+        if (store)
+        {
+            add(c.handle, c.absolute ? (int64_t)counter : delta);
+        }
+    }
+    return true;
+}
+
+bool VmstatCollector::start()
+{
+    for (Counter& c : mCounters)
+    {
+        c.delta.reset();
+    }
+    update(false);
+    return Collector::start();
+}
+
+bool VmstatCollector::collect(int64_t /* now */)
+{
+    return update(true);
+}
+
+bool VmstatCollector::available()
+{
+    return access(sysPath("/proc/vmstat").c_str(), R_OK) == 0;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "interface.hpp"
+
+// Reclaim, compaction and refault counters from /proc/vmstat, stored under their own names as
+// the change during each sample. Gauges, such as nr_free_pages, go down as well as up, so they
+// are stored as they are instead. The lines of the file do not move while the kernel runs, so the
+// line of each counter is found once, and each sample is a single read and one pass over the
+// text, without allocations.
+//
+// Configuration:
+//  - keys: Counters to collect. A trailing '*' matches all counters starting with the text
+//          before it. Default "pgscan*", "pgsteal*", "allocstall*", "compact_stall",
+//          "compact_fail", "compact_success", "pgmajfault" and "workingset_refault*".
+//  - absolute: Keys, with the same wildcard, that are gauges rather than counters. Default "nr_*".
+class VmstatCollector : public Collector
+{
+public:
+    using Collector::Collector;
+
+    virtual bool init() override;
+    virtual bool deinit() override;
+    virtual bool start() override;
+    virtual bool collect(int64_t) override;
+    virtual bool available() override;
+    virtual SysReader* reader() override { return &mReader; }
+
+private:
+    struct Counter
+    {
+        std::string key;
+        unsigned line = 0; // in the file
+        bool absolute = false; // a gauge, stored as it is
+        CounterDelta delta;
+        MetricHandle handle = -1;
+    };
+
+    /// Parse the file, storing differences to the previous update if store is set
+    bool update(bool store);
+
+    SysReader mReader;
+    int mSlot = -1;
+    std::vector<Counter> mCounters; // in the order of their lines
+};
@@ -1,4 +1,6 @@
 #include "interface.hpp"
+#include "trace.hpp"
+#include "output.hpp"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -6,13 +8,25 @@
 #include <errno.h>
 #include <unistd.h>
 #include <functional>
+#include <algorithm>
+#include <climits>
+#include <time.h>
 
 #ifndef __APPLE__
 #include "collectors/perf.hpp"
 #include "collectors/cpufreq.hpp"
+#include "collectors/cpuidle.hpp"
+#include "collectors/cpustat.hpp"
 #include "collectors/gpufreq.hpp"
+#include "collectors/devfreq.hpp"
+#include "collectors/gpu_utilisation.hpp"
 #include "collectors/procfs_stat.hpp"
+#include "collectors/psi.hpp"
+#include "collectors/schedstat.hpp"
+#include "collectors/sysfs.hpp"
+#include "collectors/vmstat.hpp"
 #include "collectors/cputemp.hpp"
+#include "collectors/thermal.hpp"
 #include "collectors/memory.hpp"
 #include "collectors/power.hpp"
 #include "collectors/ferret.hpp"
@@ -27,7 +41,225 @@
 
 static int64_t getTime()
 {
-    return static_cast<int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now().time_since_epoch()).count());
+    return static_cast<int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+static std::string sysroot;
+static bool sysrootSet = false;
+
+const std::string& collectorSysroot()
+{
+    if (!sysrootSet)
+    {
+        const char* env = getenv("LIBCOLLECTOR_SYSROOT");
+        setCollectorSysroot(env ? env : "");
+    }
+    return sysroot;
+}
+
+void setCollectorSysroot(const std::string& root)
+{
+    sysroot = root;
+    while (!sysroot.empty() && sysroot.back() == '/') sysroot.pop_back();
+    sysrootSet = true;
+}
+
+std::string sysPath(const std::string& path)
+{
+    return path.empty() || path[0] != '/' ? path : collectorSysroot() + path;
+}
+
+static int64_t getTimeNs()
+{
+    return static_cast<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// Adds the time until the end of the scope to a total, if given one
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(int64_t* total) : mTotal(total), mStart(total ? getTimeNs() : 0) {}
+    ~ScopedTimer() { if (mTotal) *mTotal += getTimeNs() - mStart; }
+
+private:
+    int64_t* mTotal;
+    int64_t mStart;
+};
+
+static int64_t threadCpuTimeNs()
+{
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+    {
+        return 0;
+    }
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// ---------- SPILL ----------
+
+bool CollectorSpill::open(const std::string& filename, size_t budget)
+{
+    assert(!isOpen());
+    mFD = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (mFD == -1)
+    {
+        DBG_LOG("Failed to open spill file %s: %s\n", filename.c_str(), strerror(errno));
+        return false;
+    }
+    unlink(filename.c_str());
+    mBudget = budget;
+    mPending = 0;
+    mEnd = 0;
+    mWrittenEnd = 0;
+    mFinished = false;
+    mThread = std::thread(&CollectorSpill::loop, this);
+    if (pthread_setname_np(mThread.native_handle(), "collector_spill"))
+    {
+        DBG_LOG("Failed to set spill thread name, will inherit from parent process.\n");
+    }
+    return true;
+}
+
+void CollectorSpill::close()
+{
+    if (!isOpen())
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mFinished = true;
+    }
+    mQueued.notify_all();
+    mThread.join();
+    ::close(mFD);
+    mFD = -1;
+}
+
+void CollectorSpill::reset()
+{
+    if (!isOpen())
+    {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(mMutex);
+    mWritten.wait(lock, [this]() { return mPending == 0; });
+    if (ftruncate(mFD, 0) != 0)
+    {
+        DBG_LOG("Failed to truncate spill file: %s\n", strerror(errno));
+    }
+    mEnd = 0;
+    mWrittenEnd = 0;
+}
+
+int64_t CollectorSpill::enqueue(const void* data, size_t bytes, std::shared_ptr<void> owner)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    mWritten.wait(lock, [this, bytes]() { return mPending == 0 || mPending + bytes <= mBudget; });
+    Block block = { mEnd, data, bytes, owner };
+    mQueue.push_back(block);
+    mEnd += bytes;
+    mPending += bytes;
+    mQueued.notify_one();
+    return block.offset;
+}
+
+bool CollectorSpill::read(int64_t offset, void* dst, size_t bytes)
+{
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mWritten.wait(lock, [this, offset, bytes]() { return mWrittenEnd >= offset + (int64_t)bytes; });
+    }
+    if (pread(mFD, dst, bytes, offset) != (ssize_t)bytes)
+    {
+        DBG_LOG("Failed to read back from spill file: %s\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void CollectorSpill::loop()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (true)
+    {
+        mQueued.wait(lock, [this]() { return mFinished || !mQueue.empty(); });
+        if (mQueue.empty())
+        {
+            break; // finished, and everything written
+        }
+        Block block = mQueue.front();
+        mQueue.pop_front();
+        lock.unlock();
+        if (pwrite(mFD, block.data, block.bytes, block.offset) != (ssize_t)block.bytes)
+        {
+            DBG_LOG("Failed to write to spill file: %s\n", strerror(errno));
+        }
+        block.owner.reset();
+        lock.lock();
+        mPending -= block.bytes;
+        mWrittenEnd = block.offset + block.bytes;
+        mWritten.notify_all();
+    }
+}
+
+// ---------- STATISTICS ----------
+
+double CollectorStats::quantile(double q) const
+{
+    if (mCount == 0)
+    {
+        return 0.0;
+    }
+    // Walk the buckets in value order: negative buckets from the largest magnitude down, then zero,
+    // then positive buckets from the smallest up.
+    const uint64_t rank = (uint64_t)(q * (mCount - 1));
+    uint64_t seen = 0;
+    double value = mMax;
+    bool found = false;
+    for (auto it = mNegative.rbegin(); it != mNegative.rend() && !found; ++it)
+    {
+        seen += it->second;
+        if (seen > rank) { value = -bucketValue(it->first); found = true; }
+    }
+    if (!found && mZero > 0)
+    {
+        seen += mZero;
+        if (seen > rank) { value = 0.0; found = true; }
+    }
+    for (auto it = mPositive.begin(); it != mPositive.end() && !found; ++it)
+    {
+        seen += it->second;
+        if (seen > rank) { value = bucketValue(it->first); found = true; }
+    }
+    return std::min(std::max(value, mMin), mMax);
+}
+
+CollectorStatsSummary CollectorStats::summary() const
+{
+    CollectorStatsSummary s;
+    s.count = mCount;
+    s.mean = mMean;
+    s.stddev = stddev();
+    s.min = mMin;
+    s.max = mMax;
+    s.p50 = quantile(0.50);
+    s.p90 = quantile(0.90);
+    s.p99 = quantile(0.99);
+    return s;
+}
+
+static void appendStats(Json::Value& v, const CollectorStatsSummary& s)
+{
+    v["count"].append(static_cast<Json::UInt64>(s.count));
+    v["mean"].append(s.mean);
+    v["stddev"].append(s.stddev);
+    v["min"].append(s.min);
+    v["max"].append(s.max);
+    v["p50"].append(s.p50);
+    v["p90"].append(s.p90);
+    v["p99"].append(s.p99);
 }
 
 // ---------- COLLECTOR ----------
@@ -39,12 +271,32 @@ void Collector::useThreading(int sampleRate)
     mSampleRate = sampleRate;
 }
 
+MetricHandle Collector::registerMetric(const std::string& key, bool compact)
+{
+    CollectorValueList* list = &mResults[key];
+    if (list->type == CollectorValueList::TYPE_UNASSIGNED)
+    {
+        list->compact = compact;
+        list->online = mOnlineStats;
+        list->spill = mSpill;
+    }
+    for (unsigned i = 0; i < mMetrics.size(); i++)
+    {
+        if (mMetrics[i] == list)
+        {
+            return i;
+        }
+    }
+    mMetrics.push_back(list);
+    return mMetrics.size() - 1;
+}
+
 void Collector::loop()
 {
     while (!finished)
     {
         int64_t t1 = getTime();
-        collect( t1 );
+        sample( t1 );
         int64_t t2 = getTime();
 
         auto duration = std::chrono::microseconds( t2 - t1 );
@@ -54,54 +306,311 @@ void Collector::loop()
             std::this_thread::sleep_for(std::chrono::milliseconds(mSampleRate) - duration);
         }
     }
+    if (mMeasureOverhead)
+    {
+        mOverhead.threadCpuNs = threadCpuTimeNs();
+    }
 }
 
-// This post-processing assumes that the sampling done in a threaded collector is
-// fairly uniform. If it is not, we will need to collect timestamps from it as well,
-// in order to do the matching, which has its own costs.
-bool Collector::postprocess(const std::vector<int64_t>& timing)
+void Collector::sample(int64_t now)
 {
-    if (mIsThreaded && !mIsSummarized) // remix values based on frame times
+    std::lock_guard<std::mutex> lock(mSampleMutex);
+    const int64_t before = mMeasureOverhead ? getTimeNs() : 0;
+    const bool collected = collect(now);
+    if (mMeasureOverhead)
+    {
+        mOverhead.collect.add(getTimeNs() - before);
+    }
+    if (collected && !mOnlineStats) // timestamps are not needed without samples
+    {
+        mSampleTimes.push_back(now, mSpill);
+    }
+}
+
+size_t Collector::memoryUsed() const
+{
+    size_t bytes = mSampleTimes.memoryUsed() + mMetrics.capacity() * sizeof(CollectorValueList*);
+    for (const auto& pair : mResults)
+    {
+        bytes += sizeof(pair) + pair.first.capacity() + pair.second.memoryUsed();
+    }
+    return bytes;
+}
+
+static double toDouble(CollectorValueList::vtype type, CollectorValue v)
+{
+    switch (type)
+    {
+    case CollectorValueList::TYPE_FP64: return v.fp64;
+    case CollectorValueList::TYPE_I64: return v.i64;
+    case CollectorValueList::TYPE_U64: return v.u64;
+    case CollectorValueList::TYPE_UNASSIGNED: break;
+    }
+    assert(false);
+    return 0.0;
+}
+
+static CollectorValue fromDouble(CollectorValueList::vtype type, double d)
+{
+    CollectorValue v;
+    v.u64 = 0;
+    switch (type)
+    {
+    case CollectorValueList::TYPE_FP64: v.fp64 = d; break;
+    case CollectorValueList::TYPE_I64: v.i64 = llround(d); break;
+    case CollectorValueList::TYPE_U64: v.u64 = d > 0.0 ? (uint64_t)llround(d) : 0; break;
+    case CollectorValueList::TYPE_UNASSIGNED: assert(false); break;
+    }
+    return v;
+}
+
+// Each sample is taken to hold from its timestamp until the next one, and each frame gets the
+// time-weighted average of the samples overlapping it. Frames and samples are both in time order,
+// so this is a single merge pass over the two.
+void resampleTimed(const CollectorValueList& in, const CollectorColumn<int64_t>& times, int64_t start,
+                   const std::vector<int64_t>& timing, CollectorValueList& out)
+{
+    const size_t samples = in.size();
+    size_t k = 0;
+    int64_t frameStart = start;
+    for (const int64_t frameTime : timing)
     {
-        double duration = 0;
-        for (const int64_t v : timing)
+        const int64_t frameEnd = frameStart + frameTime;
+        while (k + 1 < samples && times.at(k + 1) <= frameStart)
         {
-            duration += v;
+            k++;
         }
+        double sum = 0.0;
+        int64_t t = frameStart;
+        while (k + 1 < samples && times.at(k + 1) < frameEnd)
+        {
+            sum += toDouble(in.type, in.at(k)) * (times.at(k + 1) - t);
+            t = times.at(k + 1);
+            k++;
+        }
+        sum += toDouble(in.type, in.at(k)) * (frameEnd - t);
+        out.push_back(frameTime > 0 ? fromDouble(in.type, sum / frameTime) : in.at(k));
+        frameStart = frameEnd;
+    }
+}
+
+// Fallback for collectors that do not add exactly one value per metric per sample. This
+// assumes that the sampling done in the thread is fairly uniform.
+void resampleUniform(const CollectorValueList& in, const std::vector<int64_t>& timing, CollectorValueList& out)
+{
+    double duration = 0;
+    for (const int64_t v : timing)
+    {
+        duration += v;
+    }
+    const double samples = in.size();
+    int64_t cur_time = 0;
+    for (unsigned i = 0; i < timing.size(); i++)
+    {
+        // find closest match
+        const int index = trunc((double)cur_time / duration * samples);
+        cur_time += timing.at(i);
+        out.push_back(in.at(index));
+    }
+}
+
+bool Collector::postprocess(const std::vector<int64_t>& timing)
+{
+    if (mIsThreaded && !mIsSummarized) // remix values based on frame times
+    {
         CollectorValueResults tmp;
         for (const auto& kv : mResults)
         {
+            if (kv.second.type == CollectorValueList::TYPE_UNASSIGNED || kv.second.online)
+            {
+                continue; // registered but never sampled, or no samples kept
+            }
             if (kv.second.size() == 0)
             {
                 return false;
             }
-            const double samples = kv.second.size();
-            int64_t cur_time = 0;
             tmp[kv.first].type = kv.second.type;
-            for (unsigned i = 0; i < timing.size(); i++)
+            tmp[kv.first].compact = kv.second.compact;
+            tmp[kv.first].spill = kv.second.spill;
+            if (kv.second.size() == mSampleTimes.size())
+            {
+                resampleTimed(kv.second, mSampleTimes, mStartTime, timing, tmp[kv.first]);
+            }
+            else
             {
-                // find closest match
-                const int index = trunc((double)cur_time / duration * samples);
-                cur_time += timing.at(i);
-                tmp[kv.first].push_back(kv.second.at(index));
+                resampleUniform(kv.second, timing, tmp[kv.first]);
             }
         }
-        mResults = tmp;
+        // Assign per entry rather than replacing the map, so that metric handles stay valid
+        for (auto& kv : tmp)
+        {
+            std::swap(mResults[kv.first], kv.second);
+        }
     }
     return true;
 }
 
+// ---------- SCHEDULER ----------
+
+static void addNs(struct timespec& ts, int64_t ns)
+{
+    ts.tv_sec += ns / 1000000000;
+    ts.tv_nsec += ns % 1000000000;
+    if (ts.tv_nsec >= 1000000000)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+}
+
+static int64_t diffNs(const struct timespec& a, const struct timespec& b)
+{
+    return (int64_t)(a.tv_sec - b.tv_sec) * 1000000000 + (a.tv_nsec - b.tv_nsec);
+}
+
+void CollectorScheduler::start(const std::vector<Collector*>& collectors, const std::vector<int>& divisors, int tickMs)
+{
+    assert(!running());
+    assert(collectors.size() == divisors.size());
+    mCollectors = collectors;
+    mDivisors = divisors;
+    mTickNs = (int64_t)tickMs * 1000000;
+    mTicks = 0;
+    mMissed = 0;
+    mWakeups = 0;
+    mReadNs = 0;
+    mJitterSumNs = 0;
+    mJitterMaxNs = 0;
+    mCpuNs = 0;
+    mFinished = false;
+    mThread = std::thread(&CollectorScheduler::loop, this);
+    if (pthread_setname_np(mThread.native_handle(), "collector_sched"))
+    {
+        DBG_LOG("Failed to set scheduler thread name, will inherit from parent process.\n");
+    }
+}
+
+void CollectorScheduler::stop()
+{
+    mFinished = true;
+    if (mThread.joinable())
+    {
+        mThread.join();
+    }
+}
+
+void CollectorScheduler::loop()
+{
+    struct timespec deadline;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    int64_t tick = 0;
+    while (!mFinished)
+    {
+        const int64_t t = getTime();
+        mReaders.clear();
+        for (unsigned i = 0; i < mCollectors.size(); i++)
+        {
+            SysReader* r = tick % mDivisors[i] == 0 ? mCollectors[i]->reader() : nullptr;
+            if (r) mReaders.push_back(r);
+        }
+        {
+            ScopedTimer timer(&mReadNs);
+            mBatch.read(mReaders);
+        }
+        for (unsigned i = 0; i < mCollectors.size(); i++)
+        {
+            if (tick % mDivisors[i] == 0)
+            {
+                mCollectors[i]->sample(t);
+            }
+        }
+        mBatch.finish();
+        mTicks++;
+        tick++;
+        addNs(deadline, mTickNs);
+
+        // If we overran one or more deadlines, skip them rather than trying to catch up
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        while (diffNs(now, deadline) >= 0)
+        {
+            mMissed++;
+            tick++;
+            addNs(deadline, mTickNs);
+        }
+        int err = EINTR;
+        while (!mFinished && (err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr)) == EINTR) {}
+        if (err == 0) // only a wakeup from the sleep measures jitter
+        {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            const int64_t jitter = diffNs(now, deadline);
+            mWakeups++;
+            mJitterSumNs += jitter;
+            mJitterMaxNs = std::max(mJitterMaxNs, jitter);
+        }
+    }
+    mCpuNs = threadCpuTimeNs();
+}
+
+Json::Value CollectorScheduler::results() const
+{
+    Json::Value v;
+    v["tick_us"] = static_cast<Json::Int64>(mTickNs / 1000);
+    v["ticks"] = static_cast<Json::Int64>(mTicks);
+    v["missed_deadlines"] = static_cast<Json::Int64>(mMissed);
+    v["jitter_avg_us"] = mWakeups > 0 ? (double)mJitterSumNs / mWakeups / 1000.0 : 0.0;
+    v["jitter_max_us"] = (double)mJitterMaxNs / 1000.0;
+    return v;
+}
+
 // ---------- SYSFS COLLECTOR ----------
 
+bool AccumulativeCounter::configure(const Json::Value& config, Mode defaultMode)
+{
+    mDelta = CounterDelta(config.get("wrap_bits", 0).asInt());
+    mMode = defaultMode;
+    if (!config.isMember("mode"))
+    {
+        return true;
+    }
+    const std::string mode = config["mode"].asString();
+    if (mode == "absolute") mMode = MODE_ABSOLUTE;
+    else if (mode == "delta") mMode = MODE_DELTA;
+    else if (mode == "rate") mMode = MODE_RATE;
+    else return false;
+    return true;
+}
+
 SysfsCollector::SysfsCollector(const Json::Value& config, const std::string& name, const std::vector<std::string>& sysfsfiles, bool accumulative)
     : Collector(config, name), mOptions(sysfsfiles), mAccumulative(accumulative)
 {
-    (void)mAccumulative; // TBD - use me
+    if (mAccumulative && !mCounter.configure(mConfig, AccumulativeCounter::MODE_DELTA))
+    {
+        DBG_LOG("%s: Unknown mode \"%s\", using delta\n", mName.c_str(), mConfig["mode"].asString().c_str());
+    }
 }
 
 bool SysfsCollector::parse(const char* buffer)
 {
     char *end;
+    if (mCounter.mode() != AccumulativeCounter::MODE_ABSOLUTE)
+    {
+        const uint64_t counter = strtoull(buffer, &end, 10);
+        if (!*end)
+        {
+            return false;
+        }
+        const double value = mCounter.update(counter, mNow);
+        if (mCounter.mode() == AccumulativeCounter::MODE_DELTA && std::isnan(mFactor))
+        {
+            add(mHandle, (long long)value);
+        }
+        else
+        {
+            add(mHandle, value * (std::isnan(mFactor) ? 1.0 : mFactor));
+        }
+        return true;
+    }
     long temp = strtol(buffer, &end, 10);
     if (!*end)
     {
@@ -109,44 +618,29 @@ bool SysfsCollector::parse(const char* buffer)
     }
     if (std::isnan(mFactor))
     {
-        add(mName, temp);
+        add(mHandle, temp);
     }
     else
     {
-        add(mName, temp * mFactor);
+        add(mHandle, temp * mFactor);
     }
     return true;
 }
 
 bool SysfsCollector::collect(int64_t now)
 {
-    char buf[1024];
+    assert(mSlot >= 0);
+    mNow = now;
 
-    assert(mFD != -1);
-    memset(buf, 0x00, sizeof(buf));
-
-    if (read(mFD, buf, sizeof(buf) - 1) == -1)
+    if (!mReader.read())
     {
-        DBG_LOG("%s: Failed to read %s: %s\n", mName.c_str(), mSysfsFile.c_str(), strerror(errno));
+        DBG_LOG("%s: Failed to read %s: %s\n", mName.c_str(), mSysfsFile.c_str(), strerror(-mReader.length(mSlot)));
         return false;
     }
 
-    if (lseek(mFD, 0, SEEK_SET) == -1)
-    {
-        // workaround for weird hikey implementation
-        close(mFD);
-        mFD = open(mSysfsFile.c_str(), O_RDONLY);
-        if (mFD < 0)
-        {
-            DBG_LOG("%s: Failed to both seek and re-open %s: %s\n", mName.c_str(), mSysfsFile.c_str(), strerror(errno));
-            mFD = -1;
-            return false;
-        }
-    }
-
-    if (!parse(buf))
+    if (!parse(mReader.data(mSlot)))
     {
-        DBG_LOG("%s: Read garbage from %s: \"%s\"\n", mName.c_str(), mSysfsFile.c_str(), buf);
+        DBG_LOG("%s: Read garbage from %s: \"%s\"\n", mName.c_str(), mSysfsFile.c_str(), mReader.data(mSlot));
         return false;
     }
 
@@ -155,14 +649,14 @@ bool SysfsCollector::collect(int64_t now)
 
 bool SysfsCollector::init()
 {
-    if (mFD == -2)
+    mHandle = registerMetric(mName);
+    if (mSlot == -2)
     {
         for (const std::string& s : mOptions)
         {
-            mFD = open(s.c_str(), O_RDONLY);
-            if (mFD < 0)
+            mSlot = mReader.add(sysPath(s), 1024);
+            if (mSlot < 0)
             {
-                mFD = -1;
                 continue;
             }
             mSysfsFile = s;
@@ -171,17 +665,38 @@ bool SysfsCollector::init()
         }
     }
 
-    return mFD != -1;
+    return mSlot >= 0;
 }
 
-SysfsCollector::~SysfsCollector()
+bool SysfsCollector::start()
 {
-    deinit();
-    if (mFD != -1)
+    mCounter.reset();
+    if (mCounter.mode() != AccumulativeCounter::MODE_ABSOLUTE && mSlot >= 0 && mReader.read())
     {
-        close(mFD);
+        mCounter.update(strtoull(mReader.data(mSlot), nullptr, 10), getTime());
     }
-    mFD = -1;
+    return Collector::start();
+}
+
+bool SysfsCollector::available()
+{
+    if (mSlot >= 0)
+    {
+        return true;
+    }
+    for (const std::string& s : mOptions)
+    {
+        if (access(sysPath(s).c_str(), R_OK) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+SysfsCollector::~SysfsCollector()
+{
+    deinit();
     mCollecting = false;
 }
 
@@ -210,71 +725,91 @@ Collection::Collection(const Json::Value& config, bool enablePerapiPerf) : mEnab
 
 void Collection::init_from_json(const Json::Value& config)
 {
+    if (config.isMember("sysroot")) setCollectorSysroot(config["sysroot"].asString());
+    if (config.isMember("io_uring")) SysReadBatch::setUringEnabled(config["io_uring"].asBool());
+    if (config.isMember("debug") && config["debug"].asBool()) mDebug = true;
 #ifndef __APPLE__
     if (mEnablePerapiPerf)
     {
-        mCollectors.push_back(new PerfCollector(config, "perf", true));
+        registerCollector("perf", [](const Json::Value& config, const std::string& name) -> Collector* { return new PerfCollector(config, name, true); });
     }
     else
     {
-        mCollectors.push_back(new PerfCollector(config, "perf"));
-        mCollectors.push_back(new SysfsCollector(config, "battery_temperature",
-            { "/sys/class/power_supply/battery/temp",
-            "/sys/devices/platform/android-battery/power_supply/android-battery/temp", // Nexus 10
-            "/sys/class/power_supply/battery/batt_temp" })); // teclast tpad-1
-        mCollectors.push_back(new CPUFreqCollector(config, "cpufreq"));
-        mCollectors.push_back(new SysfsCollector(config, "memfreq",
+        registerCollector<PerfCollector>("perf");
+        registerCollector("battery_temperature", [](const Json::Value& config, const std::string& name) -> Collector* {
+            SysfsCollector* c = new SysfsCollector(config, name,
+                { "/sys/class/power_supply/battery/temp",
+                "/sys/devices/platform/android-battery/power_supply/android-battery/temp", // Nexus 10
+                "/sys/class/power_supply/battery/batt_temp" }); // teclast tpad-1
+            c->doubleTransform(0.1); // divide by 10 and store as float
+            return c;
+        });
+        registerCollector<CPUFreqCollector>("cpufreq");
+        registerCollector<CPUIdleCollector>("cpuidle");
+        registerCollector<CPUStatCollector>("cpustat");
+        addSysfsCollector("memfreq",
             { "/sys/class/devfreq/exynos5-busfreq-mif/cur_freq", // note 3
             "/sys/class/devfreq/exynos5-devfreq-mif/cur_freq", // note 4
-            "/sys/devices/17000010.devfreq_mif/devfreq/17000010.devfreq_mif/cur_freq" })); // Mali S7
-        mCollectors.push_back(new SysfsCollector(config, "memfreqdisplay",
-            { "/sys/devices/17000030.devfreq_disp/devfreq/17000030.devfreq_disp/cur_freq" })); // Mali S7
-        mCollectors.push_back(new SysfsCollector(config, "memfreqint",
+            "/sys/devices/17000010.devfreq_mif/devfreq/17000010.devfreq_mif/cur_freq" }); // Mali S7
+        addSysfsCollector("memfreqdisplay",
+            { "/sys/devices/17000030.devfreq_disp/devfreq/17000030.devfreq_disp/cur_freq" }); // Mali S7
+        addSysfsCollector("memfreqint",
             { "/sys/class/devfreq/exynos5-busfreq-int/cur_freq",    // note 3
             "/sys/class/devfreq/exynos5-devfreq-int/cur_freq", // note 4
-            "/sys/devices/17000020.devfreq_int/devfreq/17000020.devfreq_int/cur_freq" })); // Mali S7
-        mCollectors.push_back(new SysfsCollector(config, "gpu_active_time",
-            { "/sys/devices/platform/mali.0/power/runtime_active_time",    // mali
-            "/sys/devices/platform/pvrsrvkm.0/power/runtime_active_time", // power-vr
-            "/sys/devices/virtual/graphics/fb0/power/runtime_active_time" }, // adreno
-            true)); // accumulative value
-        mCollectors.push_back(new SysfsCollector(config, "gpu_suspended_time",
-            { "/sys/devices/platform/mali.0/power/runtime_suspended_time",    // mali
-            "/sys/devices/platform/pvrsrvkm.0/power/runtime_suspended_time", // power-vr
-            "/sys/devices/virtual/graphics/fb0/power/runtime_suspended_time" }, // adreno (but only for framebuffer zero!)
-            true)); // accumulative value
-        mCollectors.push_back(new SysfsCollector(config, "cpufreqtrans",
-            { "/sys/devices/system/cpu/cpu0/cpufreq/stats/total_trans" },
-            true)); // accumulative value
-        if (config.isMember("debug") && config["debug"].asBool()) mDebug = true;
+            "/sys/devices/17000020.devfreq_int/devfreq/17000020.devfreq_int/cur_freq" }); // Mali S7
+        registerCollector("gpu_active_time", [](const Json::Value& config, const std::string& name) -> Collector* {
+            return new SysfsCollector(config, name, gpuRuntimePaths("runtime_active_time"), true); // accumulative value
+        });
+        registerCollector("gpu_suspended_time", [](const Json::Value& config, const std::string& name) -> Collector* {
+            return new SysfsCollector(config, name, gpuRuntimePaths("runtime_suspended_time"), true); // accumulative value
+        });
+        registerCollector<GPUUtilisationCollector>("gpu_utilisation");
+        registerCollector("cpufreqtrans", [](const Json::Value& config, const std::string& name) -> Collector* {
+            return new SysfsCollector(config, name,
+                { "/sys/devices/system/cpu/cpu0/cpufreq/stats/total_trans" },
+                true); // accumulative value
+        });
 #if defined(ANDROID) || defined(__ANDROID__)
-        mCollectors.push_back(new StreamlineCollector(config, "streamline"));
+        registerCollector<StreamlineCollector>("streamline");
 #endif
-        mCollectors.push_back(new MemoryCollector(config, "memory"));
-        mCollectors.push_back(new CPUTemperatureCollector(config, "cputemp"));
-        mCollectors.push_back(new GPUFreqCollector(config, "gpufreq"));
-        mCollectors.push_back(new PowerDataCollector(config, "power"));
-        mCollectors.push_back(new FerretCollector(config, "ferret"));
-        mCollectors.push_back(new ProcFSStatCollector(config, "procfs"));
-        mCollectors.push_back(new MaliCounterCollector(config, "malicounters"));
+        registerCollector<MemoryCollector>("memory");
+        registerCollector<CPUTemperatureCollector>("cputemp");
+        registerCollector<ThermalCollector>("thermal");
+        registerCollector<GPUFreqCollector>("gpufreq");
+        registerCollector<DevfreqCollector>("devfreq");
+        registerCollector<PowerDataCollector>("power");
+        registerCollector<FerretCollector>("ferret");
+        registerCollector<ProcFSStatCollector>("procfs");
+        registerCollector<PressureCollector>("psi");
+        registerCollector<SchedstatCollector>("schedstat");
+        registerCollector<SysfsMetricsCollector>("sysfs");
+        registerCollector<VmstatCollector>("vmstat");
+        registerCollector<MaliCounterCollector>("malicounters");
     }
 #endif
     if (!mEnablePerapiPerf)
-        mCollectors.push_back(new RusageCollector(config, "rusage"));
+        registerCollector<RusageCollector>("rusage");
+}
 
-    for (Collector* c : mCollectors)
+void Collection::registerCollector(const std::string& name, CollectorFactory factory)
+{
+    for (auto& f : mFactories)
     {
-        if (mDebug)
+        if (f.first == name)
         {
-            DBG_LOG("Built-in collector: %s\n", c->name().c_str());
-            c->setDebug(true);
+            f.second = factory;
+            return;
         }
-        mCollectorMap[c->name()] = c;
     }
+    mFactories.push_back(std::make_pair(name, factory));
+}
 
-    // Various specializations
-    if (!mEnablePerapiPerf)
-       mCollectorMap["battery_temperature"]->doubleTransform(0.1); // divide by 10 and store as float
+void Collection::createAll()
+{
+    for (const auto& f : mFactories)
+    {
+        collector(f.first);
+    }
 }
 
 Collection::~Collection()
@@ -284,11 +819,13 @@ Collection::~Collection()
         c->deinit();
         delete c;
     }
+    delete mTrace;
 }
 
 std::vector<std::string> Collection::available()
 {
     std::vector<std::string> list;
+    createAll();
     for (Collector* c : mCollectors)
     {
         if (c->available())
@@ -302,6 +839,7 @@ std::vector<std::string> Collection::available()
 std::vector<std::string> Collection::unavailable()
 {
     std::vector<std::string> list;
+    createAll();
     for (Collector* c : mCollectors)
     {
         if (!c->available())
@@ -321,16 +859,22 @@ bool Collection::initialize_collector(const std::string& name)
             return true; // if so, ignore it
         }
     }
-    if (!mCollectorMap[name]->init())
+    Collector* c = collector(name);
+    if (!c)
+    {
+        DBG_LOG("No such collector: %s\n", name.c_str());
+        return false;
+    }
+    if (!c->init())
     {
         DBG_LOG("Failed to initialize collector: %s\n", name.c_str());
         return false;
     }
-    mRunning.push_back(mCollectorMap[name]);
+    mRunning.push_back(c);
     if (mConfig[name].get("threaded", false).asBool())
     {
         int sample_rate = mConfig[name].get("sample_rate", 100).asInt();
-        mCollectorMap[name]->useThreading(sample_rate);
+        c->useThreading(sample_rate);
     }
     DBG_LOG("Successfully initialized collector: %s\n", name.c_str());
     return true;
@@ -346,11 +890,11 @@ bool Collection::initialize(std::vector<std::string> list)
         {
             continue;
         }
-        else if (mCollectorMap.count(s) == 0)
+        else if (!collector(s))
         {
             DBG_LOG("No such built-in collector: %s\n", s.c_str());
         }
-        else if (!mCollectorMap[s]->available()) // permit this one
+        else if (!collector(s)->available()) // permit this one
         {
             DBG_LOG("Collector exists but is not available: %s\n", s.c_str());
         }
@@ -372,7 +916,26 @@ bool Collection::initialize(std::vector<std::string> list)
 
 Collector* Collection::collector(const std::string& name)
 {
-    return mCollectorMap[name];
+    auto it = mCollectorMap.find(name);
+    if (it != mCollectorMap.end())
+    {
+        return it->second;
+    }
+    for (const auto& f : mFactories)
+    {
+        if (f.first == name)
+        {
+            Collector* c = f.second(mConfig, name);
+            if (mDebug)
+            {
+                DBG_LOG("Created collector: %s\n", name.c_str());
+                c->setDebug(true);
+            }
+            addCollector(c);
+            return c;
+        }
+    }
+    return nullptr;
 }
 
 void Collection::start(const std::vector<std::string>& headers)
@@ -385,15 +948,45 @@ void Collection::start(const std::vector<std::string>& headers)
     mCustomHeaders = headers;
     mCustom.resize(headers.size());
     mCustomSummarized.resize(headers.size());
+    if (mConfig.isMember("spill_file") && !mSpill.isOpen())
+    {
+        mSpill.open(mConfig["spill_file"].asString(), mConfig.get("spill_budget", 4 * 1024 * 1024).asUInt());
+    }
+    else
+    {
+        mSpill.reset(); // the samples of the last capture are cleared below, so the file can be reused
+    }
+    if (mConfig.isMember("trace_file"))
+    {
+        if (!mTrace) mTrace = new CollectorTraceWriter;
+        mTrace->close();
+        mTrace->open(mConfig["trace_file"].asString());
+        mTraceFlushFrames = std::max(1u, mConfig.get("trace_flush_frames", 1024).asUInt());
+        mTraced.clear();
+    }
+    const bool scheduled = mConfig.get("central_scheduler", false).asBool() && !mEnablePerapiPerf;
+    mMeasureOverhead = mConfig.get("measure_overhead", false).asBool();
+    mCsvWriteNs = 0;
+    mTraceWriteNs = 0;
+    mFileReadNs = 0;
+    std::vector<Collector*> threaded;
     for (Collector* c : mRunning)
     {
         c->clear();
+        c->measureOverhead(mMeasureOverhead);
+        c->setStartTime(mStartTime);
+        c->setSpill(mSpill.isOpen() ? &mSpill : nullptr);
         if (!c->start())
         {
             DBG_LOG("Failed to start collector: %s\n", c->name().c_str());
             continue;
         }
-        if (c->isThreaded())
+        if (c->isThreaded() && scheduled)
+        {
+            c->finished = false;
+            threaded.push_back(c);
+        }
+        else if (c->isThreaded())
         {
             c->finished = false;
             if (mEnablePerapiPerf)
@@ -413,6 +1006,22 @@ void Collection::start(const std::vector<std::string>& headers)
             }
         }
     }
+    if (threaded.size() > 0)
+    {
+        // Tick at the fastest requested rate unless told otherwise, and run slower collectors on
+        // every n-th tick only
+        int tick = INT_MAX;
+        for (Collector* c : threaded) tick = std::min(tick, c->sampleRate());
+        tick = std::max(1, mConfig.get("scheduler_tick", tick).asInt());
+        std::vector<int> divisors;
+        for (Collector* c : threaded)
+        {
+            const int divisor = mConfig[c->name()].get("rate_divisor", (c->sampleRate() + tick / 2) / tick).asInt();
+            divisors.push_back(std::max(1, divisor));
+        }
+        mScheduler.start(threaded, divisors, tick);
+    }
+    mScheduled = threaded.size() > 0;
 
     running = true;
 }
@@ -427,15 +1036,22 @@ void Collection::stop()
             c->finished = true;
         }
     }
+    mScheduler.stop();
     // Then stop all collectors (this can take some time)
     std::vector<Collector*> tmp;
     for (Collector* c : mRunning)
     {
-        if (c->isThreaded())
+        if (c->thread.joinable())
         {
             c->thread.join();
         }
         c->stop();
+        if (mTrace && mTrace->isOpen() && c->isThreaded())
+        {
+            ScopedTimer timer(mMeasureOverhead ? &mTraceWriteNs : nullptr);
+            traceSamples(c); // the last ones, before postprocessing maps them onto frames
+        }
+        ScopedTimer timer(mMeasureOverhead ? &c->overhead().postprocessNs : nullptr);
         if (c->postprocess(mTiming))
         {
             tmp.push_back(c); // is valid result
@@ -443,6 +1059,19 @@ void Collection::stop()
     }
     mRunning = tmp;
 
+    if (mTrace && mTrace->isOpen())
+    {
+        ScopedTimer timer(mMeasureOverhead ? &mTraceWriteNs : nullptr);
+        traceFlush(true);
+        for (Collector* c : mRunning)
+        {
+            if (!c->customResults().empty()) mTrace->writeJSON(c->name(), c->customResults());
+        }
+        if (mScheduled) mTrace->writeJSON("scheduler", mScheduler.results());
+        if (mConfig.isMember("provenance")) mTrace->writeJSON("provenance", mConfig["provenance"]);
+        mTrace->close();
+    }
+
     running = false;
 }
 
@@ -451,25 +1080,127 @@ void Collection::collect(std::vector<int64_t> custom)
     const int64_t now = getTime();
     mTiming.push_back(now - mPreviousTime);
     mPreviousTime = now;
+    mReaders.clear();
     for (Collector* c : mRunning)
     {
-        if (!c->isThreaded())
+        SysReader* r = c->isThreaded() ? nullptr : c->reader();
+        if (r) mReaders.push_back(r);
+    }
+    {
+        ScopedTimer timer(mMeasureOverhead ? &mFileReadNs : nullptr);
+        mBatch.read(mReaders);
+    }
+    for (Collector* c : mRunning)
+    {
+        if (!c->isThreaded() && mMeasureOverhead)
+        {
+            const int64_t before = getTimeNs();
+            c->collect( now );
+            c->overhead().collect.add(getTimeNs() - before);
+        }
+        else if (!c->isThreaded())
         {
             c->collect( now );
         }
     }
+    mBatch.finish();
     assert(custom.size() == mCustomHeaders.size());
     for (unsigned i = 0; i < mCustomHeaders.size(); i++)
     {
         mCustom[i].push_back(custom[i]);
     }
+    if (mTrace && mTrace->isOpen() && mTiming.size() % mTraceFlushFrames == 0)
+    {
+        ScopedTimer timer(mMeasureOverhead ? &mTraceWriteNs : nullptr);
+        traceFlush(false);
+    }
+}
+
+Collection::TracedMetric& Collection::traced(const void* key, const std::string& collector, const std::string& name,
+                                             CollectorValueList::vtype type, const TracedMetric* times)
+{
+    auto it = mTraced.find(key);
+    if (it == mTraced.end())
+    {
+        TracedMetric m = { times ? mTrace->defineSampledMetric(collector, name, type, times->id) : mTrace->defineMetric(collector, name, type), 0, times != nullptr };
+        it = mTraced.insert(std::make_pair(key, m)).first;
+    }
+    return it->second;
+}
+
+void Collection::traceSamples(Collector* c)
+{
+    std::lock_guard<std::mutex> lock(c->sampleMutex());
+    const CollectorColumn<int64_t>& sampleTimes = c->sampleTimes();
+    TracedMetric& times = traced(&sampleTimes, "sample_times", c->name(), CollectorValueList::TYPE_I64);
+    if (sampleTimes.size() > times.written)
+    {
+        mTrace->writeChunk(times.id, sampleTimes, times.written, sampleTimes.size(), mStartTime);
+        times.written = sampleTimes.size();
+    }
+    for (const auto& pair : c->results())
+    {
+        const CollectorValueList& list = pair.second;
+        if (list.type == CollectorValueList::TYPE_UNASSIGNED || list.online) continue;
+        TracedMetric& m = traced(&list, c->name(), pair.first, list.type, &times);
+        if (list.size() > m.written)
+        {
+            mTrace->writeChunk(m.id, list, m.written, list.size());
+            m.written = list.size();
+        }
+    }
+}
+
+void Collection::traceFlush(bool final)
+{
+    for (Collector* c : mRunning)
+    {
+        if (c->isThreaded() && !final)
+        {
+            traceSamples(c);
+            continue;
+        }
+        for (const auto& pair : c->results())
+        {
+            const CollectorValueList& list = pair.second;
+            if (list.type == CollectorValueList::TYPE_UNASSIGNED || list.online) continue;
+            TracedMetric& m = traced(&list, c->name(), pair.first, list.type);
+            if (!m.sampled && list.size() > m.written)
+            {
+                mTrace->writeChunk(m.id, list, m.written, list.size());
+                m.written = list.size();
+            }
+        }
+    }
+    TracedMetric& timing = traced(&mTiming, "timing", "time", CollectorValueList::TYPE_I64);
+    if (mTiming.size() > timing.written)
+    {
+        mTrace->writeChunk(timing.id, mTiming, timing.written, mTiming.size());
+        timing.written = mTiming.size();
+    }
+    for (unsigned i = 0; i < mCustomHeaders.size(); i++)
+    {
+        TracedMetric& m = traced(&mCustom[i], "custom", mCustomHeaders[i], CollectorValueList::TYPE_I64);
+        if (mCustom[i].size() > m.written)
+        {
+            mTrace->writeChunk(m.id, mCustom[i], m.written, mCustom[i].size());
+            m.written = mCustom[i].size();
+        }
+    }
+    mTrace->commit();
 }
 
 void Collection::collect_scope_start(uint16_t label, int32_t flags, int tid) {
     // Not getting the current time as it introduces huge kernel cycle overhead to the perf collector.
     for (Collector* c : mRunning)
     {
-        if (!c->isThreaded())
+        if (!c->isThreaded() && mMeasureOverhead)
+        {
+            const int64_t before = getTimeNs();
+            c->collect_scope_start(label, flags, tid);
+            c->overhead().scope.add(getTimeNs() - before);
+        }
+        else if (!c->isThreaded())
         {
             c->collect_scope_start(label, flags, tid);
         }
@@ -482,40 +1213,68 @@ void Collection::collect_scope_stop(uint16_t label, int32_t flags, int tid) {
     // mTiming.push_back(now - mScopeStartTime);
     for (Collector* c : mRunning)
     {
-        if (!c->isThreaded())
+        if (!c->isThreaded() && mMeasureOverhead)
+        {
+            const int64_t before = getTimeNs();
+            c->collect_scope_stop(label, flags, tid);
+            c->overhead().scope.add(getTimeNs() - before);
+        }
+        else if (!c->isThreaded())
         {
             c->collect_scope_stop(label, flags, tid);
         }
     }
 }
 
-Json::Value Collection::results()
+Json::Value Collection::collectorResults(Collector* c)
 {
-    Json::Value results;
-    for (Collector* c : mRunning)
+    ScopedTimer timer(mMeasureOverhead ? &c->overhead().writeNs : nullptr);
+    Json::Value v = c->customResults();
+    if (!v.empty()) // overrides sampling data, if exists
     {
-        Json::Value v = c->customResults();
-        if (!v.empty()) // overrides sampling data, if exists
+        return v;
+    }
+    for (const auto& pair : c->results())
+    {
+        if (pair.second.type == CollectorValueList::TYPE_UNASSIGNED) continue;
+        if (c->isSummarized()) v["summarized"] = true;
+        Json::Value& list = v[pair.first] = Json::arrayValue;
+        switch (pair.second.type)
         {
-            results[c->name()] = v;
-            continue;
+        case CollectorValueList::TYPE_FP64: pair.second.for_each([&list](CollectorValue cv) { list.append(cv.fp64); }); break;
+        case CollectorValueList::TYPE_U64: pair.second.for_each([&list](CollectorValue cv) { list.append(static_cast<Json::UInt64>(cv.u64)); }); break;
+        case CollectorValueList::TYPE_I64: pair.second.for_each([&list](CollectorValue cv) { list.append(static_cast<Json::Int64>(cv.i64)); }); break;
+        case CollectorValueList::TYPE_UNASSIGNED: assert(false); break;
         }
-        for (const auto& pair : c->results())
+        if (pair.second.online) // one entry per summarized loop, or one for the whole run
         {
-            if (c->isSummarized()) v["summarized"] = true;
-            v[pair.first] = Json::arrayValue;
-            for (const CollectorValue& cv : pair.second.data())
-            {
-                switch (pair.second.type)
-                {
-                case CollectorValueList::TYPE_FP64: v[pair.first].append(cv.fp64); break;
-                case CollectorValueList::TYPE_U64: v[pair.first].append(static_cast<Json::UInt64>(cv.u64)); break;
-                case CollectorValueList::TYPE_I64: v[pair.first].append(static_cast<Json::Int64>(cv.i64)); break;
-                case CollectorValueList::TYPE_UNASSIGNED: assert(false); break;
-                }
-            }
+            Json::Value& stats = v["stats"][pair.first];
+            for (const CollectorStatsSummary& s : pair.second.statSummaries) appendStats(stats, s);
+            if (pair.second.statSummaries.empty()) appendStats(stats, pair.second.stats.summary());
+        }
+    }
+    return v;
+}
+
+bool Collection::results(const std::string& name, Json::Value& out)
+{
+    for (Collector* c : mRunning)
+    {
+        if (c->name() == name)
+        {
+            out = collectorResults(c);
+            return true;
         }
-        results[c->name()] = v;
+    }
+    return false;
+}
+
+Json::Value Collection::results()
+{
+    Json::Value results;
+    for (Collector* c : mRunning)
+    {
+        results[c->name()] = collectorResults(c);
     }
     Json::Value v;
     v["time"] = Json::arrayValue;
@@ -531,6 +1290,7 @@ Json::Value Collection::results()
 
         double timeInSeconds = (double)sum / 1000000.0;
         results["timing"]["samples_per_second"] = (double)mTimingSummarized.size() / timeInSeconds;
+        for (const CollectorStatsSummary& s : mTimingStats) appendStats(results["timing"]["stats"], s);
     }
     else
     {
@@ -560,61 +1320,76 @@ Json::Value Collection::results()
             results["custom"][mCustomHeaders[i]].append(static_cast<Json::Value::Int64>(t));
         }
     }
+    if (mScheduled)
+    {
+        results["scheduler"] = mScheduler.results();
+    }
     if (mConfig.isMember("provenance")) // pass provenance through from config to results
     {
         results["provenance"] = mConfig["provenance"];
     }
+    if (mMeasureOverhead)
+    {
+        results["libcollector_overhead"] = overheadResults();
+    }
     return results;
 }
 
 bool Collection::writeCSV_MTV(const std::string& filename)
 {
-    FILE *fp = fopen(filename.c_str(), "w");
-    if (!fp)
+    ScopedTimer timer(mMeasureOverhead ? &mCsvWriteNs : nullptr);
+    OutputBuffer out;
+    if (!out.open(filename))
     {
-        fprintf(stderr, "FAILED to open %s: %s\n", filename.c_str(), strerror(errno));
         return false;
     }
+    std::vector<std::pair<const std::string*, const CollectorValueResults::value_type*>> metrics;
     for (Collector* c : mRunning)
     {
         for (const auto& pair : c->results())
         {
-            fprintf(fp, "%s, %s", c->name().c_str(), pair.first.c_str());
-            for (const CollectorValue& value : pair.second.data())
-            {
-                switch (pair.second.type)
-                {
-                case CollectorValueList::TYPE_FP64: fprintf(fp, ", %f", value.fp64); break;
-                case CollectorValueList::TYPE_I64: fprintf(fp, ", %lld", (long long)value.i64); break;
-                case CollectorValueList::TYPE_U64: fprintf(fp, ", %llu", (unsigned long long)value.u64); break;
-                case CollectorValueList::TYPE_UNASSIGNED: assert(false); break;
-                }
-            }
-            fprintf(fp, "\n");
+            if (pair.second.type == CollectorValueList::TYPE_UNASSIGNED) continue;
+            metrics.push_back(std::make_pair(&c->name(), &pair));
         }
     }
-    fprintf(fp, "frametime, time");
+    // One line per metric, so format one metric per block
+    writeCsvRows(out, metrics.size(), [&metrics](CsvLine& line, size_t row)
+    {
+        const CollectorValueList& list = metrics[row].second->second;
+        line.field(*metrics[row].first);
+        line.field(metrics[row].second->first);
+        list.for_each([&line, &list](CollectorValue value) { line.field(list.type, value); });
+    }, ", ", false, csvThreads(), 1);
+    std::string text;
+    CsvLine line(text);
+    line.field(std::string("frametime"));
+    line.field(std::string("time"));
     for (int64_t t : mTiming)
     {
-        fprintf(fp, ", %lld", (long long)t);
+        line.field(t);
     }
     for (unsigned i = 0; i < mCustomHeaders.size(); i++)
     {
-        fprintf(fp, "\ncustom, %s", mCustomHeaders[i].c_str());
+        line.end();
+        line.field(std::string("custom"));
+        line.field(mCustomHeaders[i]);
         for (int64_t t : mCustom[i])
         {
-            fprintf(fp, ", %lld", (long long)t);
+            line.field(t);
         }
     }
-    return (fclose(fp) == 0);
+    out.write(text);
+    return out.close();
 }
 
 void Collection::summarize()
 {
     for (auto c : mCollectors) c->summarize();
     int64_t sum = 0;
-    for (auto c : mTiming) sum += c;
+    CollectorStats stats;
+    for (auto c : mTiming) { sum += c; stats.add(c); }
     mTimingSummarized.push_back(sum / (int64_t)mTiming.size());
+    mTimingStats.push_back(stats.summary());
     mTiming.clear();
     for (unsigned i = 0; i < mCustom.size(); i++)
     {
@@ -627,63 +1402,255 @@ void Collection::summarize()
 
 bool Collection::writeCSV(const std::string& filename)
 {
-    FILE *fp = fopen(filename.c_str(), "w");
-    if (!fp)
+    ScopedTimer timer(mMeasureOverhead ? &mCsvWriteNs : nullptr);
+    OutputBuffer out;
+    if (!out.open(filename))
     {
-        fprintf(stderr, "FAILED to open %s: %s\n", filename.c_str(), strerror(errno));
         return false;
     }
-    int rows = 0;
-    fprintf(fp, "frametime");
+    std::vector<const CollectorValueList*> lists;
+    std::string header;
+    CsvLine line(header);
+    line.field(std::string("frametime"));
     for (unsigned field = 0; field < mCustomHeaders.size(); field++)
     {
-        fprintf(fp, ", %s", mCustomHeaders[field].c_str());
+        line.field(mCustomHeaders[field]);
     }
     for (Collector* c : mRunning)
     {
         for (const auto& pair : c->results())
         {
-            fprintf(fp, ", %s:%s", c->name().c_str(), pair.first.c_str());
-            if (pair.second.size() > 0)
-            {
-                rows = pair.second.size();
-            }
+            if (pair.second.type == CollectorValueList::TYPE_UNASSIGNED || pair.second.online) continue;
+            line.field(c->name() + ":" + pair.first);
+            lists.push_back(&pair.second);
         }
     }
-    fprintf(fp, "\n");
-    for (int i = 0; i < rows; i++)
+    line.end();
+    out.write(header);
+    writeCsvRows(out, mTiming.size(), [this, &lists](CsvLine& line, size_t i)
     {
-        fprintf(fp, "%lld", (long long)mTiming[i]);
+        line.field(mTiming[i]);
         for (unsigned field = 0; field < mCustomHeaders.size(); field++)
         {
-            fprintf(fp, ", %lld", (long long)mCustom[field][i]);
+            line.field(mCustom[field][i]);
         }
-        for (Collector* c : mRunning)
+        for (const CollectorValueList* list : lists)
         {
-            for (const auto& pair : c->results())
-            {
-                const CollectorValue& value = pair.second.at(i);
-                switch (pair.second.type)
-                {
-                case CollectorValueList::TYPE_FP64: fprintf(fp, ", %f", value.fp64); break;
-                case CollectorValueList::TYPE_I64: fprintf(fp, ", %lld", (long long)value.i64); break;
-                case CollectorValueList::TYPE_U64: fprintf(fp, ", %llu", (unsigned long long)value.u64); break;
-                case CollectorValueList::TYPE_UNASSIGNED: assert(false); break;
-                }
-            }
+            if (i < list->size()) line.field(list->type, list->at(i));
+            else line.field(std::string()); // a collector that missed samples, keep later columns aligned
         }
-        fprintf(fp, "\n");
-    }
-    return (fclose(fp) == 0);
+    }, ", ", false, csvThreads());
+    return out.close();
 }
 
+unsigned Collection::csvThreads() const
+{
+    // Spilled value lists read back through a cache that is not thread safe
+    return mSpill.isOpen() ? 1 : std::max(1u, mConfig.get("csv_threads", 1).asUInt());
+}
+
+
+// Call latencies in microseconds
+static Json::Value latencyStats(const CollectorStats& stats)
+{
+    const CollectorStatsSummary s = stats.summary();
+    Json::Value v;
+    v["count"] = static_cast<Json::UInt64>(s.count);
+    v["mean"] = s.mean / 1000.0;
+    v["stddev"] = s.stddev / 1000.0;
+    v["min"] = s.min / 1000.0;
+    v["max"] = s.max / 1000.0;
+    v["p50"] = s.p50 / 1000.0;
+    v["p90"] = s.p90 / 1000.0;
+    v["p99"] = s.p99 / 1000.0;
+    return v;
+}
+
+Json::Value Collection::overheadResults() const
+{
+    Json::Value v;
+    size_t heap = (mTiming.capacity() + mTimingSummarized.capacity()) * sizeof(int64_t);
+    for (unsigned i = 0; i < mCustom.size(); i++)
+    {
+        heap += (mCustom[i].capacity() + mCustomSummarized[i].capacity()) * sizeof(int64_t);
+    }
+    v["collectors"] = Json::objectValue;
+    for (Collector* c : mRunning)
+    {
+        const CollectorOverhead& o = c->overhead();
+        Json::Value& cv = v["collectors"][c->name()];
+        cv["collect_calls"] = static_cast<Json::UInt64>(o.collect.count());
+        cv["collect_total_us"] = o.collect.mean() * o.collect.count() / 1000.0;
+        cv["collect_latency_us"] = latencyStats(o.collect);
+        if (o.scope.count() > 0)
+        {
+            cv["scope_calls"] = static_cast<Json::UInt64>(o.scope.count());
+            cv["scope_total_us"] = o.scope.mean() * o.scope.count() / 1000.0;
+            cv["scope_latency_us"] = latencyStats(o.scope);
+        }
+        cv["postprocess_us"] = (double)o.postprocessNs / 1000.0;
+        cv["write_us"] = (double)o.writeNs / 1000.0;
+        if (c->isThreaded() && !mScheduled) cv["thread_cpu_us"] = (double)o.threadCpuNs / 1000.0;
+        cv["heap_bytes"] = static_cast<Json::UInt64>(c->memoryUsed());
+        heap += c->memoryUsed();
+    }
+    if (mScheduled)
+    {
+        v["scheduler_thread_cpu_us"] = (double)mScheduler.cpuTimeNs() / 1000.0;
+        v["scheduler_file_read_us"] = (double)mScheduler.readTimeNs() / 1000.0;
+    }
+    v["file_read_us"] = (double)mFileReadNs / 1000.0;
+    v["csv_write_us"] = (double)mCsvWriteNs / 1000.0;
+    if (mTrace) v["trace_write_us"] = (double)mTraceWriteNs / 1000.0;
+    v["heap_bytes"] = static_cast<Json::UInt64>(heap);
+    return v;
+}
 
 bool Collection::writeJSON(const std::string& filename)
 {
-    FILE *fp = fopen(filename.c_str(), "w");
-    Json::StyledWriter writer;
-    Json::Value result_json = results();
-    fprintf(fp, "%s", writer.write(result_json).c_str());
+    OutputBuffer out;
+    if (!out.open(filename))
+    {
+        return false;
+    }
+    JsonStream json(out);
+    writeJSON(json);
+    return out.close();
+}
+
+static void streamValues(JsonStream& json, const CollectorValueList& list)
+{
+    json.beginArray();
+    switch (list.type)
+    {
+    case CollectorValueList::TYPE_FP64: list.for_each([&json](CollectorValue cv) { json.value(cv.fp64); }); break;
+    case CollectorValueList::TYPE_U64: list.for_each([&json](CollectorValue cv) { json.value(cv.u64); }); break;
+    case CollectorValueList::TYPE_I64: list.for_each([&json](CollectorValue cv) { json.value(cv.i64); }); break;
+    case CollectorValueList::TYPE_UNASSIGNED: assert(false); break;
+    }
+    json.endArray();
+}
+
+static void streamStats(JsonStream& json, const std::vector<CollectorStatsSummary>& stats)
+{
+    json.beginObject();
+    json.key("count"); json.beginArray(); for (const auto& s : stats) json.value(s.count); json.endArray();
+    json.key("max"); json.beginArray(); for (const auto& s : stats) json.value(s.max); json.endArray();
+    json.key("mean"); json.beginArray(); for (const auto& s : stats) json.value(s.mean); json.endArray();
+    json.key("min"); json.beginArray(); for (const auto& s : stats) json.value(s.min); json.endArray();
+    json.key("p50"); json.beginArray(); for (const auto& s : stats) json.value(s.p50); json.endArray();
+    json.key("p90"); json.beginArray(); for (const auto& s : stats) json.value(s.p90); json.endArray();
+    json.key("p99"); json.beginArray(); for (const auto& s : stats) json.value(s.p99); json.endArray();
+    json.key("stddev"); json.beginArray(); for (const auto& s : stats) json.value(s.stddev); json.endArray();
+    json.endObject();
+}
+
+// Same layout as results(), but written out as we go
+void Collection::writeJSON(JsonStream& json)
+{
+    json.beginObject();
+    for (Collector* c : mRunning)
+    {
+        ScopedTimer timer(mMeasureOverhead ? &c->overhead().writeNs : nullptr);
+        json.key(c->name());
+        const Json::Value& custom = c->customResults();
+        if (!custom.empty()) // overrides sampling data, if exists
+        {
+            json.value(custom);
+            continue;
+        }
+        json.beginObject();
+        bool sampled = false;
+        bool online = false;
+        for (const auto& pair : c->results())
+        {
+            if (pair.second.type == CollectorValueList::TYPE_UNASSIGNED) continue;
+            json.key(pair.first);
+            streamValues(json, pair.second);
+            sampled = true;
+            online = online || pair.second.online;
+        }
+        if (online)
+        {
+            json.key("stats");
+            json.beginObject();
+            for (const auto& pair : c->results())
+            {
+                if (!pair.second.online || pair.second.type == CollectorValueList::TYPE_UNASSIGNED) continue;
+                json.key(pair.first);
+                if (pair.second.statSummaries.empty()) streamStats(json, { pair.second.stats.summary() });
+                else streamStats(json, pair.second.statSummaries);
+            }
+            json.endObject();
+        }
+        if (c->isSummarized() && sampled)
+        {
+            json.key("summarized");
+            json.value(true);
+        }
+        json.endObject();
+    }
+
+    const bool summarized = mTimingSummarized.size() > 0;
+    const std::vector<int64_t>& timing = summarized ? mTimingSummarized : mTiming;
+    int64_t sum = 0;
+    json.key("timing");
+    json.beginObject();
+    json.key("time");
+    json.beginArray();
+    for (int64_t t : timing)
+    {
+        json.value(t);
+        sum += t;
+    }
+    json.endArray();
+    double timeInSeconds = (double)sum / 1000000.0;
+    json.key("samples_per_second");
+    json.value((double)timing.size() / timeInSeconds);
+    if (summarized)
+    {
+        json.key("stats");
+        streamStats(json, mTimingStats);
+    }
+    json.endObject();
 
-    return (fclose(fp) == 0);
+    if (mCustomHeaders.size() > 0)
+    {
+        bool customSummarized = false;
+        json.key("custom");
+        json.beginObject();
+        for (unsigned i = 0; i < mCustomHeaders.size(); i++)
+        {
+            json.key(mCustomHeaders[i]);
+            json.beginArray();
+            customSummarized = customSummarized || mCustomSummarized[i].size() > 0;
+            for (int64_t t : mCustomSummarized[i].size() > 0 ? mCustomSummarized[i] : mCustom[i])
+            {
+                json.value(t);
+            }
+            json.endArray();
+        }
+        if (customSummarized)
+        {
+            json.key("summarized");
+            json.value(true);
+        }
+        json.endObject();
+    }
+    if (mScheduled)
+    {
+        json.key("scheduler");
+        json.value(mScheduler.results());
+    }
+    if (mConfig.isMember("provenance")) // pass provenance through from config to results
+    {
+        json.key("provenance");
+        json.value(mConfig["provenance"]);
+    }
+    if (mMeasureOverhead)
+    {
+        json.key("libcollector_overhead");
+        json.value(overheadResults());
+    }
+    json.endObject();
 }
@@ -4,17 +4,26 @@
 #include <vector>
 #include <cmath>
 #include <map>
+#include <algorithm>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <atomic>
 #include <thread>
 #include <pthread.h>
 #include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
 
 #include "json/value.h"
 #include "json/reader.h"
 #include "json/writer.h"
 
+#include "sysread.hpp"
+
 #ifndef DBG_LOG
 #ifdef ANDROID
 #include <android/log.h>
@@ -24,6 +33,14 @@
 #endif
 #endif
 
+/// Directory that sysfs and procfs paths are looked up under, so that collectors can read a
+/// recorded tree, or the host's /sys and /proc mounted elsewhere. Empty for the real root. Taken
+/// from the LIBCOLLECTOR_SYSROOT environment variable unless set with 'sysroot' in the config.
+const std::string& collectorSysroot();
+void setCollectorSysroot(const std::string& root);
+/// Look up an absolute sysfs or procfs path under the sysroot. Relative paths are left alone.
+std::string sysPath(const std::string& path);
+
 // Value
 union CollectorValue
 {
@@ -32,7 +49,186 @@ union CollectorValue
     int64_t i64;
 };
 
-// Value list
+// Background writer for sample chunks that do not need to stay in memory. Chunks are appended to a
+// spill file and read back on demand. Chunks waiting to be written are limited to a memory budget;
+// when the writer falls behind, adding another chunk waits for it to catch up. The budget does not
+// cover the chunk that each column keeps in memory while filling it.
+class CollectorSpill
+{
+public:
+    CollectorSpill() {}
+    ~CollectorSpill() { close(); }
+
+    /// Create the spill file and start the writer thread. The file is removed again right away, so
+    /// it does not outlive the process.
+    bool open(const std::string& filename, size_t budget);
+    void close();
+    bool isOpen() const { return mFD >= 0; }
+    /// Wait for queued chunks to be written, then empty the file. Offsets handed out before are no
+    /// longer valid.
+    void reset();
+
+    /// Hand over a chunk for writing. Returns the file offset it will be found at.
+    template<typename T> int64_t write(std::vector<T>&& chunk)
+    {
+        std::shared_ptr<std::vector<T>> owner = std::make_shared<std::vector<T>>(std::move(chunk));
+        return enqueue(owner->data(), owner->size() * sizeof(T), owner);
+    }
+
+    /// Read back part of the file, waiting for it to be written first if necessary
+    bool read(int64_t offset, void* dst, size_t bytes);
+
+private:
+    struct Block
+    {
+        int64_t offset;
+        const void* data;
+        size_t bytes;
+        std::shared_ptr<void> owner;
+    };
+
+    int64_t enqueue(const void* data, size_t bytes, std::shared_ptr<void> owner);
+    void loop();
+
+    int mFD = -1;
+    size_t mBudget = 0;
+    size_t mPending = 0; // bytes queued but not yet written
+    int64_t mEnd = 0; // end of the last queued block
+    int64_t mWrittenEnd = 0; // end of the last written block
+    bool mFinished = false;
+    std::deque<Block> mQueue;
+    std::mutex mMutex;
+    std::condition_variable mQueued;
+    std::condition_variable mWritten;
+    std::thread mThread;
+};
+
+// Append-only column of raw values. Values are stored in chunks of fixed size; only the first
+// chunk grows by reallocation, so long captures never copy what has already been stored. If a
+// spill is given, each chunk is handed to it as soon as it is full, so only one chunk per column
+// stays in memory; spilled chunks are read back through a one chunk cache.
+template<typename T>
+class CollectorColumn
+{
+public:
+    enum { CHUNK_SHIFT = 12, CHUNK_VALUES = 1 << CHUNK_SHIFT };
+
+    void push_back(T val, CollectorSpill* spill = nullptr)
+    {
+        if ((mSize & (CHUNK_VALUES - 1)) == 0)
+        {
+            mChunks.emplace_back();
+            if (mChunks.size() > 1) mChunks.back().reserve(CHUNK_VALUES);
+        }
+        mChunks.back().push_back(val);
+        mSize++;
+        if (spill && mChunks.back().size() == CHUNK_VALUES)
+        {
+            mSpill = spill;
+            mOffsets.resize(mChunks.size(), -1);
+            mOffsets.back() = spill->write(std::move(mChunks.back()));
+            mChunks.back() = std::vector<T>();
+        }
+    }
+    void clear() { mChunks.clear(); mOffsets.clear(); mCachedChunk = -1; mSize = 0; }
+    size_t size() const { return mSize; }
+    T at(size_t index) const { assert(index < mSize); return chunk(index >> CHUNK_SHIFT)[index & (CHUNK_VALUES - 1)]; }
+    template<typename F> void for_each(F f) const { for (size_t i = 0; i < mChunks.size(); i++) for (const T val : chunk(i)) f(val); }
+    /// Bytes of memory held, not counting chunks moved to the spill
+    size_t memoryUsed() const
+    {
+        size_t bytes = mChunks.capacity() * sizeof(mChunks[0]) + mOffsets.capacity() * sizeof(int64_t) + mCache.capacity() * sizeof(T);
+        for (const std::vector<T>& c : mChunks) bytes += c.capacity() * sizeof(T);
+        return bytes;
+    }
+
+private:
+    bool spilled(size_t i) const { return i < mOffsets.size() && mOffsets[i] >= 0; }
+    const std::vector<T>& chunk(size_t i) const
+    {
+        if (!spilled(i)) return mChunks[i];
+        if (mCachedChunk != (int64_t)i)
+        {
+            mCache.resize(CHUNK_VALUES);
+            if (!mSpill->read(mOffsets[i], mCache.data(), CHUNK_VALUES * sizeof(T)))
+            {
+                std::fill(mCache.begin(), mCache.end(), T());
+            }
+            mCachedChunk = i;
+        }
+        return mCache;
+    }
+
+    std::vector<std::vector<T>> mChunks;
+    std::vector<int64_t> mOffsets; // file offset of each spilled chunk, or -1 if in memory
+    CollectorSpill* mSpill = nullptr;
+    mutable std::vector<T> mCache;
+    mutable int64_t mCachedChunk = -1;
+    size_t mSize = 0;
+};
+
+/// Statistics of one summarized loop
+struct CollectorStatsSummary
+{
+    uint64_t count;
+    double mean;
+    double stddev;
+    double min;
+    double max;
+    double p50;
+    double p90;
+    double p99;
+};
+
+// Running statistics in constant memory. Mean and variance use Welford's method. Quantiles come
+// from a histogram with logarithmically sized buckets, so they are accurate to within one percent
+// of the value, and the number of buckets only depends on the range of the values seen.
+class CollectorStats
+{
+public:
+    void add(double val)
+    {
+        mCount++;
+        const double delta = val - mMean;
+        mMean += delta / mCount;
+        mM2 += delta * (val - mMean);
+        if (mCount == 1 || val < mMin) mMin = val;
+        if (mCount == 1 || val > mMax) mMax = val;
+        if (val > 0.0) mPositive[bucket(val)]++;
+        else if (val < 0.0) mNegative[bucket(-val)]++;
+        else mZero++;
+    }
+    void clear() { *this = CollectorStats(); }
+    uint64_t count() const { return mCount; }
+    double mean() const { return mMean; }
+    double stddev() const { return mCount > 1 ? sqrt(mM2 / (mCount - 1)) : 0.0; }
+    double min() const { return mMin; }
+    double max() const { return mMax; }
+    /// Approximate value below which the given fraction (0 to 1) of values lie
+    double quantile(double q) const;
+    CollectorStatsSummary summary() const;
+    /// Approximate bytes of memory held by the histogram
+    size_t memoryUsed() const { return (mPositive.size() + mNegative.size()) * 48; }
+
+private:
+    static int bucket(double val) { return (int)ceil(log(val) / log(GAMMA)); }
+    static double bucketValue(int index) { return 2.0 * pow(GAMMA, index) / (GAMMA + 1.0); }
+    static constexpr double GAMMA = 1.01 / 0.99;
+
+    uint64_t mCount = 0;
+    double mMean = 0.0;
+    double mM2 = 0.0;
+    double mMin = 0.0;
+    double mMax = 0.0;
+    std::map<int, uint64_t> mPositive;
+    std::map<int, uint64_t> mNegative; // by magnitude
+    uint64_t mZero = 0;
+};
+
+// Value list. Samples are kept in a typed column, 64 bits wide unless the collector has declared
+// that its values fit in 32 bits by setting 'compact' before the first sample. If 'online' is set
+// before the first sample, no samples are kept at all, only running statistics. If 'spill' is set,
+// full chunks of samples are moved out of memory into it.
 struct CollectorValueList
 {
     enum vtype
@@ -43,43 +239,154 @@ struct CollectorValueList
         TYPE_UNASSIGNED
     };
     enum vtype type = TYPE_UNASSIGNED;
-    std::vector<CollectorValue> list;
+    /// Store samples in 32 bits. Floating point samples are then stored in single precision.
+    bool compact = false;
+    /// Keep running statistics instead of samples, so memory use does not grow with run length.
+    bool online = false;
     std::vector<CollectorValue> summaries;
-
-    void push_back(double val) { assert(type == TYPE_UNASSIGNED || type == TYPE_FP64); type = TYPE_FP64; CollectorValue fp64; fp64.fp64 = val; list.push_back(fp64); }
-    void push_back(float val) { assert(type == TYPE_UNASSIGNED || type == TYPE_FP64); type = TYPE_FP64; CollectorValue fp64; fp64.fp64 = val; list.push_back(fp64); }
-    void push_back(int val) { assert(type == TYPE_UNASSIGNED || type == TYPE_I64); type = TYPE_I64; CollectorValue i64; i64.i64 = val; list.push_back(i64); }
-    void push_back(long val) { assert(type == TYPE_UNASSIGNED || type == TYPE_I64); type = TYPE_I64; CollectorValue i64; i64.i64 = val; list.push_back(i64); }
-    void push_back(long long val) { assert(type == TYPE_UNASSIGNED || type == TYPE_I64); type = TYPE_I64; CollectorValue i64; i64.i64 = val; list.push_back(i64); }
-    void push_back(unsigned int val) { assert(type == TYPE_UNASSIGNED || type == TYPE_U64); type = TYPE_U64; CollectorValue u64; u64.u64 = val; list.push_back(u64); }
-    void push_back(unsigned long val) { assert(type == TYPE_UNASSIGNED || type == TYPE_U64); type = TYPE_U64; CollectorValue u64; u64.u64 = val; list.push_back(u64); }
-    void push_back(CollectorValue val) { assert(type != TYPE_UNASSIGNED); list.push_back(val); }
+    /// Statistics for each summarized loop, in online mode
+    std::vector<CollectorStatsSummary> statSummaries;
+    /// Statistics of the samples added since the last summarize, in online mode
+    CollectorStats stats;
+    /// Where to move full chunks of samples, if anywhere
+    CollectorSpill* spill = nullptr;
+
+    void push_back(double val) { assert(type == TYPE_UNASSIGNED || type == TYPE_FP64); type = TYPE_FP64; CollectorValue fp64; fp64.fp64 = val; append(fp64); }
+    void push_back(float val) { assert(type == TYPE_UNASSIGNED || type == TYPE_FP64); type = TYPE_FP64; CollectorValue fp64; fp64.fp64 = val; append(fp64); }
+    void push_back(int val) { assert(type == TYPE_UNASSIGNED || type == TYPE_I64); type = TYPE_I64; CollectorValue i64; i64.i64 = val; append(i64); }
+    void push_back(long val) { assert(type == TYPE_UNASSIGNED || type == TYPE_I64); type = TYPE_I64; CollectorValue i64; i64.i64 = val; append(i64); }
+    void push_back(long long val) { assert(type == TYPE_UNASSIGNED || type == TYPE_I64); type = TYPE_I64; CollectorValue i64; i64.i64 = val; append(i64); }
+    void push_back(unsigned int val) { assert(type == TYPE_UNASSIGNED || type == TYPE_U64); type = TYPE_U64; CollectorValue u64; u64.u64 = val; append(u64); }
+    void push_back(unsigned long val) { assert(type == TYPE_UNASSIGNED || type == TYPE_U64); type = TYPE_U64; CollectorValue u64; u64.u64 = val; append(u64); }
+    void push_back(CollectorValue val) { assert(type != TYPE_UNASSIGNED); append(val); }
 
     void summarize()
     {
+        if (online)
+        {
+            CollectorValue c;
+            switch (type)
+            {
+            case TYPE_FP64: c.fp64 = stats.mean(); break;
+            case TYPE_I64: c.i64 = (int64_t)stats.mean(); break;
+            case TYPE_U64: c.u64 = (uint64_t)stats.mean(); break;
+            case TYPE_UNASSIGNED: assert(false); break;
+            }
+            summaries.push_back(c);
+            statSummaries.push_back(stats.summary());
+            stats.clear();
+            return;
+        }
+        const double count = size();
         switch (type)
         {
-        case TYPE_FP64: { double s = 0.0; for (const auto v : list) s += v.fp64; CollectorValue c; c.fp64 = s / (double)list.size(); summaries.push_back(c); list.clear(); } break;
-        case TYPE_I64: { int64_t s = 0; for (const auto v : list) s += v.i64; CollectorValue c; c.i64 = s / (int64_t)list.size(); summaries.push_back(c); list.clear(); } break;
-        case TYPE_U64: { uint64_t s = 0; for (const auto v : list) s += v.u64; CollectorValue c; c.u64 = s / (uint64_t)list.size(); summaries.push_back(c); list.clear(); } break;
+        case TYPE_FP64: { double s = 0.0; for_each_sample([&s](CollectorValue v) { s += v.fp64; }); CollectorValue c; c.fp64 = s / count; summaries.push_back(c); clear(); } break;
+        case TYPE_I64: { int64_t s = 0; for_each_sample([&s](CollectorValue v) { s += v.i64; }); CollectorValue c; c.i64 = s / (int64_t)count; summaries.push_back(c); clear(); } break;
+        case TYPE_U64: { uint64_t s = 0; for_each_sample([&s](CollectorValue v) { s += v.u64; }); CollectorValue c; c.u64 = s / (uint64_t)count; summaries.push_back(c); clear(); } break;
         case TYPE_UNASSIGNED: assert(false); break;
         }
     }
-    void clear() { list.clear(); }
-    size_t size() const { return list.size(); }
-    CollectorValue at(int index) const { return list.at(index); }
-    const std::vector<CollectorValue>& data() const { if (summaries.size() > 0) return summaries; else return list; }
+    void clear() { mWide.clear(); mNarrow.clear(); stats.clear(); }
+    size_t memoryUsed() const
+    {
+        return mWide.memoryUsed() + mNarrow.memoryUsed() + stats.memoryUsed() + summaries.capacity() * sizeof(CollectorValue)
+            + statSummaries.capacity() * sizeof(CollectorStatsSummary);
+    }
+    size_t size() const { return compact ? mNarrow.size() : mWide.size(); }
+    CollectorValue at(size_t index) const { return compact ? expand(mNarrow.at(index)) : wide(mWide.at(index)); }
+    CollectorValue back() const { return at(size() - 1); }
+
+    /// Visit every sample in order.
+    template<typename F> void for_each_sample(F f) const
+    {
+        if (compact) mNarrow.for_each([this, &f](uint32_t raw) { f(expand(raw)); });
+        else mWide.for_each([&f](uint64_t raw) { f(wide(raw)); });
+    }
+
+    /// Visit the values to report in order; these are the summaries if we have been summarized.
+    template<typename F> void for_each(F f) const
+    {
+        if (summaries.size() > 0) for (const CollectorValue& v : summaries) f(v);
+        else for_each_sample(f);
+    }
+
+private:
+    void append(CollectorValue val)
+    {
+        if (online)
+        {
+            switch (type)
+            {
+            case TYPE_FP64: stats.add(val.fp64); break;
+            case TYPE_I64: stats.add(val.i64); break;
+            case TYPE_U64: stats.add(val.u64); break;
+            case TYPE_UNASSIGNED: assert(false); break;
+            }
+            return;
+        }
+        if (!compact)
+        {
+            mWide.push_back(val.u64, spill);
+            return;
+        }
+        uint32_t raw = 0;
+        switch (type)
+        {
+        case TYPE_FP64: { const float f = val.fp64; memcpy(&raw, &f, sizeof(raw)); } break;
+        case TYPE_I64: raw = static_cast<uint32_t>(static_cast<int32_t>(val.i64)); break;
+        case TYPE_U64: raw = static_cast<uint32_t>(val.u64); break;
+        case TYPE_UNASSIGNED: assert(false); break;
+        }
+        mNarrow.push_back(raw, spill);
+    }
+    CollectorValue expand(uint32_t raw) const
+    {
+        CollectorValue v;
+        v.u64 = raw;
+        switch (type)
+        {
+        case TYPE_FP64: { float f; memcpy(&f, &raw, sizeof(f)); v.fp64 = f; } break;
+        case TYPE_I64: v.i64 = static_cast<int32_t>(raw); break;
+        case TYPE_U64: case TYPE_UNASSIGNED: break;
+        }
+        return v;
+    }
+    static CollectorValue wide(uint64_t raw) { CollectorValue v; v.u64 = raw; return v; }
+
+    CollectorColumn<uint64_t> mWide;
+    CollectorColumn<uint32_t> mNarrow;
 };
 
 typedef std::map<std::string, CollectorValueList> CollectorValueResults;
 
+/// Map samples taken from a sampling thread at the given times onto frames of the given lengths,
+/// the first of which starts at 'start'. Each frame gets the time-weighted average of its samples.
+void resampleTimed(const CollectorValueList& in, const CollectorColumn<int64_t>& times, int64_t start,
+                   const std::vector<int64_t>& timing, CollectorValueList& out);
+/// Map samples onto frames of the given lengths, assuming that they were taken at a uniform rate
+void resampleUniform(const CollectorValueList& in, const std::vector<int64_t>& timing, CollectorValueList& out);
+
+// Cost of running one collector, to show how much measuring disturbs the workload. Calls are
+// timed one by one, so the statistics give their latency distribution as well as the total.
+struct CollectorOverhead
+{
+    CollectorStats collect; // nanoseconds per collect() call
+    CollectorStats scope; // nanoseconds per collect_scope_start() or collect_scope_stop() call
+    int64_t postprocessNs = 0;
+    int64_t writeNs = 0; // turning results into JSON
+    int64_t threadCpuNs = 0; // CPU time used by the collector's own sampling thread
+};
+
+/// Stable index of a metric registered with Collector::registerMetric()
+typedef int MetricHandle;
+
 // General collector class
 class Collector
 {
 public:
     Collector(const Json::Value& config, const std::string& name)
         : finished(false), mSampleRate(100), mCollecting(false), mConfig(config.get(name, Json::Value()))
-        , mName(name), mFactor(NAN) {}
+        , mName(name), mFactor(NAN) { mOnlineStats = mConfig.get("online_stats", false).asBool(); }
     virtual ~Collector() {}
 
     virtual bool init() { return true; }
@@ -94,19 +401,31 @@ public:
     virtual bool collecting() const { return mCollecting; }
     virtual const std::string& name() const { return mName; }
     virtual bool available() = 0;
+    /// Files read by every collect(), if any, so that those of all collectors due at the same time
+    /// can be read together before collecting
+    virtual SysReader* reader() { return nullptr; }
 
     virtual const CollectorValueResults& results() const final { return mResults; }
     virtual const Json::Value customResults() const final { return mCustomResult; }
     virtual void doubleTransform(double factor) final { mFactor = factor; }
     virtual void useThreading(int sampleRate) final;
     virtual bool isThreaded() const final { return mIsThreaded; }
+    virtual int sampleRate() const final { return mSampleRate; }
     virtual bool isSummarized() const final { return mIsSummarized; }
+    /// Time at which the current capture started, used to place threaded samples in frames.
+    virtual void setStartTime(int64_t start) final { mStartTime = start; }
+    /// Move full chunks of samples into the given spill instead of keeping them in memory.
+    virtual void setSpill(CollectorSpill* spill) final
+    {
+        mSpill = spill;
+        for (auto& pair : mResults) pair.second.spill = spill;
+    }
 
     virtual void summarize()
     {
         for (auto& pair : mResults)
         {
-            pair.second.summarize();
+            if (pair.second.type != CollectorValueList::TYPE_UNASSIGNED) pair.second.summarize();
         }
         mIsSummarized = true;
     }
@@ -118,19 +437,50 @@ public:
         {
             pair.second.clear();
         }
+        mSampleTimes.clear();
     }
 
-    virtual void add(const std::string& key, double value) final { mResults[key].push_back(value); }
-    virtual void add(const std::string& key, float value) final { mResults[key].push_back(value); }
-    virtual void add(const std::string& key, int value) final { mResults[key].push_back(value); }
-    virtual void add(const std::string& key, long value) final { mResults[key].push_back(value); }
-    virtual void add(const std::string& key, long long value) final { mResults[key].push_back(value); }
-    virtual void add(const std::string& key, unsigned value) final { mResults[key].push_back(value); }
-    virtual void add(const std::string& key, unsigned long value) final { mResults[key].push_back(value); }
+    virtual void add(const std::string& key, double value) final { result(key).push_back(value); }
+    virtual void add(const std::string& key, float value) final { result(key).push_back(value); }
+    virtual void add(const std::string& key, int value) final { result(key).push_back(value); }
+    virtual void add(const std::string& key, long value) final { result(key).push_back(value); }
+    virtual void add(const std::string& key, long long value) final { result(key).push_back(value); }
+    virtual void add(const std::string& key, unsigned value) final { result(key).push_back(value); }
+    virtual void add(const std::string& key, unsigned long value) final { result(key).push_back(value); }
+
+    /// Register a named metric and return a stable handle for the add() fast path below. Call this
+    /// from init(). Registering the same key again returns the same handle. Registered metrics that
+    /// never receive a value are not reported. Set compact if all values are known to fit in 32 bits.
+    virtual MetricHandle registerMetric(const std::string& key, bool compact = false) final;
+
+    virtual void add(MetricHandle handle, double value) final { mMetrics[handle]->push_back(value); }
+    virtual void add(MetricHandle handle, float value) final { mMetrics[handle]->push_back(value); }
+    virtual void add(MetricHandle handle, int value) final { mMetrics[handle]->push_back(value); }
+    virtual void add(MetricHandle handle, long value) final { mMetrics[handle]->push_back(value); }
+    virtual void add(MetricHandle handle, long long value) final { mMetrics[handle]->push_back(value); }
+    virtual void add(MetricHandle handle, unsigned value) final { mMetrics[handle]->push_back(value); }
+    virtual void add(MetricHandle handle, unsigned long value) final { mMetrics[handle]->push_back(value); }
 
     /// For multi-threaded operation, this loop is called instead of owning class calling collect() directly.
     virtual void loop() final;
 
+    /// Collect one sample from a sampling thread and remember when it was taken.
+    virtual void sample(int64_t now) final;
+
+    /// Held while a sample is taken, so that the samples of a threaded collector can be read while
+    /// it is running.
+    virtual std::mutex& sampleMutex() final { return mSampleMutex; }
+    /// Time of each sample taken from a sampling thread
+    virtual const CollectorColumn<int64_t>& sampleTimes() const final { return mSampleTimes; }
+
+    /// Time each collect() and collect_scope call made through the Collection, and the CPU time
+    /// of the sampling thread. Off by default, since timing calls has a cost of its own.
+    virtual void measureOverhead(bool enable) final { mMeasureOverhead = enable; mOverhead = CollectorOverhead(); }
+    virtual bool measuringOverhead() const final { return mMeasureOverhead; }
+    virtual CollectorOverhead& overhead() final { return mOverhead; }
+    /// Bytes of memory held by samples, not counting custom results or spilled chunks
+    virtual size_t memoryUsed() const final;
+
     /// If threaded, this holds the thread information
     std::thread thread;
     /// Set this to true in order to stop collecting data
@@ -151,6 +501,19 @@ protected:
     bool mCollecting;
     /// Data for each sampling point
     CollectorValueResults mResults;
+    /// Timestamp of each sample taken from a sampling thread
+    CollectorColumn<int64_t> mSampleTimes;
+    /// See sampleMutex()
+    std::mutex mSampleMutex;
+    /// Start of the current capture
+    int64_t mStartTime = 0;
+    /// Where full chunks of samples go, if anywhere
+    CollectorSpill* mSpill = nullptr;
+    /// Keep running statistics instead of samples? Set with 'online_stats' in the config.
+    bool mOnlineStats = false;
+    /// Registered metrics indexed by handle. These point into mResults, which must therefore never
+    /// have its entries erased or be reassigned as a whole.
+    std::vector<CollectorValueList*> mMetrics;
     /// Configuration JSON from the Collection super-class.
     Json::Value mConfig;
     /// Name of collector
@@ -159,30 +522,178 @@ protected:
     double mFactor;
     /// Custom results (replaces sampling points)
     Json::Value mCustomResult;
+    /// Measure our own cost?
+    bool mMeasureOverhead = false;
+    CollectorOverhead mOverhead;
+
+private:
+    CollectorValueList& result(const std::string& key)
+    {
+        CollectorValueList& list = mResults[key];
+        if (list.type == CollectorValueList::TYPE_UNASSIGNED) { list.online = mOnlineStats; list.spill = mSpill; }
+        return list;
+    }
+};
+
+// Turns successive samples of a growing counter into differences. Counts since boot are of no
+// interest, so collectors give it the counter once in start(), and the first sample of a capture is
+// the difference since the start rather than zero.
+class CounterDelta
+{
+public:
+    /// For counters that never wrap or reset but may go backwards a little, so that any decrease
+    /// gives zero
+    static const int CLAMP = -1;
+
+    explicit CounterDelta(int wrapBits = 0) : mWrapBits(wrapBits) {}
+
+    /// Difference to the previous value, which is zero for the first. A smaller value than the last
+    /// one means that the counter wrapped around: at wrapBits bits if given, or otherwise at 32 bits
+    /// if the last value was in the upper half of that range. Anything else is a reset to zero.
+    /// With CLAMP instead of wrapBits, a smaller value gives zero.
+    uint64_t update(uint64_t value)
+    {
+        const uint64_t previous = mPrevious;
+        const bool first = mFirst;
+        mPrevious = value;
+        mFirst = false;
+        if (first) return 0;
+        if (value >= previous) return value - previous;
+        if (mWrapBits == CLAMP) return 0;
+        if (mWrapBits > 0 && mWrapBits < 64) return (value - previous) & ((UINT64_C(1) << mWrapBits) - 1);
+        if (mWrapBits >= 64) return value - previous; // unsigned arithmetic wraps at 64 bits
+        if (previous <= UINT32_MAX && previous > UINT32_MAX / 2) return (value - previous) & UINT32_MAX;
+        return value; // reset
+    }
+    bool first() const { return mFirst; }
+    void reset() { mFirst = true; mPrevious = 0; }
+
+private:
+    int mWrapBits;
+    bool mFirst = true;
+    uint64_t mPrevious = 0;
+};
+
+// A growing counter stored as configured with 'mode': "absolute" for the counter itself, "delta"
+// for the difference to the previous sample, or "rate" for that difference per second. Set
+// 'wrap_bits' for counters that wrap around at other than 32 or 64 bits.
+class AccumulativeCounter
+{
+public:
+    enum Mode { MODE_ABSOLUTE, MODE_DELTA, MODE_RATE };
+
+    /// Read 'mode' and 'wrap_bits' from the config, with defaultMode if there is no mode. Returns
+    /// false for an unknown mode, which leaves defaultMode.
+    bool configure(const Json::Value& config, Mode defaultMode);
+    Mode mode() const { return mMode; }
+
+    /// Difference to the previous sample, per second in rate mode, where now is in microseconds.
+    /// The first sample gives zero.
+    double update(uint64_t counter, int64_t now)
+    {
+        const double delta = mDelta.update(counter);
+        const double seconds = mLastTime >= 0 && now > mLastTime ? (now - mLastTime) / 1000000.0 : 0.0;
+        mLastTime = now;
+        if (mMode != MODE_RATE) return delta;
+        return seconds > 0.0 ? delta / seconds : 0.0;
+    }
+    /// Start again from the next sample, as on a new capture
+    void reset() { mDelta.reset(); mLastTime = -1; }
+
+private:
+    Mode mMode = MODE_ABSOLUTE;
+    CounterDelta mDelta;
+    int64_t mLastTime = -1;
 };
 
 // Specialized collector class for handling /sys filesystem polling
 class SysfsCollector : public Collector
 {
 public:
+    /// The files are tried in order until one can be opened. They are looked up under the sysroot.
+    /// An accumulative file holds a growing counter, which by default is stored as the difference
+    /// to the previous sample. See AccumulativeCounter for 'mode' and 'wrap_bits' in the config.
     SysfsCollector(const Json::Value& config, const std::string& name, const std::vector<std::string>& sysfsfiles, bool accumulative = false);
     ~SysfsCollector();
 
     virtual bool init();
+    virtual bool start();
     virtual bool collect(int64_t);
-    virtual bool available() { init(); return mFD >= 0; }
+    /// Checks that one of the files is readable, without opening it
+    virtual bool available();
+    virtual SysReader* reader() { return mSlot >= 0 ? &mReader : nullptr; }
 
 protected:
     virtual bool parse(const char* buffer);
     std::string mSysfsFile;
     std::vector<std::string> mOptions;
+    MetricHandle mHandle = -1;
 
 private:
-    int mFD = -2;
+    SysReader mReader;
+    int mSlot = -2; // not yet opened
     bool mAccumulative = false;
+    AccumulativeCounter mCounter;
+    int64_t mNow = 0;
+};
+
+// Drives all threaded collectors from a single thread. Each tick wakes up on an absolute deadline,
+// so sampling does not drift, and collectors can run on every n-th tick only.
+class CollectorScheduler
+{
+public:
+    CollectorScheduler() : mFinished(false) {}
+
+    /// Start sampling the given collectors every tick, where a tick is tickMs milliseconds
+    void start(const std::vector<Collector*>& collectors, const std::vector<int>& divisors, int tickMs);
+    void stop();
+    bool running() const { return mThread.joinable(); }
+
+    /// Tick statistics from the last run, including missed deadlines and wakeup jitter
+    Json::Value results() const;
+    /// CPU time used by the scheduler thread in the last run
+    int64_t cpuTimeNs() const { return mCpuNs; }
+    /// Time spent reading the files of all collectors in the last run, before they parse them
+    int64_t readTimeNs() const { return mReadNs; }
+
+private:
+    void loop();
+
+    std::thread mThread;
+    std::atomic<bool> mFinished;
+    std::vector<Collector*> mCollectors;
+    std::vector<int> mDivisors;
+    SysReadBatch mBatch;
+    std::vector<SysReader*> mReaders; // of the collectors due on this tick
+    int64_t mTickNs = 0;
+    int64_t mTicks = 0;
+    int64_t mMissed = 0;
+    int64_t mWakeups = 0; // sleeps that ended at their deadline, over which jitter is measured
+    int64_t mJitterSumNs = 0;
+    int64_t mJitterMaxNs = 0;
+    int64_t mReadNs = 0;
+    int64_t mCpuNs = 0;
 };
 
+class CollectorTraceWriter;
+class JsonStream;
+
 // Manager class
+//
+// Configuration, besides an object for each collector by its name:
+//  - central_scheduler: Sample all threaded collectors from one thread rather than a thread each,
+//                       default false. Not done with per-API perf. The statistics of its ticks are
+//                       given as "scheduler" in the results.
+//  - scheduler_tick: Milliseconds between ticks of the central scheduler, by default the shortest
+//                    'sample_rate' of the threaded collectors.
+//  - spill_file: Move full chunks of samples out of memory into this file during capture, and read
+//                them back when writing results. The file is removed as soon as it is opened, so
+//                it never outlives the process, but it needs the disk space until then.
+//  - spill_budget: Bytes of chunks that may wait in memory to be written to the spill file before
+//                  collecting waits for the writer, default 4194304 (4 MiB).
+// In the object of a threaded collector:
+//  - rate_divisor: Sample only on every n-th tick of the central scheduler, by default its
+//                  'sample_rate' divided by the tick, rounded to the nearest whole number.
 class Collection
 {
 public:
@@ -209,34 +720,55 @@ public:
     /// Initialize a single collector. Attempts to initialize a collector more than once is ignored.
     bool initialize_collector(const std::string& name);
 
-    /// Return reference to a named collector.
+    /// Return reference to a named collector, creating it if necessary. Returns null if there is
+    /// no collector by that name.
     Collector* collector(const std::string& name);
 
+    /// Creates a collector with the given name from the configuration of the collection
+    typedef std::function<Collector*(const Json::Value& config, const std::string& name)> CollectorFactory;
+
+    /// Register a collector by name. It is only created once it is initialized or asked for, so
+    /// collectors that are never used cost nothing. Replaces any earlier registration by that name.
+    void registerCollector(const std::string& name, CollectorFactory factory);
+
+    /// Register a collector class taking the usual (config, name) constructor arguments
+    template<typename T> void registerCollector(const std::string& name)
+    {
+        registerCollector(name, [](const Json::Value& config, const std::string& name) -> Collector* { return new T(config, name); });
+    }
+
     /// Add custom collector
     void addCollector(Collector* collector)
     {
         mCollectors.push_back(collector);
+        mCollectorMap[collector->name()] = collector;
     }
 
     /// Add generic sysfs collector
     void addSysfsCollector(const std::string& name, std::vector<std::string> sysfsfiles)
     {
-        SysfsCollector* collector = new SysfsCollector(mConfig, name, sysfsfiles);
-        mCollectors.push_back((Collector*)collector);
+        registerCollector(name, [sysfsfiles](const Json::Value& config, const std::string& name) -> Collector* {
+            return new SysfsCollector(config, name, sysfsfiles);
+        });
     }
 
-    /// Write out the data to file as CSV (data in rows)
+    /// Write out the data to file as CSV (data in rows). Rows are formatted on 'csv_threads' threads
+    /// from the config, default 1, which also applies to the per-thread CSV files of perf.
     bool writeCSV(const std::string& filename);
 
     /// Write out the data to file as CSV in the MTV format (data in columns)
     bool writeCSV_MTV(const std::string& filename);
 
-    /// Write out the data to a file as json
+    /// Write out the data to a file as json. The data is written out as it is read, so this needs
+    /// much less memory than results() for long runs.
     bool writeJSON(const std::string& filename);
 
+    /// Write out the data as one json value, for embedding in a larger document
+    void writeJSON(JsonStream& json);
+
     /// Clear any old results and start collecting data. If the optional customHeaders
     /// vector is passed in, this defines custom data that must be passed in through
-    /// later calls to collect().
+    /// later calls to collect(). If 'trace_file' is set, it is overwritten with this capture.
     void start(const std::vector<std::string>& customHeaders = std::vector<std::string>());
 
     /// Stop collecting data
@@ -264,10 +796,39 @@ public:
     /// Get the results as JSON
     Json::Value results();
 
+    /// Get the results of one collector as they appear in results(). Returns false if they do not
+    /// appear there, as for collectors that are not running.
+    bool results(const std::string& name, Json::Value& out);
+
     const Json::Value& config() { return mConfig; }
 
 private:
+    struct TracedMetric
+    {
+        uint32_t id;
+        size_t written;
+        bool sampled; // samples of a threaded collector, not mapped onto frames
+    };
+
     void init_from_json(const Json::Value& config);
+    /// Create every registered collector that does not exist yet
+    void createAll();
+    /// Append values that are not in the trace file yet. Threaded collectors are written as their
+    /// samples and sample times, for the reader to map onto frames, until final is set after
+    /// postprocessing; then only values that postprocessing added are written.
+    void traceFlush(bool final);
+    /// Append the samples of a threaded collector that are not in the trace file yet
+    void traceSamples(Collector* c);
+    /// The trace metric of a value list or vector, defined on first use. Sample times are given
+    /// for the samples of a threaded collector.
+    TracedMetric& traced(const void* key, const std::string& collector, const std::string& name, CollectorValueList::vtype type,
+                         const TracedMetric* times = nullptr);
+    /// Number of threads to format CSV output with
+    unsigned csvThreads() const;
+    /// The libcollector_overhead results block, if 'measure_overhead' is set
+    Json::Value overheadResults() const;
+    /// The results of one collector, as in results()
+    Json::Value collectorResults(Collector* c);
 
     bool running = false;
     bool mEnablePerapiPerf = false;
@@ -275,12 +836,28 @@ private:
     std::vector<Collector*> mCollectors;
     std::vector<Collector*> mRunning;
     std::map<std::string, Collector*> mCollectorMap;
+    std::vector<std::pair<std::string, CollectorFactory>> mFactories; // in registration order
     std::vector<int64_t> mTiming;
     std::vector<int64_t> mTimingSummarized;
+    std::vector<CollectorStatsSummary> mTimingStats; // per summarized loop
     std::vector<std::vector<int64_t>> mCustom; // custom results
     std::vector<std::vector<int64_t>> mCustomSummarized; // custom results
     std::vector<std::string> mCustomHeaders;
+    CollectorScheduler mScheduler;
+    bool mScheduled = false; // whether mScheduler drove the threaded collectors of the last capture
+    SysReadBatch mBatch; // for collectors sampled by collect()
+    std::vector<SysReader*> mReaders;
+    CollectorSpill mSpill;
+    CollectorTraceWriter* mTrace = nullptr;
+    std::map<const void*, TracedMetric> mTraced; // by value list, vector or sample time column
+    unsigned mTraceFlushFrames = 1024;
     int64_t mStartTime = 0;
     int64_t mPreviousTime = 0;
     bool mDebug = false;
+    bool mMeasureOverhead = false;
+    // CSV rows, trace flushes and batched file reads mix all collectors, so their cost is only
+    // known in total
+    int64_t mCsvWriteNs = 0;
+    int64_t mTraceWriteNs = 0;
+    int64_t mFileReadNs = 0;
 };
@@ -482,24 +482,24 @@ void vkCollectorContext::postprocess_results() {
     }
 
     Json::Value result_data_value;
-    Json::Value libcollector_results = collectors->results();
 
     result_data_value["frames"] = static_cast<int>(frames_processed);
     result_data_value["cpu_runtime_seconds"] = static_cast<double>(run_duration_cpu_timer);
     result_data_value["fps"] = static_cast<double>(frames_processed) / run_duration_wall_timer;
     result_data_value["system_runtime_seconds"] = static_cast<double>(run_duration_wall_timer);
 
-    if (libcollector_results.isMember("ferret")) {
-        if (libcollector_results["ferret"].empty()) {
+    Json::Value ferret_results;
+    if (collectors->results("ferret", ferret_results)) {
+        if (ferret_results.empty()) {
             DBG_LOG("LIBCOLLECTOR LAYER: Ferret data detected, but the results are empty.\n");
         } else {
             DBG_LOG("LIBCOLLECTOR LAYER: Ferret data detected, checking for postprocessed results...\n");
             // Calculate CPU FPS
-            if (libcollector_results["ferret"].isMember("postprocessed_results")) {
+            if (ferret_results.isMember("postprocessed_results")) {
                 DBG_LOG("LIBCOLLECTOR LAYER: Postprocessed ferret data detected, calculating CPU FPS!\n");
 
-                int main_thread = libcollector_results["ferret"]["postprocessed_results"]["main_thread_index"].asInt();
-                double main_thread_megacycles = libcollector_results["ferret"]["postprocessed_results"]["main_thread_megacycles"].asInt();
+                int main_thread = ferret_results["postprocessed_results"]["main_thread_index"].asInt();
+                double main_thread_megacycles = ferret_results["postprocessed_results"]["main_thread_megacycles"].asInt();
                 DBG_LOG("LIBCOLLECTOR LAYER: Main (heaviest) thread index set to: %d, main thread mega cycles consumed = %f\n", main_thread, main_thread_megacycles);
 
                 result_data_value["main_thread_cpu_runtime@3GHz"] = main_thread_megacycles / 3000.0;
@@ -512,7 +512,7 @@ void vkCollectorContext::postprocess_results() {
                     result_data_value["cpu_fps_main_thread@3GHz"] = static_cast<double>(frames_processed) / main_thread_cpu_runtime_3ghz;
                 }
 
-                double total_megacycles = libcollector_results["ferret"]["postprocessed_results"]["megacycles_sum"].asDouble();
+                double total_megacycles = ferret_results["postprocessed_results"]["megacycles_sum"].asDouble();
                 DBG_LOG("LIBCOLLECTOR LAYER: Total CPU mega cycles consumed = %f\n", total_megacycles);
 
                 result_data_value["full_system_cpu_runtime@3GHz"] = total_megacycles / 3000.0;
@@ -536,11 +536,6 @@ void vkCollectorContext::postprocess_results() {
         }
     }
 
-    result_data_value["frame_data"] = libcollector_results;
-
-    Json::StyledWriter writer;
-    std::string collector_data = writer.write(result_data_value);
-
     std::string outputfile = glibcollector_config["result_file_basename"].asString();
     std::string json_token = ".json";
 
@@ -550,26 +545,28 @@ void vkCollectorContext::postprocess_results() {
         outputfile += "_device_" + _to_string(id) + json_token;
     }
 
-    FILE* file_handle = fopen(outputfile.c_str(), "w");
-    if (!file_handle) {
+    OutputBuffer out;
+    if (!out.open(outputfile)) {
         DBG_LOG("LIBCOLLECTOR LAYER ERROR: Failed to open output result JSON %s: %s\n", outputfile.c_str(), strerror(errno));
         return;
     }
 
-    size_t written;
-    int err = 0;
-    do {
-        written = fwrite(collector_data.c_str(), collector_data.size(), 1, file_handle);
-        err = ferror(file_handle);
-    } while (!written && (err == EWOULDBLOCK || err == EINTR || err == EAGAIN));
+    // Stream the collector data into the file rather than copying it into result_data_value first
+    JsonStream json(out);
+    json.beginObject();
+    for (auto it = result_data_value.begin(); it != result_data_value.end(); ++it) {
+        json.key(it.name());
+        json.value(*it);
+    }
+    json.key("frame_data");
+    collectors->writeJSON(json);
+    json.endObject();
 
-    if (ferror(file_handle)) {
+    const bool synced = out.sync();
+    if (!out.close() || !synced) {
         DBG_LOG("LIBCOLLECTOR LAYER ERROR: Failed to write output result JSON: %s\n", strerror(errno));
     }
 
-    fsync(fileno(file_handle));
-    fclose(file_handle);
-
     DBG_LOG("LIBCOLLECTOR LAYER: Results writter to %s.\n", outputfile.c_str());
 
     postprocessed = true;
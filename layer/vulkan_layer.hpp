@@ -16,6 +16,7 @@
 
 #include "vulkan/vk_layer.h"
 #include "interface.hpp"
+#include "output.hpp"
 #include "collectors/collector_utility.hpp"
 
 // VK_LAYER_EXPORT got removed from vulkan/vk_layer.h
@@ -0,0 +1,241 @@
+#include "output.hpp"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+
+
+// ---------- FORMATTING ----------
+
+size_t formatUInt(char* dst, uint64_t value)
+{
+    char tmp[FORMAT_MAX_CHARS];
+    char* p = tmp + sizeof(tmp);
+    do
+    {
+        *--p = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    const size_t len = tmp + sizeof(tmp) - p;
+    memcpy(dst, p, len);
+    dst[len] = '\0';
+    return len;
+}
+
+size_t formatInt(char* dst, int64_t value)
+{
+    if (value < 0)
+    {
+        *dst = '-';
+        return 1 + formatUInt(dst + 1, 0 - (uint64_t)value);
+    }
+    return formatUInt(dst, value);
+}
+
+size_t formatDouble(char* dst, double value)
+{
+    if (std::isnan(value))
+    {
+        memcpy(dst, "nan", 4);
+        return 3;
+    }
+    if (std::isinf(value))
+    {
+        const char* text = value > 0 ? "inf" : "-inf";
+        memcpy(dst, text, strlen(text) + 1);
+        return strlen(text);
+    }
+    if (std::fabs(value) < 9007199254740992.0 && value == std::trunc(value) && (value != 0 || !std::signbit(value)))
+    {
+        // Integral values up to 2^53 are exact as integers, so skip the floating point formatting
+        const size_t len = formatInt(dst, (int64_t)value);
+        memcpy(dst + len, ".0", 3);
+        return len + 2;
+    }
+    // The fewest digits that read back as the same value: 15 are enough for most, 17 for any
+    int len = snprintf(dst, FORMAT_MAX_CHARS, "%.15g", value);
+    for (int precision = 16; precision <= 17 && strtod(dst, nullptr) != value; precision++)
+    {
+        len = snprintf(dst, FORMAT_MAX_CHARS, "%.*g", precision, value);
+    }
+    // Use a decimal point whatever the locale, and keep the value recognisable as floating point
+    bool fraction = false;
+    for (int i = 0; i < len; i++)
+    {
+        if (dst[i] == ',') dst[i] = '.';
+        fraction = fraction || dst[i] == '.' || dst[i] == 'e';
+    }
+    if (!fraction)
+    {
+        memcpy(dst + len, ".0", 3);
+        len += 2;
+    }
+    return len;
+}
+
+// ---------- OUTPUT BUFFER ----------
+
+bool OutputBuffer::open(const std::string& filename)
+{
+    assert(!isOpen());
+    mFD = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (mFD == -1)
+    {
+        fprintf(stderr, "FAILED to open %s: %s\n", filename.c_str(), strerror(errno));
+        return false;
+    }
+    mUsed = 0;
+    mFailed = false;
+    return true;
+}
+
+bool OutputBuffer::close()
+{
+    if (!isOpen())
+    {
+        return false;
+    }
+    flush();
+    if (::close(mFD) != 0)
+    {
+        mFailed = true;
+    }
+    mFD = -1;
+    return !mFailed;
+}
+
+bool OutputBuffer::sync()
+{
+    return flush() && fsync(mFD) == 0;
+}
+
+bool OutputBuffer::flush()
+{
+    writeAll(mBuffer.data(), mUsed);
+    mUsed = 0;
+    return !mFailed;
+}
+
+void OutputBuffer::writeAll(const char* data, size_t size)
+{
+    while (size > 0 && !mFailed)
+    {
+        const ssize_t written = ::write(mFD, data, size);
+        if (written < 0 && (errno == EINTR || errno == EAGAIN))
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            DBG_LOG("Failed to write output: %s\n", strerror(errno));
+            mFailed = true;
+            break;
+        }
+        data += written;
+        size -= written;
+    }
+}
+
+// ---------- JSON STREAM ----------
+
+void JsonStream::newline()
+{
+    mOut.put('\n');
+    for (unsigned i = 0; i < mFirst.size(); i++)
+    {
+        mOut.write("   ", 3);
+    }
+}
+
+void JsonStream::separator()
+{
+    if (mAfterKey)
+    {
+        mAfterKey = false;
+    }
+    else if (!mFirst.empty())
+    {
+        assert(!mObject.back()); // object members need a key first
+        if (!mFirst.back()) mOut.write(", ", 2);
+        mFirst.back() = false;
+    }
+}
+
+void JsonStream::key(const std::string& name)
+{
+    assert(!mFirst.empty() && mObject.back() && !mAfterKey);
+    if (!mFirst.back()) mOut.put(',');
+    mFirst.back() = false;
+    newline();
+    string(name);
+    mOut.write(" : ", 3);
+    mAfterKey = true;
+}
+
+void JsonStream::endObject()
+{
+    const bool empty = mFirst.back();
+    mFirst.pop_back();
+    mObject.pop_back();
+    if (!empty) newline();
+    mOut.put('}');
+    if (mFirst.empty()) mOut.put('\n');
+}
+
+void JsonStream::string(const std::string& v)
+{
+    static const char hex[] = "0123456789abcdef";
+    mOut.put('"');
+    for (const char c : v)
+    {
+        switch (c)
+        {
+        case '"': mOut.write("\\\"", 2); break;
+        case '\\': mOut.write("\\\\", 2); break;
+        case '\n': mOut.write("\\n", 2); break;
+        case '\r': mOut.write("\\r", 2); break;
+        case '\t': mOut.write("\\t", 2); break;
+        default:
+            if ((unsigned char)c < 0x20)
+            {
+                const char escaped[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf] };
+                mOut.write(escaped, 6);
+            }
+            else mOut.put(c);
+            break;
+        }
+    }
+    mOut.put('"');
+}
+
+void JsonStream::value(const Json::Value& v)
+{
+    switch (v.type())
+    {
+    case Json::nullValue: separator(); mOut.write("null", 4); break;
+    case Json::intValue: value(static_cast<int64_t>(v.asInt64())); break;
+    case Json::uintValue: value(static_cast<uint64_t>(v.asUInt64())); break;
+    case Json::realValue: value(v.asDouble()); break;
+    case Json::stringValue: value(v.asString()); break;
+    case Json::booleanValue: value(v.asBool()); break;
+    case Json::arrayValue:
+        beginArray();
+        for (const Json::Value& element : v) value(element);
+        endArray();
+        break;
+    case Json::objectValue:
+        beginObject();
+        for (auto it = v.begin(); it != v.end(); ++it)
+        {
+            key(it.name());
+            value(*it);
+        }
+        endObject();
+        break;
+    }
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <thread>
+
+#include "interface.hpp"
+
+/// Longest text that the format functions below can produce, including the terminating zero
+#define FORMAT_MAX_CHARS 32
+
+/// Write a number as decimal text to dst and return its length. These do not depend on the locale.
+size_t formatInt(char* dst, int64_t value);
+size_t formatUInt(char* dst, uint64_t value);
+/// Shortest text that reads back as the same double. Non-finite values are written as nan, inf or -inf.
+size_t formatDouble(char* dst, double value);
+
+// Buffered output to a file descriptor, writing in large blocks.
+class OutputBuffer
+{
+public:
+    explicit OutputBuffer(size_t capacity = 256 * 1024) : mBuffer(capacity) {}
+    ~OutputBuffer() { close(); }
+
+    bool open(const std::string& filename);
+    /// Flush and close. Returns false if anything failed to be written.
+    bool close();
+    /// Flush and make sure the data is on disk
+    bool sync();
+    bool isOpen() const { return mFD >= 0; }
+
+    void write(const char* data, size_t size)
+    {
+        if (mUsed + size > mBuffer.size())
+        {
+            flush();
+            if (size > mBuffer.size()) { writeAll(data, size); return; }
+        }
+        memcpy(mBuffer.data() + mUsed, data, size);
+        mUsed += size;
+    }
+    void write(const std::string& str) { write(str.data(), str.size()); }
+    void put(char c) { if (mUsed == mBuffer.size()) flush(); mBuffer[mUsed++] = c; }
+    void putInt(int64_t value) { char tmp[FORMAT_MAX_CHARS]; write(tmp, formatInt(tmp, value)); }
+    void putUInt(uint64_t value) { char tmp[FORMAT_MAX_CHARS]; write(tmp, formatUInt(tmp, value)); }
+    void putDouble(double value) { char tmp[FORMAT_MAX_CHARS]; write(tmp, formatDouble(tmp, value)); }
+    bool flush();
+
+private:
+    void writeAll(const char* data, size_t size);
+
+    int mFD = -1;
+    std::vector<char> mBuffer;
+    size_t mUsed = 0;
+    bool mFailed = false;
+};
+
+// Writes JSON text as it goes, without building a document first. Objects are indented one member
+// per line, arrays are written on a single line.
+class JsonStream
+{
+public:
+    explicit JsonStream(OutputBuffer& out) : mOut(out) {}
+
+    void beginObject() { separator(); mOut.put('{'); mFirst.push_back(true); mObject.push_back(true); }
+    void endObject();
+    void beginArray() { separator(); mOut.write("[ ", 2); mFirst.push_back(true); mObject.push_back(false); }
+    void endArray() { mFirst.pop_back(); mObject.pop_back(); mOut.write(" ]", 2); }
+    /// Name the next member of the current object
+    void key(const std::string& name);
+
+    void value(int v) { separator(); mOut.putInt(v); }
+    void value(int64_t v) { separator(); mOut.putInt(v); }
+    void value(uint64_t v) { separator(); mOut.putUInt(v); }
+    void value(double v) { separator(); if (std::isfinite(v)) mOut.putDouble(v); else mOut.write("null", 4); }
+    void value(bool v) { separator(); if (v) mOut.write("true", 4); else mOut.write("false", 5); }
+    void value(const std::string& v) { separator(); string(v); }
+    /// Write a whole document, such as custom collector results
+    void value(const Json::Value& v);
+
+private:
+    void separator();
+    void newline();
+    void string(const std::string& v);
+
+    OutputBuffer& mOut;
+    std::vector<bool> mFirst; // no member or element written yet, per open object or array
+    std::vector<bool> mObject; // object rather than array, per open object or array
+    bool mAfterKey = false;
+};
+
+// Appends the fields of one CSV line to a string
+class CsvLine
+{
+public:
+    /// If terminated is set, every field is followed by the separator, including the last one.
+    CsvLine(std::string& text, const char* separator = ", ", bool terminated = false)
+        : mText(text), mSeparator(separator), mSeparatorLength(strlen(separator)), mTerminated(terminated) {}
+
+    void field(const std::string& v) { before(); mText += v; after(); }
+    void field(int64_t v) { char tmp[FORMAT_MAX_CHARS]; before(); mText.append(tmp, formatInt(tmp, v)); after(); }
+    void field(uint64_t v) { char tmp[FORMAT_MAX_CHARS]; before(); mText.append(tmp, formatUInt(tmp, v)); after(); }
+    void field(double v) { char tmp[FORMAT_MAX_CHARS]; before(); mText.append(tmp, formatDouble(tmp, v)); after(); }
+    void field(CollectorValueList::vtype type, CollectorValue v)
+    {
+        switch (type)
+        {
+        case CollectorValueList::TYPE_FP64: field(v.fp64); break;
+        case CollectorValueList::TYPE_I64: field(v.i64); break;
+        case CollectorValueList::TYPE_U64: field(v.u64); break;
+        case CollectorValueList::TYPE_UNASSIGNED: assert(false); break;
+        }
+    }
+    void end() { mText += '\n'; mFirst = true; }
+
+private:
+    void before() { if (!mTerminated && !mFirst) mText.append(mSeparator, mSeparatorLength); mFirst = false; }
+    void after() { if (mTerminated) mText.append(mSeparator, mSeparatorLength); }
+
+    std::string& mText;
+    const char* mSeparator;
+    size_t mSeparatorLength;
+    bool mTerminated;
+    bool mFirst = true;
+};
+
+/// Write CSV rows [0, rows) to out, where format(CsvLine&, row) appends the fields of one row. Rows
+/// are formatted in blocks of rowsPerBlock; with more than one thread, that many blocks are
+/// formatted at the same time and then written out in order. Only use threads if format() may be
+/// called concurrently; value lists backed by a spill may not.
+template<typename F>
+void writeCsvRows(OutputBuffer& out, size_t rows, F format, const char* separator = ", ", bool terminated = false,
+                  unsigned threads = 1, size_t rowsPerBlock = 4096)
+{
+    threads = std::max(1u, threads);
+    std::vector<std::string> blocks(threads);
+    auto formatBlock = [&](unsigned slot, size_t first)
+    {
+        std::string& text = blocks[slot];
+        text.clear();
+        CsvLine line(text, separator, terminated);
+        const size_t last = std::min(rows, first + rowsPerBlock);
+        for (size_t row = first; row < last; row++)
+        {
+            format(line, row);
+            line.end();
+        }
+    };
+    for (size_t first = 0; first < rows; first += threads * rowsPerBlock)
+    {
+        std::vector<std::thread> workers;
+        for (unsigned slot = 1; slot < threads && first + slot * rowsPerBlock < rows; slot++)
+        {
+            workers.push_back(std::thread(formatBlock, slot, first + slot * rowsPerBlock));
+        }
+        formatBlock(0, first);
+        for (std::thread& t : workers)
+        {
+            t.join();
+        }
+        for (unsigned slot = 0; slot <= workers.size(); slot++)
+        {
+            out.write(blocks[slot]);
+        }
+    }
+}
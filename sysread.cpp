@@ -0,0 +1,390 @@
+#include "sysread.hpp"
+#include "interface.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include <atomic>
+
+// The syscall numbers can be newer than the installed kernel headers, so check for both
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING_H 1
+#endif
+#endif
+
+#if defined(__linux__) && defined(HAVE_IO_URING_H) && defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#endif
+
+static std::atomic<bool> uringEnabled_(false); // see SysReadBatch::setUringEnabled()
+static std::atomic<bool> countSyscalls_(false); // see SysReadBatch::setCountSyscalls()
+static std::atomic<uint64_t> syscalls_(0);
+
+static inline void countSyscall()
+{
+    if (countSyscalls_.load(std::memory_order_relaxed))
+    {
+        syscalls_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// Submission queue size. Larger batches are submitted in several parts.
+#define RING_ENTRIES 128
+
+// ---------- SYSREADER ----------
+
+SysReader::SysReader()
+{
+}
+
+SysReader::~SysReader()
+{
+    clear();
+}
+
+int SysReader::add(const std::string& path, size_t capacity)
+{
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    unsigned slot = 0;
+    while (slot < mFiles.size() && mFiles[slot].fd >= 0) slot++;
+    if (slot == mFiles.size())
+    {
+        mFiles.emplace_back();
+    }
+    File& f = mFiles[slot];
+    f.fd = fd;
+    f.path = path;
+    f.buffer.assign(std::max<size_t>(capacity, 2), '\0');
+    f.length = 0;
+    f.fresh = false;
+    f.seekable = true;
+    mOpen++;
+    return slot;
+}
+
+void SysReader::remove(int slot)
+{
+    File& f = mFiles[slot];
+    if (f.fd >= 0)
+    {
+        close(f.fd);
+        f.fd = -1;
+        f.fresh = false;
+        mOpen--;
+    }
+}
+
+void SysReader::clear()
+{
+    for (unsigned i = 0; i < mFiles.size(); i++)
+    {
+        remove(i);
+    }
+    mFiles.clear();
+}
+
+void SysReader::readFile(File& f)
+{
+    while (true)
+    {
+        ssize_t len;
+        if (f.seekable)
+        {
+            len = pread(f.fd, f.buffer.data(), f.buffer.size() - 1, 0);
+            countSyscall();
+            if (len < 0 && errno == ESPIPE)
+            {
+                f.seekable = false; // some drivers cannot seek, so re-open the file for every read instead
+            }
+        }
+        if (!f.seekable)
+        {
+            close(f.fd);
+            f.fd = open(f.path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (f.fd < 0)
+            {
+                f.fd = open("/dev/null", O_RDONLY | O_CLOEXEC); // keep the slot open, and fail below
+                f.length = -ENOENT;
+                f.buffer[0] = '\0';
+                return;
+            }
+            len = ::read(f.fd, f.buffer.data(), f.buffer.size() - 1);
+            countSyscall();
+        }
+        if (len < 0)
+        {
+            f.length = -errno;
+            f.buffer[0] = '\0';
+            return;
+        }
+        if ((size_t)len == f.buffer.size() - 1)
+        {
+            f.buffer.resize(f.buffer.size() * 2); // may be cut short, so read it again with more room
+            continue;
+        }
+        f.length = len;
+        f.buffer[len] = '\0';
+        return;
+    }
+}
+
+bool SysReader::read()
+{
+    bool success = true;
+    for (File& f : mFiles)
+    {
+        if (f.fd < 0) continue;
+        if (!f.fresh) readFile(f);
+        f.fresh = false;
+        success = success && f.length >= 0;
+    }
+    return success;
+}
+
+// ---------- SYSREADBATCH ----------
+
+SysReadBatch::SysReadBatch()
+{
+}
+
+SysReadBatch::~SysReadBatch()
+{
+    closeRing();
+}
+
+void SysReadBatch::setUringEnabled(bool enabled)
+{
+    uringEnabled_ = enabled;
+}
+
+bool SysReadBatch::uringEnabled()
+{
+    return uringEnabled_;
+}
+
+void SysReadBatch::setCountSyscalls(bool enabled)
+{
+    countSyscalls_ = enabled;
+}
+
+uint64_t SysReadBatch::syscalls()
+{
+    return syscalls_.load(std::memory_order_relaxed);
+}
+
+#ifdef HAVE_IO_URING
+
+bool SysReadBatch::setupRing()
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    const int fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &p);
+    if (fd < 0)
+    {
+        return false; // not supported, or not allowed here
+    }
+    mRing.fd = fd;
+    mRing.entries = p.sq_entries;
+    mRing.sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    mRing.cqSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    const bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single)
+    {
+        mRing.sqSize = mRing.cqSize = std::max(mRing.sqSize, mRing.cqSize);
+    }
+    mRing.sq = mmap(nullptr, mRing.sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (mRing.sq == MAP_FAILED)
+    {
+        mRing.sq = nullptr;
+        closeRing();
+        return false;
+    }
+    if (single)
+    {
+        mRing.cq = mRing.sq;
+    }
+    else
+    {
+        mRing.cq = mmap(nullptr, mRing.cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (mRing.cq == MAP_FAILED)
+        {
+            mRing.cq = nullptr;
+            closeRing();
+            return false;
+        }
+    }
+    mRing.sqes = mmap(nullptr, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (mRing.sqes == MAP_FAILED)
+    {
+        mRing.sqes = nullptr;
+        closeRing();
+        return false;
+    }
+    char* sq = static_cast<char*>(mRing.sq);
+    char* cq = static_cast<char*>(mRing.cq);
+    mRing.sqHead = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+    mRing.sqTail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    mRing.sqMask = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    mRing.sqArray = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    mRing.cqHead = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    mRing.cqTail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    mRing.cqMask = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    mRing.cqes = cq + p.cq_off.cqes;
+    return true;
+}
+
+void SysReadBatch::closeRing()
+{
+    if (mRing.sqes) munmap(mRing.sqes, mRing.entries * sizeof(struct io_uring_sqe));
+    if (mRing.cq && mRing.cq != mRing.sq) munmap(mRing.cq, mRing.cqSize);
+    if (mRing.sq) munmap(mRing.sq, mRing.sqSize);
+    if (mRing.fd >= 0) close(mRing.fd);
+    mRing = Ring();
+}
+
+// Read files[first, first + count) with one io_uring_enter(), unless interrupted. Files that could
+// not be read this way are left for pread(). Returns false if the ring no longer works.
+bool SysReadBatch::submit(std::vector<SysReader::File*>& files, size_t first, size_t count)
+{
+    struct io_uring_sqe* sqes = static_cast<struct io_uring_sqe*>(mRing.sqes);
+    struct io_uring_cqe* cqes = static_cast<struct io_uring_cqe*>(mRing.cqes);
+    const unsigned sqMask = *mRing.sqMask;
+    const unsigned cqMask = *mRing.cqMask;
+    unsigned tail = *mRing.sqTail;
+    for (size_t i = 0; i < count; i++)
+    {
+        SysReader::File& f = *files[first + i];
+        mIovecs[i].iov_base = f.buffer.data();
+        mIovecs[i].iov_len = f.buffer.size() - 1;
+        const unsigned index = tail & sqMask;
+        struct io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READV;
+        sqe->fd = f.fd;
+        sqe->addr = reinterpret_cast<uint64_t>(&mIovecs[i]);
+        sqe->len = 1;
+        sqe->off = 0;
+        sqe->user_data = i;
+        mRing.sqArray[index] = index;
+        tail++;
+    }
+    __atomic_store_n(mRing.sqTail, tail, __ATOMIC_RELEASE);
+
+    bool working = true;
+    size_t completed = 0;
+    while (completed < count)
+    {
+        const unsigned toSubmit = tail - __atomic_load_n(mRing.sqHead, __ATOMIC_ACQUIRE);
+        const int ret = syscall(__NR_io_uring_enter, mRing.fd, toSubmit, count - completed, IORING_ENTER_GETEVENTS, nullptr, 0);
+        countSyscall();
+        if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        {
+            // Nothing more will complete, so leave the rest to pread()
+            DBG_LOG("io_uring_enter failed, reading files with pread instead: %s\n", strerror(errno));
+            return false;
+        }
+        unsigned head = *mRing.cqHead;
+        const unsigned cqTail = __atomic_load_n(mRing.cqTail, __ATOMIC_ACQUIRE);
+        while (head != cqTail)
+        {
+            const struct io_uring_cqe& cqe = cqes[head & cqMask];
+            SysReader::File& f = *files[first + cqe.user_data];
+            if (cqe.res >= 0 && (size_t)cqe.res < f.buffer.size() - 1)
+            {
+                f.length = cqe.res;
+                f.buffer[cqe.res] = '\0';
+                f.fresh = true;
+            }
+            else if (cqe.res == -EINVAL || cqe.res == -EOPNOTSUPP)
+            {
+                working = false; // reads are not supported by this kernel
+            }
+            // otherwise it was cut short or failed, and is read again with pread(), which knows
+            // how to deal with both
+            head++;
+            completed++;
+        }
+        __atomic_store_n(mRing.cqHead, head, __ATOMIC_RELEASE);
+    }
+    return working;
+}
+
+#else
+
+bool SysReadBatch::setupRing()
+{
+    return false;
+}
+
+void SysReadBatch::closeRing()
+{
+}
+
+bool SysReadBatch::submit(std::vector<SysReader::File*>&, size_t, size_t)
+{
+    return false;
+}
+
+#endif
+
+void SysReadBatch::read(const std::vector<SysReader*>& readers)
+{
+    mReaders.assign(readers.begin(), readers.end());
+    mPending.clear();
+    for (SysReader* r : readers)
+    {
+        for (SysReader::File& f : r->mFiles)
+        {
+            if (f.fd >= 0 && f.seekable && !f.fresh) mPending.push_back(&f);
+        }
+    }
+    if (!mTried && mPending.size() > 1)
+    {
+        mTried = true;
+        if (uringEnabled() && setupRing())
+        {
+            mIovecs.resize(mRing.entries);
+        }
+    }
+    if (mRing.fd >= 0 && mPending.size() > 1)
+    {
+        for (size_t first = 0; first < mPending.size(); first += mRing.entries)
+        {
+            if (!submit(mPending, first, std::min<size_t>(mRing.entries, mPending.size() - first)))
+            {
+                closeRing();
+                break;
+            }
+        }
+    }
+    for (SysReader::File* f : mPending)
+    {
+        if (!f->fresh)
+        {
+            SysReader::readFile(*f);
+            f->fresh = true;
+        }
+    }
+}
+
+void SysReadBatch::finish()
+{
+    for (SysReader* r : mReaders)
+    {
+        for (SysReader::File& f : r->mFiles)
+        {
+            f.fresh = false;
+        }
+    }
+    mReaders.clear();
+}
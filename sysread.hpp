@@ -0,0 +1,123 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <string>
+#include <vector>
+
+class SysReadBatch;
+
+// Reads small sysfs and procfs files whole on every sample. Files are kept open and read with
+// pread() at offset zero, so no seeking is needed. When a SysReadBatch has already read a file for
+// the current sample, its contents are used without reading it again.
+class SysReader
+{
+public:
+    SysReader();
+    ~SysReader();
+    SysReader(const SysReader&) = delete;
+    SysReader& operator=(const SysReader&) = delete;
+
+    /// Open a file, returning its slot, or -1 with errno set if it cannot be opened. The path is
+    /// used as is, so resolve it with sysPath() first. Buffers grow as needed beyond capacity.
+    int add(const std::string& path, size_t capacity = 256);
+    /// Close the file in a slot. Other slots keep their numbers.
+    void remove(int slot);
+    /// Close all files
+    void clear();
+    /// Number of open files
+    unsigned files() const { return mOpen; }
+
+    /// Read every open file that has not already been read by a batch since the last call.
+    /// Returns false if any of them failed.
+    bool read();
+    /// Contents from the last read, terminated by a zero
+    const char* data(int slot) const { return mFiles[slot].buffer.data(); }
+    /// The same, for parsers that modify it in place until the next read
+    char* data(int slot) { return mFiles[slot].buffer.data(); }
+    /// Bytes read by the last read, or minus errno if it failed
+    ssize_t length(int slot) const { return mFiles[slot].length; }
+    const std::string& path(int slot) const { return mFiles[slot].path; }
+
+private:
+    friend class SysReadBatch;
+
+    struct File
+    {
+        int fd = -1;
+        std::string path;
+        std::vector<char> buffer;
+        ssize_t length = 0;
+        bool fresh = false; // read by a batch, and not yet used
+        bool seekable = true;
+    };
+
+    static void readFile(File& f);
+
+    std::vector<File> mFiles;
+    unsigned mOpen = 0;
+};
+
+// Reads the files of several SysReaders together, with one pread() per file, or as one io_uring
+// submission if enabled. The scheduler uses one for all collectors due on a tick.
+class SysReadBatch
+{
+public:
+    SysReadBatch();
+    ~SysReadBatch();
+    SysReadBatch(const SysReadBatch&) = delete;
+    SysReadBatch& operator=(const SysReadBatch&) = delete;
+
+    /// Read all open files of these readers
+    void read(const std::vector<SysReader*>& readers);
+    /// Drop contents that were read but not used since the last read(), so that they are not
+    /// mistaken for a later sample
+    void finish();
+    /// Whether reads go through io_uring; only known after the first read()
+    bool usingUring() const { return mRing.fd >= 0; }
+
+    /// Enable or disable io_uring for batches that have not read anything yet. It is disabled by
+    /// default: sysfs and procfs reads cannot complete inline, so io_uring hands each one to a
+    /// kernel worker and ends up slower than pread(). It is also fatal in Android app sandboxes.
+    /// Set with 'io_uring' in the config.
+    static void setUringEnabled(bool enabled);
+    static bool uringEnabled();
+    /// Count the system calls made to read files, in all readers and batches. Off by default, so
+    /// that sampling does not pay for it; the benchmarks turn it on.
+    static void setCountSyscalls(bool enabled);
+    /// System calls made to read files while counting was on
+    static uint64_t syscalls();
+
+private:
+    friend class SysReader;
+
+    struct Ring
+    {
+        int fd = -1;
+        unsigned entries = 0;
+        void* sq = nullptr;
+        void* cq = nullptr;
+        size_t sqSize = 0;
+        size_t cqSize = 0;
+        void* sqes = nullptr;
+        unsigned* sqHead = nullptr;
+        unsigned* sqTail = nullptr;
+        unsigned* sqMask = nullptr;
+        unsigned* sqArray = nullptr;
+        unsigned* cqHead = nullptr;
+        unsigned* cqTail = nullptr;
+        unsigned* cqMask = nullptr;
+        void* cqes = nullptr;
+    };
+
+    bool setupRing();
+    void closeRing();
+    bool submit(std::vector<SysReader::File*>& files, size_t first, size_t count);
+
+    Ring mRing;
+    bool mTried = false;
+    std::vector<SysReader::File*> mPending;
+    std::vector<struct iovec> mIovecs;
+    std::vector<SysReader*> mReaders; // filled by the last read()
+};
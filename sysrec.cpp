@@ -0,0 +1,554 @@
+// Records sysfs and procfs files over time, and replays them into a directory tree that collectors
+// can read by setting 'sysroot' in their configuration (or LIBCOLLECTOR_SYSROOT).
+//
+// A recording starts with the line "sysrec 1", followed by records of these kinds:
+//   path <index> <path>             a recorded file, given once for each file before its first data
+//   time <microseconds>             the files read at this time since the start follow
+//   data <index> <size>\n<bytes>\n  new contents of a file, only given when they have changed.
+//                                   Empty contents stand for a file that failed to read.
+
+#include "interface.hpp"
+#include "output.hpp"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <map>
+
+// Files that the built-in collectors read, when no others are given
+static const char* defaultPatterns[] =
+{
+    "/sys/devices/system/cpu/cpufreq/policy[0-9]*/scaling_cur_freq",
+    "/sys/devices/system/cpu/cpufreq/policy[0-9]*/stats/time_in_state",
+    "/sys/devices/system/cpu/cpufreq/policy[0-9]*/related_cpus",
+    "/sys/devices/system/cpu/cpu[0-9]*/cpufreq/scaling_cur_freq",
+    "/sys/devices/system/cpu/cpu[0-9]*/cpufreq/stats/time_in_state",
+    "/sys/devices/system/cpu/cpu[0-9]*/cpufreq/stats/total_trans",
+    "/sys/devices/system/cpu/cpu[0-9]*/cpuidle/state[0-9]*/time",
+    "/sys/devices/system/cpu/cpu[0-9]*/cpuidle/state[0-9]*/usage",
+    "/sys/devices/system/cpu/cpu[0-9]*/cpuidle/state[0-9]*/name",
+    "/sys/class/thermal/thermal_zone[0-9]*/temp",
+    "/sys/class/thermal/thermal_zone[0-9]*/type",
+    "/sys/class/thermal/cooling_device[0-9]*/cur_state",
+    "/sys/class/thermal/cooling_device[0-9]*/max_state",
+    "/sys/class/thermal/cooling_device[0-9]*/type",
+    "/sys/class/devfreq/*/cur_freq",
+    "/sys/class/devfreq/*/trans_stat",
+    "/sys/class/power_supply/battery/temp",
+    "/sys/class/power_supply/battery/batt_temp",
+    "/sys/devices/platform/*/power/runtime_active_time",
+    "/sys/devices/platform/*/power/runtime_suspended_time",
+    "/sys/devices/platform/*/clock",
+    "/sys/kernel/gpu/gpu_clock",
+    "/sys/class/kgsl/kgsl-3d0/gpuclk",
+    "/proc/stat",
+    "/proc/meminfo",
+    "/proc/vmstat",
+    "/proc/pressure/cpu",
+    "/proc/pressure/memory",
+    "/proc/pressure/io",
+    nullptr
+};
+
+// Files of the process given with -p, read by the schedstat and ferret collectors, whose 'pid'
+// must then be set to the same process id. These are looked for again on every read, so that the
+// recording follows threads as they start.
+static const char* processPatterns[] =
+{
+    "/proc/%d/stat",
+    "/proc/%d/task/[0-9]*/stat",
+    "/proc/%d/task/[0-9]*/schedstat",
+    "/proc/%d/task/[0-9]*/comm",
+    nullptr
+};
+
+// Files of the process given with -p that the memory collector reads for itself. They are recorded
+// as those of /proc/self, so that the replay stands in for the process being measured rather than
+// for sysrec.
+static const char* selfFiles[] =
+{
+    "status",
+    "stat",
+    "smaps_rollup",
+    nullptr
+};
+
+void usage(int status)
+{
+    static const char message[] =
+        "usage: sysrec record [-i MILLISECONDS] [-d SECONDS] [-p PID] RECORDING [PATH...]\n"
+        "       sysrec replay [-1] [-l] [-s SPEED] RECORDING ROOT\n\n"
+        "Records sysfs and procfs files over time, so that collectors can later be run against them\n"
+        "on a machine without the same hardware, by setting 'sysroot' in their configuration or\n"
+        "LIBCOLLECTOR_SYSROOT in the environment to the replay ROOT.\n"
+        "\n"
+        "record: Read the files every interval and write any that changed to RECORDING. Paths may\n"
+        "        be glob patterns; by default the files read by the built-in collectors are recorded.\n"
+        "    -i  Interval between reads in milliseconds (default 100)\n"
+        "    -d  Duration of the recording in seconds (default 10)\n"
+        "    -p  Also record the threads of process PID, including those started while recording,\n"
+        "        for collectors configured with this 'pid', and its memory use as that of /proc/self\n"
+        "\n"
+        "replay: Create the recorded files under ROOT and update them in place as they were recorded.\n"
+        "    -1  Only create the files as first recorded, then exit\n"
+        "    -l  Loop forever\n"
+        "    -s  Replay speed, as a factor of real time (default 1)\n"
+        "\n";
+
+    fputs( message, stderr );
+    exit( status );
+}
+
+static int64_t getTime()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleepUntil( int64_t time )
+{
+    struct timespec ts;
+    ts.tv_sec = time / 1000000;
+    ts.tv_nsec = ( time % 1000000 ) * 1000;
+    while( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr ) == EINTR ) {}
+}
+
+// Whole contents of a file, read from the start
+static bool readContents( int fd, std::string& contents )
+{
+    char buf[4096];
+    contents.clear();
+    off_t offset = 0;
+    while( true )
+    {
+        const ssize_t len = pread( fd, buf, sizeof( buf ), offset );
+        if( len < 0 )
+        {
+            return false;
+        }
+        if( len == 0 )
+        {
+            return true;
+        }
+        contents.append( buf, len );
+        offset += len;
+    }
+}
+
+// A file being recorded
+struct RecordedFile
+{
+    int fd;
+    bool rescanned; // found again on every read, and closed once it fails to read
+    bool valid; // whether last holds its contents
+    std::string last;
+};
+
+static int record( const std::string& filename, const std::vector<std::string>& patterns, const std::vector<std::string>& rescannedPatterns,
+                   int pid, int intervalMs, int durationS )
+{
+    std::vector<RecordedFile> files;
+    std::map<std::string, unsigned> indices; // of files by the path they are recorded as
+    std::vector<std::string> names; // paths that files are recorded as, until written out
+    auto add = [&files, &indices, &names]( const std::string& path, const std::string& name, bool rescanned )
+    {
+        auto it = indices.find( name );
+        if( it != indices.end() && files[it->second].fd >= 0 )
+        {
+            return;
+        }
+        const int fd = open( path.c_str(), O_RDONLY );
+        if( fd < 0 )
+        {
+            return;
+        }
+        if( it != indices.end() ) // a file that had gone is back, as when a thread id is reused
+        {
+            files[it->second].fd = fd;
+            return;
+        }
+        RecordedFile f = { fd, rescanned, false, std::string() };
+        indices[name] = files.size();
+        files.push_back( f );
+        names.push_back( name );
+    };
+    auto scan = [&add]( const std::vector<std::string>& patterns, bool rescanned )
+    {
+        for( const std::string& pattern : patterns )
+        {
+            glob_t g;
+            if( glob( pattern.c_str(), 0, nullptr, &g ) == 0 )
+            {
+                for( size_t i = 0; i < g.gl_pathc; i++ )
+                {
+                    add( g.gl_pathv[i], g.gl_pathv[i], rescanned );
+                }
+            }
+            globfree( &g );
+        }
+    };
+    scan( patterns, false );
+    scan( rescannedPatterns, true );
+    for( const char** f = selfFiles; pid > 0 && *f; f++ )
+    {
+        char path[64];
+        snprintf( path, sizeof( path ), "/proc/%d/%s", pid, *f );
+        add( path, std::string( "/proc/self/" ) + *f, false );
+    }
+    if( files.empty() )
+    {
+        fprintf( stderr, "ERROR: none of the files to record can be read\n" );
+        return 1;
+    }
+
+    OutputBuffer out;
+    if( !out.open( filename ) )
+    {
+        fprintf( stderr, "ERROR: cannot create %s\n", filename.c_str() );
+        return 1;
+    }
+    out.write( std::string( "sysrec 1\n" ) );
+    unsigned written = 0; // files whose path has been written out
+    std::string contents;
+    const int64_t start = getTime();
+    const int64_t end = start + (int64_t)durationS * 1000000;
+    for( int64_t tick = start; tick <= end; tick += (int64_t)intervalMs * 1000 )
+    {
+        sleepUntil( tick );
+        if( tick > start )
+        {
+            scan( rescannedPatterns, true );
+        }
+        for( ; written < files.size(); written++ )
+        {
+            out.write( std::string( "path " ) );
+            out.putUInt( written );
+            out.put( ' ' );
+            out.write( names[written] );
+            out.put( '\n' );
+        }
+        out.write( std::string( "time " ) );
+        out.putInt( getTime() - start );
+        out.put( '\n' );
+        for( unsigned i = 0; i < files.size(); i++ )
+        {
+            RecordedFile& f = files[i];
+            if( f.fd < 0 )
+            {
+                continue;
+            }
+            if( !readContents( f.fd, contents ) )
+            {
+                contents.clear();
+                if( f.rescanned ) // a thread that has exited, which keeps failing until it is back
+                {
+                    close( f.fd );
+                    f.fd = -1;
+                }
+            }
+            if( f.valid && contents == f.last )
+            {
+                continue;
+            }
+            out.write( std::string( "data " ) );
+            out.putUInt( i );
+            out.put( ' ' );
+            out.putUInt( contents.size() );
+            out.put( '\n' );
+            out.write( contents );
+            out.put( '\n' );
+            f.last.swap( contents );
+            f.valid = true;
+        }
+    }
+
+    for( const RecordedFile& f : files )
+    {
+        if( f.fd >= 0 ) close( f.fd );
+    }
+    if( !out.close() )
+    {
+        fprintf( stderr, "ERROR: failed to write %s\n", filename.c_str() );
+        return 1;
+    }
+    fprintf( stderr, "Recorded %u files\n", (unsigned)files.size() );
+    return 0;
+}
+
+struct Change
+{
+    unsigned file;
+    std::string contents;
+};
+
+struct Frame
+{
+    int64_t time;
+    std::vector<Change> changes;
+};
+
+static bool load( const std::string& filename, std::vector<std::string>& files, std::vector<Frame>& frames )
+{
+    const int fd = open( filename.c_str(), O_RDONLY );
+    std::string text;
+    if( fd < 0 || !readContents( fd, text ) )
+    {
+        fprintf( stderr, "ERROR: cannot read %s\n", filename.c_str() );
+        if( fd >= 0 ) close( fd );
+        return false;
+    }
+    close( fd );
+
+    size_t pos = 0;
+    auto line = [&text, &pos]( std::string& result ) -> bool
+    {
+        const size_t eol = text.find( '\n', pos );
+        if( eol == std::string::npos ) return false;
+        result = text.substr( pos, eol - pos );
+        pos = eol + 1;
+        return true;
+    };
+    std::string l;
+    if( !line( l ) || l != "sysrec 1" )
+    {
+        fprintf( stderr, "ERROR: %s is not a recording\n", filename.c_str() );
+        return false;
+    }
+    while( line( l ) )
+    {
+        if( l.compare( 0, 5, "path " ) == 0 )
+        {
+            const size_t space = l.find( ' ', 5 );
+            const unsigned index = strtoul( l.c_str() + 5, nullptr, 10 );
+            if( space == std::string::npos || index != files.size() ) break;
+            files.push_back( l.substr( space + 1 ) );
+        }
+        else if( l.compare( 0, 5, "time " ) == 0 )
+        {
+            Frame f;
+            f.time = strtoll( l.c_str() + 5, nullptr, 10 );
+            frames.push_back( f );
+        }
+        else if( l.compare( 0, 5, "data " ) == 0 && !frames.empty() )
+        {
+            char* end = nullptr;
+            Change c;
+            c.file = strtoul( l.c_str() + 5, &end, 10 );
+            const size_t size = strtoull( end, nullptr, 10 );
+            if( c.file >= files.size() || pos + size + 1 > text.size() ) break; // cut short
+            c.contents = text.substr( pos, size );
+            pos += size + 1;
+            frames.back().changes.push_back( c );
+        }
+        else
+        {
+            break;
+        }
+    }
+    if( frames.empty() )
+    {
+        fprintf( stderr, "ERROR: %s holds no data\n", filename.c_str() );
+        return false;
+    }
+    return true;
+}
+
+static bool createDirectories( const std::string& path )
+{
+    for( size_t pos = path.find( '/', 1 ); pos != std::string::npos; pos = path.find( '/', pos + 1 ) )
+    {
+        if( mkdir( path.substr( 0, pos ).c_str(), 0755 ) != 0 && errno != EEXIST )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Replace the contents in place, so that readers holding the file open see them. Contents at
+// least as long as before are written over the old ones, so readers never see the file empty.
+// Shorter ones would leave the old tail behind ("99" over "12345" reads "99345"), so the file is
+// emptied first, which readers take as a failed read.
+static bool update( int fd, const std::string& contents )
+{
+    struct stat st;
+    const bool shrinks = fstat( fd, &st ) != 0 || (size_t)st.st_size > contents.size();
+    if( ( shrinks && ftruncate( fd, 0 ) != 0 ) || pwrite( fd, contents.data(), contents.size(), 0 ) != (ssize_t)contents.size() )
+    {
+        fprintf( stderr, "WARNING: failed to update a file: %s\n", strerror( errno ) );
+        return false;
+    }
+    return true;
+}
+
+static int replay( const std::string& filename, const std::string& root, bool once, bool loop, double speed )
+{
+    std::vector<std::string> files;
+    std::vector<Frame> frames;
+    if( !load( filename, files, frames ) )
+    {
+        return 1;
+    }
+
+    // Files are created with their first contents, so that those recorded later, such as the files
+    // of a thread that started during the recording, only appear at that time
+    std::vector<int> fds( files.size(), -1 );
+    auto create = [&root, &files, &fds]( unsigned file ) -> bool
+    {
+        const std::string path = root + files[file];
+        if( !createDirectories( path ) )
+        {
+            fprintf( stderr, "ERROR: cannot create directories for %s\n", path.c_str() );
+            return false;
+        }
+        fds[file] = open( path.c_str(), O_WRONLY | O_CREAT, 0644 );
+        if( fds[file] < 0 )
+        {
+            fprintf( stderr, "ERROR: cannot create %s\n", path.c_str() );
+            return false;
+        }
+        return true;
+    };
+
+    int status = 0;
+    do
+    {
+        const int64_t start = getTime();
+        for( const Frame& f : frames )
+        {
+            if( !once )
+            {
+                sleepUntil( start + (int64_t)( f.time / speed ) );
+            }
+            for( const Change& c : f.changes )
+            {
+                if( fds[c.file] < 0 && !create( c.file ) )
+                {
+                    status = 1;
+                    continue;
+                }
+                if( !update( fds[c.file], c.contents ) )
+                {
+                    status = 1; // but keep going, as readers may still get the other files
+                }
+            }
+            if( once )
+            {
+                break;
+            }
+        }
+    } while( loop && !once );
+
+    for( int fd : fds )
+    {
+        if( fd >= 0 ) close( fd );
+    }
+    return status;
+}
+
+int main(int argc, char **argv)
+{
+    extern char *optarg;
+    extern int optind;
+    int c;
+
+    if( argc < 2 )
+    {
+        usage( 2 );
+    }
+    const std::string mode = argv[1];
+    if( mode == "-h" )
+    {
+        usage( 0 );
+    }
+    if( mode != "record" && mode != "replay" )
+    {
+        fprintf( stderr, "ERROR: unknown mode %s\n", mode.c_str() );
+        usage( 2 );
+    }
+
+    int intervalMs = 100;
+    int durationS = 10;
+    int pid = 0;
+    bool once = false;
+    bool loop = false;
+    double speed = 1.0;
+
+    optind = 2;
+    while( ( c = getopt(argc, argv, "hi:d:p:1ls:") ) != -1 )
+    {
+        switch( c )
+        {
+            case 'h':
+                usage( 0 );
+                break;
+            case 'i':
+                intervalMs = std::max( 1, atoi( optarg ) );
+                break;
+            case 'd':
+                durationS = std::max( 0, atoi( optarg ) );
+                break;
+            case 'p':
+                pid = atoi( optarg );
+                break;
+            case '1':
+                once = true;
+                break;
+            case 'l':
+                loop = true;
+                break;
+            case 's':
+                speed = atof( optarg );
+                break;
+            default:
+                usage( 2 );
+                break;
+        }
+    }
+
+    if( mode == "record" )
+    {
+        if( argc - optind < 1 )
+        {
+            fprintf( stderr, "ERROR: a recording file is required\n" );
+            usage( 2 );
+        }
+        std::vector<std::string> patterns( argv + optind + 1, argv + argc );
+        if( patterns.empty() )
+        {
+            for( const char** p = defaultPatterns; *p; p++ )
+            {
+                patterns.push_back( *p );
+            }
+        }
+        std::vector<std::string> process;
+        for( const char** p = processPatterns; pid > 0 && *p; p++ )
+        {
+            char pattern[64];
+            snprintf( pattern, sizeof( pattern ), *p, pid );
+            process.push_back( pattern );
+        }
+        return record( argv[optind], patterns, process, pid, intervalMs, durationS );
+    }
+
+    if( argc - optind != 2 )
+    {
+        fprintf( stderr, "ERROR: a recording file and a root directory are required\n" );
+        usage( 2 );
+    }
+    if( speed <= 0.0 )
+    {
+        fprintf( stderr, "ERROR: speed must be positive\n" );
+        usage( 2 );
+    }
+    return replay( argv[optind], argv[optind + 1], once, loop, speed );
+}
@@ -1,10 +1,17 @@
 #include "interface.hpp"
 #include "collectors/perf.hpp"
+#include "collectors/devfreq.hpp"
+#include "trace.hpp"
+#include "output.hpp"
 
 #include <assert.h>
 #include <stdio.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <ftw.h>
 #include <unistd.h>
 #include <mutex>
 #include <memory>
@@ -15,6 +22,7 @@
 #ifndef DEBUG
 // otherwise we will get complaints about assert()ed variables being unused
 #pragma GCC diagnostic ignored "-Wunused-variable"
+#pragma GCC diagnostic ignored "-Wunused-but-set-variable"
 #endif
 
 static void test1()
@@ -351,6 +359,1366 @@ private:
 	std::mutex test8_mtx;
 };
 
+class HandleCollector : public Collector
+{
+public:
+	using Collector::Collector;
+
+	virtual bool init() override
+	{
+		mCount = registerMetric("count");
+		mHalf = registerMetric("half");
+		const MetricHandle again = registerMetric("count");
+		assert(again == mCount); // registering twice gives the same handle
+		registerMetric("never_sampled");
+		return true;
+	}
+	virtual bool collect(int64_t) override { add(mCount, ++mValue); add(mHalf, mValue / 2.0); return true; }
+	virtual bool available() override { return true; }
+
+private:
+	MetricHandle mCount = -1;
+	MetricHandle mHalf = -1;
+	int mValue = 0;
+};
+
+static void test9()
+{
+	printf("[test 9]: Testing metric handles with a custom collector...\n");
+	Json::Value j;
+	j["handles"] = Json::objectValue;
+	Collection c(j);
+	c.addCollector(new HandleCollector(j, "handles"));
+	bool result = c.initialize({"handles"});
+	assert(result);
+	c.start();
+	for (int i = 0; i < 3; i++)
+	{
+		c.collect();
+	}
+	c.stop();
+	Json::Value results = c.results();
+	assert(results["handles"]["count"].size() == 3);
+	assert(results["handles"]["count"][2].asInt() == 3);
+	assert(results["handles"]["half"][1].asDouble() == 1.0);
+	assert(!results["handles"].isMember("never_sampled"));
+	Json::Value handles;
+	result = c.results("handles", handles);
+	assert(result && handles == results["handles"]);
+	result = c.results("ferret", handles); // not running
+	assert(!result);
+}
+
+static void test10()
+{
+	printf("[test 10]: Testing chunked value storage...\n");
+	CollectorValueList wide;
+	CollectorValueList narrow;
+	narrow.compact = true;
+	const int count = 3 * CollectorColumn<uint64_t>::CHUNK_VALUES + 17; // cross several chunk boundaries
+	for (int i = 0; i < count; i++)
+	{
+		wide.push_back((long)i * 1000000000L);
+		narrow.push_back(-i);
+	}
+	assert(wide.size() == (size_t)count && narrow.size() == (size_t)count);
+	assert(wide.at(count - 1).i64 == (int64_t)(count - 1) * 1000000000L);
+	assert(narrow.at(4097).i64 == -4097);
+	int64_t expected = 0;
+	bool ordered = true;
+	narrow.for_each([&](CollectorValue v) { ordered = ordered && v.i64 == expected--; });
+	assert(ordered);
+	narrow.summarize();
+	assert(narrow.size() == 0 && narrow.summaries.size() == 1);
+	assert(narrow.summaries[0].i64 == -(count - 1) / 2);
+}
+
+static void test11()
+{
+	printf("[test 11]: Testing the central sampling scheduler...\n");
+	Json::Value j;
+	Json::Value v;
+	v["threaded"] = true;
+	v["sample_rate"] = 2;
+	j["procfs"] = v;
+	v["sample_rate"] = 4; // runs on every other tick
+	j["rusage"] = v;
+	j["central_scheduler"] = true;
+	Collection c(j);
+	bool result = c.initialize();
+	assert(result);
+	c.start();
+	for (int i = 0; i < 5; i++)
+	{
+		usleep(20000);
+		c.collect();
+	}
+	c.stop();
+	Json::Value results = c.results();
+	Json::StyledWriter writer;
+	printf("Scheduler:\n%s", writer.write(results["scheduler"]).c_str());
+	assert(results["scheduler"]["tick_us"].asInt() == 2000);
+	assert(results["scheduler"]["ticks"].asInt() > 0);
+	assert(results["scheduler"]["jitter_avg_us"].asDouble() >= 0.0);
+	assert(results["procfs"]["threads"].size() == 5);
+	assert(results["rusage"]["UserCPUTime"].size() == 5);
+
+	// Without threaded collectors nothing is scheduled, so there are no statistics to give
+	Json::Value unthreaded;
+	unthreaded["procfs"] = Json::objectValue;
+	unthreaded["central_scheduler"] = true;
+	Collection d(unthreaded);
+	result = d.initialize({ "procfs" });
+	assert(result);
+	d.start();
+	d.collect();
+	d.stop();
+	assert(!d.results().isMember("scheduler"));
+}
+
+class BusyCollector : public Collector
+{
+public:
+	using Collector::Collector;
+
+	virtual bool init() override { mBusy = registerMetric("busy"); return true; }
+	virtual bool collect(int64_t) override { add(mBusy, busy ? 1.0 : 0.0); return true; }
+	virtual bool available() override { return true; }
+
+	std::atomic<bool> busy{false};
+
+private:
+	MetricHandle mBusy = -1;
+};
+
+static void test12()
+{
+	printf("[test 12]: Testing timestamp based frame attribution of threaded samples...\n");
+	Json::Value j;
+	j["busy"] = Json::objectValue;
+	Collection c(j);
+	BusyCollector* busy = new BusyCollector(j, "busy");
+	busy->useThreading(1);
+	c.addCollector(busy);
+	bool result = c.initialize({"busy"});
+	assert(result);
+	c.start();
+	usleep(30000); // short frame
+	c.collect();
+	busy->busy = true;
+	usleep(100000); // long frame, would get most of the samples with uniform attribution
+	busy->busy = false;
+	c.collect();
+	usleep(30000);
+	c.collect();
+	c.stop();
+	Json::Value results = c.results();
+	printf("busy per frame: %f %f %f\n", results["busy"]["busy"][0].asDouble(), results["busy"]["busy"][1].asDouble(),
+	       results["busy"]["busy"][2].asDouble());
+	assert(results["busy"]["busy"].size() == 3);
+	assert(results["busy"]["busy"][0].asDouble() < 0.25);
+	assert(results["busy"]["busy"][1].asDouble() > 0.8);
+	assert(results["busy"]["busy"][2].asDouble() < 0.25);
+}
+
+static std::string readFile(const std::string& filename)
+{
+	FILE* fp = fopen(filename.c_str(), "r");
+	assert(fp);
+	std::string data;
+	char buf[4096];
+	size_t len;
+	while ((len = fread(buf, 1, sizeof(buf), fp)) > 0) data.append(buf, len);
+	fclose(fp);
+	return data;
+}
+
+static void test13()
+{
+	printf("[test 13]: Testing online statistics...\n");
+	CollectorStats stats;
+	for (int i = 1; i <= 1000; i++)
+	{
+		stats.add((double)i);
+	}
+	assert(stats.count() == 1000 && stats.mean() == 500.5);
+	assert(fabs(stats.stddev() - 288.8194) < 0.001);
+	assert(stats.min() == 1.0 && stats.max() == 1000.0);
+	assert(fabs(stats.quantile(0.5) - 500.0) < 500.0 * 0.01 + 1.0);
+	assert(fabs(stats.quantile(0.99) - 990.0) < 990.0 * 0.01 + 1.0);
+
+	Json::Value j;
+	j["handles"]["online_stats"] = true;
+	Collection c(j);
+	c.addCollector(new HandleCollector(j, "handles"));
+	bool result = c.initialize({"handles"});
+	assert(result);
+	for (int loop = 0; loop < 2; loop++)
+	{
+		c.start();
+		for (int i = 0; i < 100; i++)
+		{
+			c.collect();
+		}
+		c.stop();
+		c.summarize();
+	}
+	assert(c.collector("handles")->results().at("count").size() == 0); // no samples kept
+	result = c.writeCSV("test13.csv");
+	assert(result);
+	assert(readFile("test13.csv").find("handles:count") == std::string::npos); // nothing to write per frame
+	Json::Value results = c.results();
+	Json::StyledWriter writer;
+	printf("Stats:\n%s", writer.write(results["handles"]["stats"]["count"]).c_str());
+	assert(results["handles"]["count"].size() == 2);
+	assert(results["handles"]["stats"]["count"]["count"][0].asInt() == 100);
+	assert(results["handles"]["stats"]["count"]["min"][1].asDouble() == 101.0);
+	assert(results["handles"]["stats"]["count"]["max"][1].asDouble() == 200.0);
+	assert(fabs(results["handles"]["stats"]["half"]["mean"][0].asDouble() - 25.25) < 1e-9);
+	assert(results["timing"]["stats"]["p90"].size() == 2);
+}
+
+static void test14()
+{
+	printf("[test 14]: Testing spilling samples to disk...\n");
+	Json::Value j;
+	j["handles"] = Json::objectValue;
+	j["spill_file"] = "test14.spill";
+	j["spill_budget"] = 16384; // less than one chunk, so the writer must keep up
+	Collection c(j);
+	c.addCollector(new HandleCollector(j, "handles"));
+	bool result = c.initialize({"handles"});
+	assert(result);
+	c.start();
+	const int count = 3 * CollectorColumn<uint64_t>::CHUNK_VALUES + 5;
+	for (int i = 0; i < count; i++)
+	{
+		c.collect();
+	}
+	c.stop();
+	assert(access("test14.spill", F_OK) != 0); // removed once opened
+	Json::Value results = c.results();
+	assert(results["handles"]["count"].size() == (unsigned)count);
+	bool ordered = true;
+	for (int i = 0; i < count; i++)
+	{
+		ordered = ordered && results["handles"]["count"][i].asInt() == i + 1;
+	}
+	assert(ordered);
+	assert(results["handles"]["half"][5000].asDouble() == 5001 / 2.0);
+
+	// a later capture starts the spill file over, so it does not grow from one capture to the next
+	c.start();
+	for (int i = 0; i < count; i++)
+	{
+		c.collect();
+	}
+	c.stop();
+	results = c.results();
+	assert(results["handles"]["count"].size() == (unsigned)count);
+	ordered = true;
+	for (int i = 0; i < count; i++)
+	{
+		ordered = ordered && results["handles"]["count"][i].asInt() == count + i + 1;
+	}
+	assert(ordered);
+	c.summarize();
+	assert(c.results()["handles"]["count"][0].asInt() == count + (count + 1) / 2);
+
+	CollectorSpill spill;
+	result = spill.open("test14b.spill", 16384);
+	assert(result);
+	const int64_t first = spill.write(std::vector<uint64_t>(10, 1));
+	const int64_t second = spill.write(std::vector<uint64_t>(10, 2));
+	spill.reset();
+	const int64_t reused = spill.write(std::vector<uint64_t>(10, 3));
+	uint64_t back[10] = {};
+	result = spill.read(reused, back, sizeof(back));
+	assert(result);
+	assert(first == 0 && second == 80);
+	assert(reused == 0);
+	assert(back[9] == 3);
+}
+
+static void test15()
+{
+	printf("[test 15]: Testing the binary trace file...\n");
+	Json::Value j;
+	j["handles"] = Json::objectValue;
+	j["trace_file"] = "test15.trace";
+	j["trace_flush_frames"] = 10;
+	j["provenance"]["info"] = "test";
+	Collection c(j);
+	c.addCollector(new HandleCollector(j, "handles"));
+	bool result = c.initialize({"handles"});
+	assert(result);
+	c.start({ "custom" });
+	for (int i = 0; i < 25; i++)
+	{
+		c.collect({ i });
+	}
+	CollectorTraceReader partial; // as if the process had died here
+	result = partial.open("test15.trace");
+	assert(result);
+	assert(partial.results()["handles"]["count"].size() == 20);
+	c.stop();
+	CollectorTraceReader reader;
+	result = reader.open("test15.trace");
+	assert(result);
+	Json::Value expected = c.results();
+	Json::Value actual = reader.results();
+	assert(actual["handles"] == expected["handles"]);
+	assert(actual["timing"]["time"] == expected["timing"]["time"]);
+	assert(actual["custom"]["custom"] == expected["custom"]["custom"]);
+	assert(actual["provenance"] == expected["provenance"]);
+	result = reader.writeCSV("test15.csv") && reader.writeCSV_MTV("test15_mtv.csv");
+	assert(result);
+
+	// Threaded collectors are written as samples while running, and mapped onto frames on reading
+	Json::Value t;
+	t["handles"]["threaded"] = true;
+	t["handles"]["sample_rate"] = 1;
+	t["trace_file"] = "test15_threaded.trace";
+	t["trace_flush_frames"] = 10;
+	Collection threaded(t);
+	threaded.addCollector(new HandleCollector(t, "handles"));
+	result = threaded.initialize({"handles"});
+	assert(result);
+	threaded.start();
+	for (int i = 0; i < 25; i++)
+	{
+		usleep(2000);
+		threaded.collect();
+	}
+	CollectorTraceReader running;
+	result = running.open("test15_threaded.trace");
+	assert(result);
+	assert(running.results()["handles"]["count"].size() == 20);
+	assert(running.results()["handles"]["count"][19].asInt() > 0);
+	threaded.stop();
+	CollectorTraceReader stopped;
+	result = stopped.open("test15_threaded.trace");
+	assert(result);
+	assert(stopped.results()["handles"] == threaded.results()["handles"]);
+	assert(stopped.results()["sample_times"].isNull());
+
+	TraceHeader header; // a metric record too short to hold its id and type must be rejected
+	FILE* fp = fopen("test15.trace", "rb");
+	assert(fp);
+	result = fread(&header, sizeof(header), 1, fp) == 1;
+	assert(result);
+	fclose(fp);
+	const TraceRecord truncated = { TRACE_METRIC, 4 };
+	const uint8_t payload[8] = {};
+	header.committed = sizeof(header) + sizeof(truncated) + sizeof(payload);
+	fp = fopen("test15_corrupt.trace", "wb");
+	assert(fp);
+	fwrite(&header, sizeof(header), 1, fp);
+	fwrite(&truncated, sizeof(truncated), 1, fp);
+	fwrite(payload, sizeof(payload), 1, fp);
+	fclose(fp);
+	CollectorTraceReader corrupt;
+	result = corrupt.open("test15_corrupt.trace");
+	assert(!result);
+
+	// A file that cannot grow, as on a full disk, stops the trace instead of crashing on a write
+	struct rlimit limit;
+	getrlimit(RLIMIT_FSIZE, &limit);
+	const struct rlimit small = { 3 * 1024 * 1024 / 2, limit.rlim_max };
+	setrlimit(RLIMIT_FSIZE, &small);
+	signal(SIGXFSZ, SIG_IGN);
+	CollectorTraceWriter writer;
+	result = writer.open("test15_full.trace");
+	assert(result);
+	const uint32_t id = writer.defineMetric("handles", "count", CollectorValueList::TYPE_I64);
+	const std::vector<int64_t> values(256 * 1024, 1);
+	writer.writeChunk(id, values, 0, 100);
+	writer.commit();
+	writer.writeChunk(id, values, 0, values.size());
+	assert(!writer.isOpen());
+	writer.writeChunk(id, values, 0, 100); // ignored
+	setrlimit(RLIMIT_FSIZE, &limit);
+	signal(SIGXFSZ, SIG_DFL);
+	CollectorTraceReader full;
+	result = full.open("test15_full.trace");
+	assert(result);
+	assert(full.metrics().size() == 1 && full.metrics()[0].values.size() == 100);
+}
+
+static void test16()
+{
+	printf("[test 16]: Testing streamed JSON output...\n");
+	char text[FORMAT_MAX_CHARS];
+	formatDouble(text, 0.1);
+	assert(strcmp(text, "0.1") == 0);
+	formatDouble(text, 45.2);
+	assert(strcmp(text, "45.2") == 0);
+	formatDouble(text, 2.0);
+	assert(strcmp(text, "2.0") == 0);
+	formatDouble(text, -3.0);
+	assert(strcmp(text, "-3.0") == 0);
+	formatDouble(text, -0.0);
+	assert(strcmp(text, "-0.0") == 0);
+	formatDouble(text, 1e20);
+	assert(strtod(text, nullptr) == 1e20);
+	formatDouble(text, 1.0 / 3.0);
+	assert(strtod(text, nullptr) == 1.0 / 3.0);
+	formatInt(text, INT64_MIN);
+	assert(strcmp(text, "-9223372036854775808") == 0);
+	formatUInt(text, UINT64_MAX);
+	assert(strcmp(text, "18446744073709551615") == 0);
+
+	Json::Value j;
+	j["handles"] = Json::objectValue;
+	j["provenance"]["info"] = "test \"quoted\"";
+	Collection c(j);
+	c.addCollector(new HandleCollector(j, "handles"));
+	bool result = c.initialize({"handles"});
+	assert(result);
+	c.start({ "custom" });
+	for (int i = 0; i < 100; i++)
+	{
+		c.collect({ -i });
+	}
+	c.stop();
+	result = c.writeJSON("test16.json");
+	assert(result);
+	Json::Value streamed;
+	Json::Value expected;
+	Json::Reader reader;
+	FILE* fp = fopen("test16.json", "r");
+	std::string data;
+	char buf[4096];
+	size_t len;
+	while ((len = fread(buf, 1, sizeof(buf), fp)) > 0) data.append(buf, len);
+	fclose(fp);
+	result = reader.parse(data, streamed);
+	assert(result);
+	Json::StyledWriter writer;
+	result = reader.parse(writer.write(c.results()), expected);
+	assert(result);
+	assert(streamed == expected);
+}
+
+// Misses every third sample, as a collector does when its file fails to read
+class SkippingCollector : public HandleCollector
+{
+public:
+	using HandleCollector::HandleCollector;
+	virtual bool collect(int64_t now) override { return ++mCalls % 3 == 0 ? false : HandleCollector::collect(now); }
+
+private:
+	int mCalls = 0;
+};
+
+static void test17()
+{
+	printf("[test 17]: Testing CSV output...\n");
+	std::string text;
+	CsvLine line(text);
+	line.field(int64_t(-3));
+	line.field(uint64_t(7));
+	line.field(0.25);
+	line.field(45.2); // no more digits than it takes to read back the same value
+	line.end();
+	assert(text == "-3, 7, 0.25, 45.2\n");
+
+	std::string outputs[2];
+	for (int run = 0; run < 2; run++)
+	{
+		Json::Value j;
+		j["handles"] = Json::objectValue;
+		j["csv_threads"] = run == 0 ? 1 : 4;
+		Collection c(j);
+		c.addCollector(new HandleCollector(j, "handles"));
+		bool result = c.initialize({"handles"});
+		assert(result);
+		c.start({ "custom" });
+		for (int i = 0; i < 3 * 4096 + 11; i++) // several blocks of rows
+		{
+			c.collect({ i });
+		}
+		c.stop();
+		result = c.writeCSV("test17.csv") && c.writeCSV_MTV("test17_mtv.csv");
+		assert(result);
+		// frame times differ between runs, so drop the first column of the CSV and the frame time
+		// line of the MTV CSV before comparing
+		std::string csv = readFile("test17.csv");
+		for (size_t pos = 0; pos < csv.size(); pos = csv.find('\n', pos) + 1)
+		{
+			outputs[run] += csv.substr(csv.find(", ", pos), csv.find('\n', pos) + 1 - csv.find(", ", pos));
+		}
+		std::string mtv = readFile("test17_mtv.csv");
+		outputs[run] += mtv.substr(0, mtv.find("frametime")) + mtv.substr(mtv.find("\ncustom"));
+	}
+	const std::string start = ", custom, handles:count, handles:half\n, 0, 1, 0.5\n";
+	assert(outputs[0].compare(0, start.size(), start) == 0);
+	assert(outputs[0].find(", 4096, 4097, 2048.5\n") != std::string::npos);
+	assert(outputs[0].find("handles, half, 0.5, 1.0, 1.5, ") != std::string::npos);
+	assert(outputs[0] == outputs[1]);
+
+	// A collector with fewer values than frames leaves its columns empty on the last rows
+	Json::Value j;
+	j["handles"] = Json::objectValue;
+	j["skipping"] = Json::objectValue;
+	Collection c(j);
+	c.addCollector(new HandleCollector(j, "handles"));
+	c.addCollector(new SkippingCollector(j, "skipping"));
+	bool result = c.initialize({"handles", "skipping"});
+	assert(result);
+	c.start();
+	for (int i = 0; i < 5; i++)
+	{
+		c.collect();
+	}
+	c.stop();
+	result = c.writeCSV("test17_skipping.csv");
+	assert(result);
+	const std::string csv = readFile("test17_skipping.csv");
+	assert(std::count(csv.begin(), csv.end(), '\n') == 6);
+	const std::string last = ", 5, 2.5, , \n";
+	assert(csv.compare(csv.size() - last.size(), last.size(), last) == 0);
+}
+
+static int test18Created = 0;
+
+class CountedCollector : public HandleCollector
+{
+public:
+	CountedCollector(const Json::Value& config, const std::string& name) : HandleCollector(config, name) { test18Created++; }
+};
+
+static void test18()
+{
+	printf("[test 18]: Testing lazy collector construction...\n");
+	Json::Value j;
+	j["counted"] = Json::objectValue;
+	Collection c(j);
+	c.registerCollector<CountedCollector>("counted");
+	c.registerCollector<CountedCollector>("unused");
+	assert(test18Created == 0); // nothing is created until needed
+	assert(c.collector("no_such_collector") == nullptr);
+	bool result = c.initialize();
+	assert(result);
+	assert(test18Created == 1); // only the configured one
+	assert(c.collector("counted") == c.collector("counted"));
+	assert(test18Created == 1);
+	c.start();
+	c.collect();
+	c.stop();
+	assert(c.results()["counted"]["count"].size() == 1);
+	std::vector<std::string> list = c.available(); // creates everything to check it
+	assert(std::find(list.begin(), list.end(), "unused") != list.end());
+	assert(test18Created == 2);
+}
+
+static void test19()
+{
+	printf("[test 19]: Testing overhead measurement...\n");
+	Json::Value j;
+	j["measure_overhead"] = true;
+	j["handles"] = Json::objectValue;
+	j["sampled"]["threaded"] = true;
+	j["sampled"]["sample_rate"] = 1;
+	Collection c(j);
+	c.addCollector(new HandleCollector(j, "handles"));
+	c.addCollector(new HandleCollector(j, "sampled"));
+	bool result = c.initialize();
+	assert(result);
+	c.start();
+	for (int i = 0; i < 100; i++)
+	{
+		c.collect();
+		c.collect_scope_start(0, 0, 0);
+		c.collect_scope_stop(0, 0, 0);
+	}
+	usleep(20000);
+	c.stop();
+	c.writeCSV("test19.csv");
+	Json::Value results = c.results();
+	const Json::Value& overhead = results["libcollector_overhead"];
+	const Json::Value& handles = overhead["collectors"]["handles"];
+	assert(handles["collect_calls"].asInt() == 100);
+	assert(handles["collect_latency_us"]["count"].asInt() == 100);
+	assert(handles["scope_calls"].asInt() == 200);
+	assert(handles["heap_bytes"].asUInt64() > 0);
+	assert(!handles.isMember("thread_cpu_us"));
+	const Json::Value& threaded = overhead["collectors"]["sampled"];
+	assert(threaded["collect_calls"].asInt() > 0);
+	assert(threaded.isMember("thread_cpu_us"));
+	assert(overhead["csv_write_us"].asDouble() > 0.0);
+	assert(overhead.isMember("file_read_us")); // files read for all collectors at once
+	assert(overhead["heap_bytes"].asUInt64() >= handles["heap_bytes"].asUInt64());
+
+	Json::Value off;
+	off["handles"] = Json::objectValue;
+	Collection plain(off);
+	plain.addCollector(new HandleCollector(off, "handles"));
+	plain.initialize();
+	plain.start();
+	plain.collect();
+	plain.stop();
+	assert(!plain.results().isMember("libcollector_overhead")); // only when asked for
+}
+
+static int removeTreeEntry(const char* path, const struct stat*, int, struct FTW*)
+{
+	return remove(path);
+}
+
+// Remove a directory and everything in it
+static void removeTree(const std::string& root)
+{
+	nftw(root.c_str(), removeTreeEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+// A temporary file tree for collectors to read under the sysroot. Going out of scope resets the
+// sysroot and removes the tree.
+class FakeTree
+{
+public:
+	explicit FakeTree(const std::string& name) : mRoot("/tmp/libcollector_" + name + ".XXXXXX")
+	{
+		const bool created = mkdtemp(&mRoot[0]) != nullptr;
+		assert(created);
+	}
+	~FakeTree()
+	{
+		setCollectorSysroot("");
+		removeTree(mRoot);
+	}
+
+	const std::string& root() const { return mRoot; }
+
+	/// A collection config that reads from the tree
+	Json::Value config() const
+	{
+		Json::Value j;
+		j["sysroot"] = mRoot;
+		return j;
+	}
+
+	/// Write a file in the tree, making directories as needed
+	void write(const std::string& relative, const std::string& contents) const
+	{
+		for (size_t pos = relative.find('/', 1); pos != std::string::npos; pos = relative.find('/', pos + 1))
+		{
+			mkdir((mRoot + relative.substr(0, pos)).c_str(), 0700);
+		}
+		FILE* fp = fopen((mRoot + relative).c_str(), "w");
+		const bool opened = fp != nullptr;
+		assert(opened);
+		if (!opened) return;
+		fwrite(contents.data(), 1, contents.size(), fp);
+		fclose(fp);
+	}
+
+private:
+	std::string mRoot;
+};
+
+// Files to write in a fake tree, as paths under its root and their contents, in order
+typedef std::vector<std::pair<std::string, std::string>> FakeFiles;
+
+// A capture of collectors reading a fake tree, for the tests of each collector. The collection is
+// initialized at the first start(), and each sample can first change files in the tree.
+class CollectorTest
+{
+public:
+	CollectorTest(const std::string& test, const FakeFiles& files, const std::string& collector, const Json::Value& config = Json::objectValue)
+		: tree(test), mConfig(tree.config()), mCollector(collector)
+	{
+		write(files);
+		add(collector, config);
+	}
+
+	/// Add another collector to the capture, before the first start()
+	void add(const std::string& collector, const Json::Value& config)
+	{
+		assert(!mCollection);
+		mConfig[collector] = config;
+	}
+
+	/// Write files in the tree
+	void write(const FakeFiles& files) const
+	{
+		for (const auto& file : files)
+		{
+			tree.write(file.first, file.second);
+		}
+	}
+
+	void start()
+	{
+		if (!mCollection)
+		{
+			mCollection.reset(new Collection(mConfig));
+			const bool initialized = mCollection->initialize();
+			assert(initialized);
+		}
+		mCollection->start();
+	}
+
+	/// Write files in the tree, then take a sample
+	void collect(const FakeFiles& changes = FakeFiles())
+	{
+		write(changes);
+		mCollection->collect();
+	}
+
+	void stop() { mCollection->stop(); }
+	void summarize() { mCollection->summarize(); }
+
+	/// The results of a collector of the last capture, by default the one the test was made for
+	Json::Value results(const std::string& collector = std::string())
+	{
+		return mCollection->results()[collector.empty() ? mCollector : collector];
+	}
+
+	FakeTree tree;
+
+private:
+	Json::Value mConfig;
+	std::string mCollector;
+	std::unique_ptr<Collection> mCollection;
+};
+
+static void test20()
+{
+	printf("[test 20]: Testing collectors reading a recorded tree under a sysroot...\n");
+	FakeTree tree("test20");
+	tree.write("/sys/class/devfreq/exynos5-busfreq-mif/cur_freq", "800000\n");
+
+	Json::Value j = tree.config();
+	j["memfreq"] = Json::objectValue;
+	Collection c(j);
+	assert(sysPath("/sys/class/devfreq") == tree.root() + "/sys/class/devfreq");
+	assert(sysPath("relative") == "relative");
+	bool result = c.initialize();
+	assert(result);
+	c.start();
+	c.collect();
+	c.collect();
+	c.stop();
+	Json::Value results = c.results();
+	assert(results["memfreq"]["memfreq"].size() == 2);
+	assert(results["memfreq"]["memfreq"][0].asInt() == 800000);
+	assert(results["memfreq"]["memfreq"][1].asInt() == 800000);
+}
+
+static void test21()
+{
+	printf("[test 21]: Testing batched reading of sysfs files...\n");
+	FakeTree tree("test21");
+	std::vector<std::string> files;
+	for (int i = 0; i < 4; i++)
+	{
+		const std::string name = "/file" + std::to_string(i);
+		tree.write(name, std::to_string(i * 1000) + "\n");
+		files.push_back(tree.root() + name);
+	}
+	std::string big(3000, 'x'); // more than the reader asks for
+	tree.write("/file3", big);
+
+	SysReader a;
+	SysReader b;
+	const int missing = a.add(tree.root() + "/missing");
+	assert(missing == -1);
+	const int a0 = a.add(files[0], 16);
+	const int a1 = a.add(files[1], 16);
+	const int b0 = b.add(files[2], 16);
+	const int b1 = b.add(files[3], 16);
+	assert(a.files() == 2 && b.files() == 2);
+	bool result = a.read();
+	assert(result);
+	assert(std::string(a.data(a0)) == "0\n" && a.length(a1) == 5);
+
+	SysReadBatch::setCountSyscalls(true);
+	for (bool uring : { true, false })
+	{
+		SysReadBatch::setUringEnabled(uring);
+		SysReadBatch batch;
+		std::vector<SysReader*> readers = { &a, &b };
+		for (int i = 0; i < 3; i++)
+		{
+			batch.read(readers);
+			if (!uring) assert(!batch.usingUring());
+			const uint64_t before = SysReadBatch::syscalls();
+			result = a.read() && b.read(); // already read by the batch
+			assert(result);
+			assert(SysReadBatch::syscalls() == before);
+			assert(std::string(a.data(a1)) == "1000\n");
+			assert(std::string(b.data(b0)) == "2000\n");
+			assert(b.data(b1) == big && b.length(b1) == (ssize_t)big.size());
+			batch.finish();
+		}
+		printf("\tio_uring %s: %s\n", uring ? "enabled" : "disabled", batch.usingUring() ? "used" : "not used");
+	}
+	SysReadBatch::setUringEnabled(false);
+	const uint64_t counted = SysReadBatch::syscalls();
+	result = a.read();
+	assert(result);
+	assert(SysReadBatch::syscalls() == counted + 2);
+	SysReadBatch::setCountSyscalls(false);
+
+	// Unused contents of a batch are not taken for a later sample
+	SysReadBatch batch;
+	std::vector<SysReader*> readers = { &a };
+	batch.read(readers);
+	batch.finish();
+	tree.write("/file0", "42\n");
+	result = a.read();
+	assert(result);
+	assert(std::string(a.data(a0)) == "42\n");
+
+	a.remove(a0);
+	assert(a.files() == 1);
+	result = a.read();
+	assert(result && std::string(a.data(a1)) == "1000\n");
+	const int reused = a.add(files[2]);
+	assert(reused == a0); // slots are reused
+
+	a.clear();
+	b.clear();
+}
+
+static void test22()
+{
+	printf("[test 22]: Testing the config-driven sysfs collector...\n");
+	CounterDelta d;
+	const uint64_t first = d.update(100);
+	const uint64_t grown = d.update(150);
+	const uint64_t reset = d.update(10);
+	const uint64_t high = d.update(UINT32_MAX - 5);
+	const uint64_t wrapped = d.update(4);
+	assert(first == 0);
+	assert(grown == 50);
+	assert(reset == 10);
+	assert(high == UINT32_MAX - 15);
+	assert(wrapped == 10); // at 32 bits
+	CounterDelta d12(12);
+	d12.update(4090);
+	const uint64_t wrapped12 = d12.update(6);
+	assert(wrapped12 == 12);
+
+	FakeTree tree("test22");
+	tree.write("/sys/class/thermal/thermal_zone0/temp", "45000\n");
+	tree.write("/sys/class/thermal/thermal_zone1/temp", "50500\n");
+	tree.write("/proc/meminfo", "MemTotal:        1000 kB\nMemFree:          400 kB\n");
+	tree.write("/proc/stat", "cpu  10 20 30 40\ncpu0 1 2 3 4\n");
+	tree.write("/sys/gpu/busy", "load: 17 %\n");
+
+	Json::Value j = tree.config();
+	Json::Value& metrics = j["sysfs"]["metrics"];
+	metrics[0]["name"] = "temp";
+	metrics[0]["path"] = "/sys/class/thermal/thermal_zone*/temp";
+	metrics[0]["scale"] = 0.001;
+	metrics[1]["name"] = "memfree";
+	metrics[1]["path"] = "/proc/meminfo";
+	metrics[1]["format"] = "key";
+	metrics[1]["key"] = "MemFree";
+	metrics[2]["name"] = "system";
+	metrics[2]["path"] = "/proc/stat";
+	metrics[2]["format"] = "column";
+	metrics[2]["column"] = 3;
+	metrics[2]["mode"] = "delta";
+	metrics[3]["name"] = "cpu0_user_rate";
+	metrics[3]["path"] = "/proc/stat";
+	metrics[3]["format"] = "column";
+	metrics[3]["line"] = 1;
+	metrics[3]["column"] = 1;
+	metrics[3]["mode"] = "rate";
+	metrics[4]["name"] = "gpu_load";
+	metrics[4]["path"] = "/sys/gpu/busy";
+	metrics[4]["format"] = "match";
+	metrics[4]["pattern"] = "load: %";
+	Collection c(j);
+	bool result = c.initialize({ "sysfs" });
+	assert(result);
+	c.start(); // reads the counters once
+	usleep(10000);
+	tree.write("/proc/stat", "cpu  10 20 35 40\ncpu0 101 2 3 4\n");
+	c.collect();
+	c.collect(); // nothing changed
+	c.stop();
+	Json::Value results = c.results();
+	const Json::Value& r = results["sysfs"];
+	assert(r["temp_thermal_zone0"][1].asDouble() == 45.0);
+	assert(r["temp_thermal_zone1"][1].asDouble() == 50.5);
+	assert(r["memfree"][0].asInt() == 400);
+	assert(r["system"][0].asInt() == 5 && r["system"][1].asInt() == 0);
+	assert(r["cpu0_user_rate"][0].asDouble() > 0.0 && r["cpu0_user_rate"][0].asDouble() <= 100.0 / 0.01);
+	assert(r["cpu0_user_rate"][1].asDouble() == 0.0);
+	assert(r["gpu_load"][1].asInt() == 17);
+
+	// A new capture starts its differences again, rather than covering the time in between
+	tree.write("/proc/stat", "cpu  10 20 50 40\ncpu0 151 2 3 4\n");
+	c.start();
+	c.collect();
+	c.stop();
+	results = c.results();
+	assert(results["sysfs"]["system"][0].asInt() == 0);
+	assert(results["sysfs"]["cpu0_user_rate"][0].asDouble() == 0.0);
+
+	// Configuration mistakes are reported rather than collected as zeroes
+	Json::Value bad = tree.config();
+	bad["sysfs"]["required"] = true;
+	bad["sysfs"]["metrics"][0]["name"] = "memfree";
+	bad["sysfs"]["metrics"][0]["path"] = "/proc/meminfo";
+	bad["sysfs"]["metrics"][0]["format"] = "yaml";
+	Collection b(bad);
+	result = b.initialize({ "sysfs" });
+	assert(!result);
+}
+
+static void test23()
+{
+	printf("[test 23]: Testing differences and rates of accumulative sysfs counters...\n");
+	Json::Value rate;
+	rate["mode"] = "rate";
+	Json::Value absolute;
+	absolute["mode"] = "absolute";
+	CollectorTest t("test23", {
+		{ "/sys/devices/platform/mali.0/power/runtime_active_time", "1000\n" },
+		{ "/sys/devices/platform/mali.0/power/runtime_suspended_time", "5000\n" },
+		{ "/sys/devices/system/cpu/cpu0/cpufreq/stats/total_trans", "77\n" },
+	}, "gpu_active_time");
+	t.add("gpu_suspended_time", rate);
+	t.add("gpu_utilisation", Json::objectValue);
+	t.add("cpufreqtrans", absolute);
+	t.start(); // the first frame covers the time from here
+	usleep(10000);
+	t.collect({
+		{ "/sys/devices/platform/mali.0/power/runtime_active_time", "1030\n" },
+		{ "/sys/devices/platform/mali.0/power/runtime_suspended_time", "5010\n" },
+	});
+	t.collect(); // nothing changed
+	t.stop();
+	const Json::Value active = t.results()["gpu_active_time"];
+	assert(active.size() == 2);
+	assert(active[0].asInt() == 30 && active[1].asInt() == 0);
+	const Json::Value suspended = t.results("gpu_suspended_time")["gpu_suspended_time"];
+	assert(suspended[0].asDouble() > 0.0 && suspended[0].asDouble() <= 10 / 0.01);
+	assert(suspended[1].asDouble() == 0.0);
+	const Json::Value utilisation = t.results("gpu_utilisation")["gpu_utilisation"];
+	assert(utilisation[0].asDouble() == 0.75);
+	assert(utilisation[1].asDouble() == 0.75); // repeated while the counters stand still
+	assert(t.results("cpufreqtrans")["cpufreqtrans"][1].asInt() == 77);
+}
+
+static void test24()
+{
+	printf("[test 24]: Testing thermal zone discovery...\n");
+	FakeFiles files;
+	const char* zones[][3] = { { "0", "cpu-thermal", "45000" }, { "1", "gpu thermal", "51500" }, { "2", "cpu-thermal", "" }, { "10", "battery", "30000" } };
+	for (const auto& z : zones)
+	{
+		files.emplace_back(std::string("/sys/class/thermal/thermal_zone") + z[0] + "/type", std::string(z[1]) + "\n");
+		files.emplace_back(std::string("/sys/class/thermal/thermal_zone") + z[0] + "/temp", z[2][0] ? std::string(z[2]) + "\n" : "");
+	}
+	files.emplace_back("/sys/class/thermal/cooling_device0/type", "thermal-cpufreq-0\n");
+	files.emplace_back("/sys/class/thermal/cooling_device0/cur_state", "2\n");
+	files.emplace_back("/sys/class/thermal/cooling_device0/max_state", "7\n");
+
+	CollectorTest t("test24", files, "thermal");
+	t.start();
+	t.collect();
+	t.stop();
+	const Json::Value r = t.results();
+	assert(r["temp_cpu-thermal_0"][0].asDouble() == 45.0);
+	assert(r["temp_gpu_thermal"][0].asDouble() == 51.5);
+	assert(r["temp_battery"][0].asDouble() == 30.0);
+	assert(r.isMember("temp_cpu-thermal_2")); // a sensor that is off still has its place
+	assert(r["cooling_thermal-cpufreq-0"][0].asInt() == 2);
+	assert(r["cooling_thermal-cpufreq-0_max"][0].asInt() == 7);
+
+	// A zone that fails to read during the capture repeats its last temperature, which keeps the
+	// statistics of the loop finite
+	Json::Value online;
+	online["online_stats"] = true;
+	CollectorTest failing("test24", {
+		{ "/sys/class/thermal/thermal_zone0/type", "cpu-thermal\n" },
+		{ "/sys/class/thermal/thermal_zone0/temp", "45000\n" },
+	}, "thermal", online);
+	failing.start();
+	failing.collect();
+	failing.collect({ { "/sys/class/thermal/thermal_zone0/temp", "" } });
+	failing.collect({ { "/sys/class/thermal/thermal_zone0/temp", "48000\n" } });
+	failing.stop();
+	failing.summarize();
+	const Json::Value stats = failing.results()["stats"]["temp_cpu-thermal"];
+	assert(stats["count"][0].asInt() == 3);
+	assert(stats["mean"][0].asDouble() == 46.0);
+	assert(stats["min"][0].asDouble() == 45.0);
+	assert(stats["max"][0].asDouble() == 48.0);
+}
+
+static std::string transStat(int time100, int time200)
+{
+	char text[512];
+	snprintf(text, sizeof(text), "     From  :   To\n"
+		"           : 100000000 200000000   time(ms)\n"
+		"* 100000000:         0         4    %8d\n"
+		"  200000000:         3         0    %8d\n"
+		"Total transition : 7\n", time100, time200);
+	return text;
+}
+
+static void test25()
+{
+	printf("[test 25]: Testing devfreq discovery and time-weighted frequencies...\n");
+	std::vector<int64_t> frequencies;
+	std::vector<int64_t> times;
+	assert(parseDevfreqTransStat(transStat(300, 100).c_str(), frequencies, times));
+	assert(frequencies.size() == 2 && frequencies[0] == 100000000 && frequencies[1] == 200000000);
+	assert(times[0] == 300 && times[1] == 100);
+	assert(!parseDevfreqTransStat("Not Supported.\n", frequencies, times));
+
+	const FakeFiles files = {
+		{ "/sys/class/devfreq/13000000.mali/cur_freq", "200000000\n" },
+		{ "/sys/class/devfreq/13000000.mali/trans_stat", transStat(300, 100) },
+		{ "/sys/class/devfreq/17000010.devfreq_mif/cur_freq", "1539000000\n" },
+	};
+	CollectorTest t("test25", files, "devfreq");
+	t.start();
+	// 100 ms at 100 MHz and 300 ms at 200 MHz since the start
+	t.collect({ { "/sys/class/devfreq/13000000.mali/trans_stat", transStat(400, 400) } });
+	// no time passed in the table, so the current frequency is used
+	t.collect();
+	t.stop();
+	const Json::Value r = t.results();
+	assert(r["gpu_13000000.mali"][0].asInt64() == 175000000);
+	assert(r["gpu_13000000.mali"][1].asInt64() == 200000000);
+	assert(r["memory_17000010.devfreq_mif"][0].asInt64() == 1539000000);
+	assert(r["memory_17000010.devfreq_mif"].size() == 2);
+
+	Json::Value filter;
+	filter["devices"].append("mif");
+	CollectorTest filtered("test25", files, "devfreq", filter);
+	filtered.start();
+	filtered.collect();
+	filtered.stop();
+	assert(!filtered.results().isMember("gpu_13000000.mali"));
+	assert(filtered.results().isMember("memory_17000010.devfreq_mif"));
+}
+
+static void test26()
+{
+	printf("[test 26]: Testing cpufreq policies...\n");
+	CollectorTest t("test26", {
+		{ "/sys/devices/system/cpu/cpufreq/policy0/related_cpus", "0 1\n" },
+		{ "/sys/devices/system/cpu/cpufreq/policy0/scaling_cur_freq", "600000\n" },
+		{ "/sys/devices/system/cpu/cpufreq/policy0/stats/time_in_state", "300000 100\n600000 100\n" },
+		{ "/sys/devices/system/cpu/cpufreq/policy2/related_cpus", "2 3\n" },
+		{ "/sys/devices/system/cpu/cpufreq/policy2/scaling_cur_freq", "1800000\n" },
+		// time_in_state that does not change during the first sample, so scaling_cur_freq is read
+		{ "/sys/devices/system/cpu/cpufreq/policy6/related_cpus", "6\n" },
+		{ "/sys/devices/system/cpu/cpufreq/policy6/scaling_cur_freq", "1000000\n" },
+		{ "/sys/devices/system/cpu/cpufreq/policy6/stats/time_in_state", "500000 10\n2000000 10\n" },
+	}, "cpufreq");
+	t.start();
+	// 100 units at 300 MHz and 300 units at 600 MHz since the start
+	t.collect({ { "/sys/devices/system/cpu/cpufreq/policy0/stats/time_in_state", "300000 200\n600000 400\n" } });
+	t.collect(); // unchanged, so the previous average again
+	t.stop();
+	const Json::Value r = t.results();
+	for (const char* name : { "cpu_0", "cpu_1", "cluster_0" })
+	{
+		assert(r[name][0].asInt() == 525000);
+		assert(r[name][1].asInt() == 525000);
+	}
+	assert(r["cpu_2"][0].asInt() == 1800000);
+	assert(r["cpu_3"][0].asInt() == 1800000);
+	assert(r["cluster_2"][0].asInt() == 1800000);
+	assert(r["highest_avg"][0].asInt() == 1800000);
+	assert(!r.isMember("cpu_4"));
+	assert(r["cluster_6"][0].asInt() == 1000000);
+	assert(r["cpu_6"][1].asInt() == 1000000);
+}
+
+static void test27()
+{
+	printf("[test 27]: Testing cpuidle residency...\n");
+	FakeFiles files;
+	for (const char* cpu : { "cpu0", "cpu1" })
+	{
+		const std::string base = std::string("/sys/devices/system/cpu/") + cpu + "/cpuidle/";
+		files.emplace_back(base + "state0/name", "WFI\n");
+		files.emplace_back(base + "state0/time", "1000\n");
+		files.emplace_back(base + "state0/usage", "10\n");
+		files.emplace_back(base + "state1/name", "cpu-sleep\n");
+		files.emplace_back(base + "state1/time", "5000\n");
+		files.emplace_back(base + "state1/usage", "2\n");
+	}
+	files.emplace_back("/sys/devices/system/cpu/cpufreq/policy0/related_cpus", "0 1\n"); // not a core
+
+	CollectorTest t("test27", files, "cpuidle");
+	t.start();
+	// cpu1 was idle for far longer than the sample took
+	t.collect({
+		{ "/sys/devices/system/cpu/cpu1/cpuidle/state1/time", "1000005000\n" },
+		{ "/sys/devices/system/cpu/cpu1/cpuidle/state1/usage", "5\n" },
+	});
+	t.stop();
+	const Json::Value r = t.results();
+	assert(r["cpu_0_WFI"][0].asInt() == 0);
+	assert(r["cpu_0_cpu-sleep"][0].asInt() == 0);
+	assert(r["cpu_1_cpu-sleep"][0].asInt() == 1000000000);
+	assert(r["cpu_1_cpu-sleep_usage"][0].asInt() == 3);
+	assert(r["cpu_0_busy"][0].asDouble() == 1.0);
+	assert(r["cpu_1_busy"][0].asDouble() == 0.0);
+	assert(r["busy"][0].asDouble() == 0.5);
+	assert(r.size() == 11);
+}
+
+static std::string procStat(int user, int idle, bool cpu1Online, int ctxt, int processes, int iowait = 5)
+{
+	char text[1024];
+	int len = snprintf(text, sizeof(text), "cpu  %d 10 30 %d %d 1 2 0 0 0\ncpu0 %d 10 30 %d %d 1 2 0 0 0\n", user, idle, iowait, user, idle, iowait);
+	if (cpu1Online)
+	{
+		len += snprintf(text + len, sizeof(text) - len, "cpu1 %d 0 0 %d 0 0 0 0 0 0\n", user, idle);
+	}
+	snprintf(text + len, sizeof(text) - len, "intr 1234 0 0 0\nctxt %d\nbtime 1700000000\nprocesses %d\nprocs_running 1\n", ctxt, processes);
+	return text;
+}
+
+static void test28()
+{
+	printf("[test 28]: Testing system-wide CPU time from /proc/stat...\n");
+	const long ticks = sysconf(_SC_CLK_TCK);
+	CollectorTest t("test28", { { "/proc/stat", procStat(100, 1000, true, 5000, 300) } }, "cpustat");
+	t.start();
+	t.collect({ { "/proc/stat", procStat(100 + ticks, 1000 + 2 * ticks, true, 5600, 304) } });
+	t.collect({ { "/proc/stat", procStat(100 + 2 * ticks, 1000 + 2 * ticks, false, 5700, 304) } });
+	t.stop();
+	Json::Value r = t.results();
+	assert(r["cpu_user"][0].asInt() == 1000);
+	assert(r["cpu_idle"][0].asInt() == 2000);
+	assert(r["cpu_0_user"][0].asInt() == 1000);
+	assert(r["cpu_0_system"][0].asInt() == 0);
+	assert(r["cpu_1_idle"][0].asInt() == 2000);
+	assert(r["cpu_0_user"][1].asInt() == 1000);
+	assert(r["cpu_1_user"][1].asInt() == 0); // offline
+	assert(r["cpu_1_user"].size() == 2);
+	assert(r["context_switches"][0].asInt() == 600);
+	assert(r["context_switches"][1].asInt() == 100);
+	assert(r["forks"][0].asInt() == 4);
+	assert(r["forks"][1].asInt() == 0);
+
+	// iowait going backwards, from a value that is not near 32-bit wraparound, is not a reset
+	t.write({ { "/proc/stat", procStat(100, 1000, true, 5000, 300, 1000000000) } });
+	t.start();
+	t.collect({ { "/proc/stat", procStat(100 + ticks, 1000, true, 5000, 300, 999999990) } });
+	t.stop();
+	r = t.results();
+	assert(r["cpu_iowait"][0].asInt() == 0);
+	assert(r["cpu_0_iowait"][0].asInt() == 0);
+	assert(r["cpu_0_user"][0].asInt() == 1000);
+}
+
+static void test29()
+{
+	printf("[test 29]: Testing pressure stall information...\n");
+	const std::string memory = "some avg10=0.00 avg60=0.00 avg300=0.00 total=500\nfull avg10=0.00 avg60=0.00 avg300=0.00 total=200\n";
+	Json::Value config;
+	config["cgroup"] = "/sys/fs/cgroup/bench";
+	Json::Value trigger;
+	trigger["resource"] = "memory";
+	trigger["threshold"] = 100000;
+	config["triggers"].append(trigger);
+	CollectorTest t("test29", {
+		{ "/proc/pressure/cpu", "some avg10=1.50 avg60=0.70 avg300=0.10 total=100000\n" }, // an older kernel without "full" for cpu
+		{ "/proc/pressure/memory", memory },
+		{ "/sys/fs/cgroup/bench/io.pressure", "some avg10=12.25 avg60=3.00 avg300=1.00 total=7000\nfull avg10=10.00 avg60=2.00 avg300=0.50 total=6000\n" },
+	}, "psi", config);
+	t.start();
+	assert(readFile(t.tree.root() + "/proc/pressure/memory") == memory); // not a kernel file, so no trigger was written into it
+	t.collect({
+		{ "/proc/pressure/cpu", "some avg10=2.50 avg60=0.90 avg300=0.20 total=125000\n" },
+		{ "/sys/fs/cgroup/bench/io.pressure", "some avg10=12.25 avg60=3.00 avg300=1.00 total=9000\nfull avg10=10.00 avg60=2.00 avg300=0.50 total=7500\n" },
+	});
+	t.stop();
+	const Json::Value r = t.results();
+	assert(r["cpu_some_avg10"][0].asDouble() == 2.5);
+	assert(r["cpu_some_stall"][0].asInt() == 25000);
+	assert(!r.isMember("cpu_full_stall"));
+	assert(r["memory_some_stall"][0].asInt() == 0);
+	assert(r["memory_full_stall"][0].asInt() == 0);
+	assert(!r.isMember("io_some_stall"));
+	assert(r["cgroup_io_some_avg10"][0].asDouble() == 12.25);
+	assert(r["cgroup_io_some_stall"][0].asInt() == 2000);
+	assert(r["cgroup_io_full_stall"][0].asInt() == 1500);
+	assert(!r.isMember("memory_some_trigger"));
+}
+
+static void test30()
+{
+	printf("[test 30]: Testing per-thread scheduler statistics...\n");
+	Json::Value config;
+	config["pid"] = 42;
+	CollectorTest t("test30", {
+		{ "/proc/42/task/42/comm", "game\n" },
+		{ "/proc/42/task/42/schedstat", "1000000 500000 10\n" },
+		{ "/proc/42/task/43/comm", "Render Thread\n" },
+		{ "/proc/42/task/43/schedstat", "2000000 0 4\n" },
+	}, "schedstat", config);
+	t.start();
+	t.collect({
+		{ "/proc/42/task/42/schedstat", "1500000 500000 12\n" },
+		{ "/proc/42/task/43/schedstat", "2000000 3000000 5\n" },
+	});
+	// a new thread, which ran before being seen, and one that exited
+	t.collect({
+		{ "/proc/42/task/44/comm", "worker\n" },
+		{ "/proc/42/task/44/schedstat", "700 300 1\n" },
+		{ "/proc/42/task/43/schedstat", "" },
+	});
+	// a new thread reusing the tid of the one that exited
+	t.collect({
+		{ "/proc/42/task/43/comm", "loader\n" },
+		{ "/proc/42/task/43/schedstat", "100 50 1\n" },
+	});
+	// and the first thread coming back after that one exited too, and exiting again
+	t.collect({ { "/proc/42/task/43/schedstat", "" } });
+	t.collect({
+		{ "/proc/42/task/43/comm", "Render Thread\n" },
+		{ "/proc/42/task/43/schedstat", "900 0 1\n" },
+	});
+	t.collect({ { "/proc/42/task/43/schedstat", "" } });
+	t.stop();
+	Json::Value r = t.results();
+	assert(r["game_42_run_ns"][0].asInt() == 500000);
+	assert(r["game_42_slices"][0].asInt() == 2);
+	assert(r["Render_Thread_43_wait_ns"][0].asInt() == 3000000);
+	assert(r["Render_Thread_43_wait_ns"][1].asInt() == 0);
+	assert(r["Render_Thread_43_wait_ns"].size() == 6);
+	assert(r["Render_Thread_43_wait_ns"][2].asInt() == 0);
+	assert(r["Render_Thread_43_run_ns"].size() == 6);
+	assert(r["Render_Thread_43_run_ns"][3].asInt() == 0);
+	assert(r["Render_Thread_43_run_ns"][4].asInt() == 900);
+	assert(r["Render_Thread_43_run_ns"][5].asInt() == 0);
+	assert(r["worker_44_run_ns"].size() == 6);
+	assert(r["worker_44_run_ns"][0].asInt() == 0);
+	assert(r["worker_44_run_ns"][1].asInt() == 700);
+	assert(r["loader_43_run_ns"].size() == 6);
+	assert(r["loader_43_run_ns"][1].asInt() == 0);
+	assert(r["loader_43_run_ns"][2].asInt() == 100);
+	assert(r["loader_43_run_ns"][4].asInt() == 0);
+	assert(r["run_ns"][0].asInt() == 500000);
+	assert(r["wait_ns"][0].asInt() == 3000000);
+	assert(r["slices"][0].asInt() == 3);
+	assert(r["wait_ns"][1].asInt() == 300);
+	assert(r["wait_ns"][2].asInt() == 50);
+	assert(r["run_ns"][4].asInt() == 900);
+	assert(r["run_ns"].size() == 6);
+
+	// a second capture no longer reports the thread that exited, and picks up the tid being
+	// reused again under an earlier name
+	removeTree(t.tree.root() + "/proc/42/task/43");
+	t.start();
+	t.collect();
+	t.collect({
+		{ "/proc/42/task/43/comm", "loader\n" },
+		{ "/proc/42/task/43/schedstat", "300 0 2\n" },
+	});
+	t.stop();
+	r = t.results();
+	assert(!r.isMember("Render_Thread_43_wait_ns"));
+	assert(r["game_42_run_ns"].size() == 2);
+	assert(r["worker_44_run_ns"].size() == 2);
+	assert(r["loader_43_run_ns"].size() == 2);
+	assert(r["loader_43_run_ns"][0].asInt() == 0);
+	assert(r["loader_43_run_ns"][1].asInt() == 300);
+}
+
+static void test31()
+{
+	printf("[test 31]: Testing process memory from procfs...\n");
+	Json::Value config;
+	config["pss_interval"] = 2;
+	CollectorTest t("test31", {
+		{ "/proc/self/status", "Name:\tgame\nVmPeak:\t  200000 kB\nVmHWM:\t  150000 kB\nVmRSS:\t  120000 kB\nRssAnon:\t   80000 kB\n"
+			"RssFile:\t   39000 kB\nRssShmem:\t    1000 kB\nVmSwap:\t     512 kB\nThreads:\t4\n" },
+		{ "/proc/self/stat", "42 (a (strange) name) S 1 42 42 0 -1 4194560 1000 0 7 0 50 20 0 0 20 0 4 0\n" },
+		{ "/proc/meminfo", "MemTotal:        8000000 kB\nMemFree:          500000 kB\nMemAvailable:    4000000 kB\n" },
+		{ "/proc/self/smaps_rollup", "00400000-7fff0000 ---p 00000000 00:00 0 [rollup]\nRss:              120000 kB\nPss:               90000 kB\nPss_Anon:          80000 kB\n" },
+	}, "memory", config);
+	t.start();
+	t.collect({
+		{ "/proc/self/stat", "42 (a (strange) name) S 1 42 42 0 -1 4194560 1250 0 9 0 50 20 0 0 20 0 4 0\n" },
+		{ "/proc/meminfo", "MemTotal:        8000000 kB\nMemFree:          400000 kB\nMemAvailable:    3900000 kB\n" },
+	});
+	// smaps_rollup is not read for this one
+	t.collect({ { "/proc/self/smaps_rollup", "00400000-7fff0000 ---p 00000000 00:00 0 [rollup]\nRss:              120000 kB\nPss:               95000 kB\n" } });
+	t.collect();
+	t.stop();
+	const Json::Value r = t.results();
+	assert(r["memory_max_rss"][0].asInt() == 150000);
+	assert(r["memory_cur_rss"][0].asInt() == 120000);
+	assert(r["memory_rss_anon"][0].asInt() == 80000);
+	assert(r["memory_rss_file"][0].asInt() == 39000);
+	assert(r["memory_rss_shmem"][0].asInt() == 1000);
+	assert(r["memory_swap"][0].asInt() == 512);
+	assert(r["memory_available"][0].asInt() == 3900000);
+	assert(r["memory_used"][0].asInt() == 100000);
+	assert(r["memory_minor_faults"][0].asInt() == 250);
+	assert(r["memory_major_faults"][0].asInt() == 2);
+	assert(r["memory_minor_faults"][1].asInt() == 0);
+	assert(r["memory_pss"][0].asInt() == 90000);
+	assert(r["memory_pss"][1].asInt() == 90000);
+	assert(r["memory_pss"][2].asInt() == 95000);
+}
+
+// Capture vmstat with the given config over two samples of /proc/vmstat
+static Json::Value vmstatResults(const Json::Value& config)
+{
+	CollectorTest t("test32", { { "/proc/vmstat", "nr_free_pages 1000\npgmajfault 10\npgscan_kswapd 100\npgscan_direct 5\npgsteal_kswapd 90\ncompact_stall 1\ncompact_stall_extra 3\n" } }, "vmstat", config);
+	t.start();
+	t.collect({ { "/proc/vmstat", "nr_free_pages 900\npgmajfault 12\npgscan_kswapd 400\npgscan_direct 5\npgsteal_kswapd 350\ncompact_stall 4\ncompact_stall_extra 3\n" } });
+	// the same counters on other lines, as from a recording of another kernel
+	t.collect({ { "/proc/vmstat", "pgscan_direct 7\npgscan_kswapd 400\nnr_free_pages 950\npgmajfault 12\ncompact_stall 4\npgsteal_kswapd 350\n" } });
+	t.stop();
+	return t.results();
+}
+
+static void test32()
+{
+	printf("[test 32]: Testing reclaim and compaction counters from /proc/vmstat...\n");
+	const Json::Value r = vmstatResults(Json::objectValue);
+	assert(r["pgmajfault"][0].asInt() == 2);
+	assert(r["pgscan_kswapd"][0].asInt() == 300);
+	assert(r["pgsteal_kswapd"][0].asInt() == 260);
+	assert(r["compact_stall"][0].asInt() == 3);
+	assert(r["pgscan_direct"][1].asInt() == 2);
+	assert(!r.isMember("nr_free_pages"));
+	assert(!r.isMember("compact_stall_extra"));
+
+	Json::Value custom;
+	custom["keys"].append("nr_free_pages");
+	custom["keys"].append("pgscan*");
+	const Json::Value r2 = vmstatResults(custom);
+	assert(r2.size() == 3);
+	assert(r2["pgscan_kswapd"][0].asInt() == 300);
+	assert(r2["nr_free_pages"][0].asInt() == 900); // a gauge, so not a difference
+	assert(r2["nr_free_pages"][1].asInt() == 950);
+}
+
+static void test33()
+{
+	printf("[test 33]: Testing the CPU temperature collector...\n");
+	CollectorTest t("test33", { { "/sys/devices/platform/exynos5-tmu/temp", "sensor0 : 450\nsensor1 : 515\n" } }, "cputemp");
+	t.start();
+	t.collect();
+	t.collect({ { "/sys/devices/platform/exynos5-tmu/temp", "sensor0 : 460\nsensor1 : 520\nsensor2 : 300\n" } });
+	t.stop();
+	const Json::Value r = t.results();
+	assert(r["cpu_temperature_0"].size() == 2);
+	assert(r["cpu_temperature_0"][0].asDouble() == 45.0);
+	assert(r["cpu_temperature_1"][1].asDouble() == 52.0);
+	assert(!r.isMember("cpu_temperature_2")); // the metrics are fixed at init
+}
+
 int main()
 {
 	srandom(time(NULL));
@@ -364,6 +1732,31 @@ int main()
 	test7(); // summarized results
 	auto test8 = std::unique_ptr<Test8>(new Test8());
 	test8->run();
+	test9();
+	test10();
+	test11();
+	test12();
+	test13();
+	test14();
+	test15();
+	test16();
+	test17();
+	test18();
+	test19();
+	test20();
+	test21();
+	test22();
+	test23();
+	test24();
+	test25();
+	test26();
+	test27();
+	test28();
+	test29();
+	test30();
+	test31();
+	test32();
+	test33();
 	printf("ALL DONE!\n");
 	return 0;
 }
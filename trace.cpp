@@ -0,0 +1,511 @@
+#include "trace.hpp"
+#include "output.hpp"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+
+#define TRACE_MIN_SIZE (1024 * 1024)
+
+static size_t padded(size_t size)
+{
+    return (size + 7) & ~(size_t)7;
+}
+
+// ---------- WRITER ----------
+
+bool CollectorTraceWriter::open(const std::string& filename)
+{
+    assert(!isOpen());
+    mFD = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (mFD == -1)
+    {
+        DBG_LOG("Failed to open trace file %s: %s\n", filename.c_str(), strerror(errno));
+        return false;
+    }
+    mCapacity = 0;
+    mEnd = 0;
+    mMetrics = 0;
+    if (!grow(TRACE_MIN_SIZE))
+    {
+        return false;
+    }
+    TraceHeader* header = reinterpret_cast<TraceHeader*>(mMap);
+    memset(header, 0, sizeof(TraceHeader));
+    memcpy(header->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    header->version = TRACE_VERSION;
+    mEnd = sizeof(TraceHeader);
+    commit();
+    return true;
+}
+
+void CollectorTraceWriter::close()
+{
+    if (!isOpen())
+    {
+        return;
+    }
+    commit();
+    if (mMap)
+    {
+        munmap(mMap, mCapacity);
+    }
+    mMap = nullptr;
+    mCapacity = 0;
+    if (ftruncate(mFD, mEnd) != 0)
+    {
+        DBG_LOG("Failed to trim trace file: %s\n", strerror(errno));
+    }
+    ::close(mFD);
+    mFD = -1;
+}
+
+bool CollectorTraceWriter::grow(size_t needed)
+{
+    size_t capacity = std::max<size_t>(mCapacity, TRACE_MIN_SIZE);
+    while (capacity < needed)
+    {
+        capacity *= 2;
+    }
+    // Allocate the blocks before mapping them. Writing through the mapping into a hole of a sparse
+    // file raises SIGBUS when the disk fills up, which would kill the application being measured.
+    const int error = posix_fallocate(mFD, mCapacity, capacity - mCapacity);
+    if (error != 0)
+    {
+        DBG_LOG("Failed to grow trace file, stopping the trace: %s\n", strerror(error));
+        close();
+        return false;
+    }
+    if (mMap)
+    {
+        munmap(mMap, mCapacity);
+        mMap = nullptr;
+    }
+    void* map = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, mFD, 0);
+    if (map == MAP_FAILED)
+    {
+        DBG_LOG("Failed to map trace file, stopping the trace: %s\n", strerror(errno));
+        close();
+        return false;
+    }
+    mMap = static_cast<uint8_t*>(map);
+    mCapacity = capacity;
+    return true;
+}
+
+uint8_t* CollectorTraceWriter::reserve(uint32_t kind, size_t size)
+{
+    const size_t total = sizeof(TraceRecord) + padded(size);
+    if (!isOpen() || (mEnd + total > mCapacity && !grow(mEnd + total)))
+    {
+        return nullptr;
+    }
+    TraceRecord* record = reinterpret_cast<TraceRecord*>(mMap + mEnd);
+    record->kind = kind;
+    record->size = size;
+    uint8_t* payload = mMap + mEnd + sizeof(TraceRecord);
+    memset(payload + size, 0, padded(size) - size);
+    mEnd += total;
+    return payload;
+}
+
+void CollectorTraceWriter::commit()
+{
+    if (mMap)
+    {
+        reinterpret_cast<TraceHeader*>(mMap)->committed = mEnd;
+    }
+}
+
+uint32_t CollectorTraceWriter::define(uint32_t kind, const std::string& collector, const std::string& metric, CollectorValueList::vtype type, uint32_t times)
+{
+    const uint32_t id = mMetrics++;
+    const uint32_t vtype = type;
+    const size_t header = kind == TRACE_SAMPLED_METRIC ? 12 : 8;
+    uint8_t* p = reserve(kind, header + collector.size() + 1 + metric.size() + 1);
+    if (p)
+    {
+        memcpy(p, &id, 4);
+        memcpy(p + 4, &vtype, 4);
+        if (kind == TRACE_SAMPLED_METRIC) memcpy(p + 8, &times, 4);
+        memcpy(p + header, collector.c_str(), collector.size() + 1);
+        memcpy(p + header + collector.size() + 1, metric.c_str(), metric.size() + 1);
+    }
+    return id;
+}
+
+uint32_t CollectorTraceWriter::defineMetric(const std::string& collector, const std::string& metric, CollectorValueList::vtype type)
+{
+    return define(TRACE_METRIC, collector, metric, type, 0);
+}
+
+uint32_t CollectorTraceWriter::defineSampledMetric(const std::string& collector, const std::string& metric, CollectorValueList::vtype type, uint32_t times)
+{
+    return define(TRACE_SAMPLED_METRIC, collector, metric, type, times);
+}
+
+void CollectorTraceWriter::writeChunk(uint32_t id, const CollectorValueList& list, size_t first, size_t last)
+{
+    const uint32_t count = last - first;
+    uint8_t* p = reserve(TRACE_CHUNK, 8 + (size_t)count * sizeof(CollectorValue));
+    if (!p)
+    {
+        return;
+    }
+    memcpy(p, &id, 4);
+    memcpy(p + 4, &count, 4);
+    CollectorValue* values = reinterpret_cast<CollectorValue*>(p + 8);
+    for (size_t i = first; i < last; i++)
+    {
+        *values++ = list.at(i);
+    }
+}
+
+void CollectorTraceWriter::writeChunk(uint32_t id, const std::vector<int64_t>& values, size_t first, size_t last)
+{
+    const uint32_t count = last - first;
+    uint8_t* p = reserve(TRACE_CHUNK, 8 + (size_t)count * sizeof(int64_t));
+    if (!p)
+    {
+        return;
+    }
+    memcpy(p, &id, 4);
+    memcpy(p + 4, &count, 4);
+    memcpy(p + 8, values.data() + first, count * sizeof(int64_t));
+}
+
+void CollectorTraceWriter::writeChunk(uint32_t id, const CollectorColumn<int64_t>& times, size_t first, size_t last, int64_t base)
+{
+    const uint32_t count = last - first;
+    uint8_t* p = reserve(TRACE_CHUNK, 8 + (size_t)count * sizeof(int64_t));
+    if (!p)
+    {
+        return;
+    }
+    memcpy(p, &id, 4);
+    memcpy(p + 4, &count, 4);
+    int64_t* values = reinterpret_cast<int64_t*>(p + 8);
+    for (size_t i = first; i < last; i++)
+    {
+        *values++ = times.at(i) - base;
+    }
+}
+
+void CollectorTraceWriter::writeJSON(const std::string& key, const Json::Value& value)
+{
+    Json::FastWriter writer;
+    const std::string text = writer.write(value);
+    uint8_t* p = reserve(TRACE_JSON, key.size() + 1 + text.size());
+    if (p)
+    {
+        memcpy(p, key.c_str(), key.size() + 1);
+        memcpy(p + key.size() + 1, text.data(), text.size());
+    }
+}
+
+// ---------- READER ----------
+
+bool CollectorTraceReader::open(const std::string& filename)
+{
+    mMetrics.clear();
+    mJSON.clear();
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+    {
+        DBG_LOG("Failed to open trace file %s: %s\n", filename.c_str(), strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(TraceHeader))
+    {
+        DBG_LOG("Trace file %s is too short\n", filename.c_str());
+        ::close(fd);
+        return false;
+    }
+    void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        DBG_LOG("Failed to map trace file %s: %s\n", filename.c_str(), strerror(errno));
+        return false;
+    }
+    const uint8_t* data = static_cast<const uint8_t*>(map);
+    const TraceHeader* header = reinterpret_cast<const TraceHeader*>(data);
+    if (memcmp(header->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 || header->version != TRACE_VERSION)
+    {
+        DBG_LOG("%s is not a trace file of a supported version\n", filename.c_str());
+        munmap(map, st.st_size);
+        return false;
+    }
+    const size_t end = std::min<size_t>(header->committed, st.st_size);
+    size_t pos = sizeof(TraceHeader);
+    bool valid = true;
+    while (valid && pos + sizeof(TraceRecord) <= end)
+    {
+        const TraceRecord* record = reinterpret_cast<const TraceRecord*>(data + pos);
+        const uint8_t* p = data + pos + sizeof(TraceRecord);
+        const size_t size = record->size;
+        if (pos + sizeof(TraceRecord) + size > end)
+        {
+            valid = false;
+            break;
+        }
+        switch (record->kind)
+        {
+        case TRACE_METRIC:
+        case TRACE_SAMPLED_METRIC:
+        {
+            const size_t header = record->kind == TRACE_SAMPLED_METRIC ? 12 : 8;
+            if (size < header)
+            {
+                valid = false;
+                break;
+            }
+            uint32_t id, vtype, times = 0;
+            memcpy(&id, p, 4);
+            memcpy(&vtype, p + 4, 4);
+            if (record->kind == TRACE_SAMPLED_METRIC) memcpy(&times, p + 8, 4);
+            const char* collector = reinterpret_cast<const char*>(p + header);
+            const size_t collectorLen = strnlen(collector, size - header);
+            const char* name = collector + collectorLen + 1;
+            valid = id == mMetrics.size() && vtype < CollectorValueList::TYPE_UNASSIGNED && header + collectorLen + 1 < size
+                && (record->kind == TRACE_METRIC || times < id);
+            if (valid)
+            {
+                Metric m;
+                m.collector = collector;
+                m.name = std::string(name, strnlen(name, size - header - collectorLen - 1));
+                m.type = static_cast<CollectorValueList::vtype>(vtype);
+                m.times = record->kind == TRACE_SAMPLED_METRIC ? (int)times : -1;
+                mMetrics.push_back(m);
+            }
+            break;
+        }
+        case TRACE_CHUNK:
+        {
+            if (size < 8)
+            {
+                valid = false;
+                break;
+            }
+            uint32_t id, count;
+            memcpy(&id, p, 4);
+            memcpy(&count, p + 4, 4);
+            valid = id < mMetrics.size() && count <= (size - 8) / sizeof(CollectorValue);
+            if (valid)
+            {
+                std::vector<CollectorValue>& values = mMetrics[id].values;
+                const size_t old = values.size();
+                values.resize(old + count);
+                memcpy(values.data() + old, p + 8, count * sizeof(CollectorValue));
+            }
+            break;
+        }
+        case TRACE_JSON:
+        {
+            const char* key = reinterpret_cast<const char*>(p);
+            const size_t keyLen = strnlen(key, size);
+            Json::Value value;
+            Json::Reader reader;
+            valid = keyLen < size && reader.parse(key + keyLen + 1, reinterpret_cast<const char*>(p + size), value);
+            if (valid)
+            {
+                mJSON.push_back(std::make_pair(std::string(key, keyLen), value));
+            }
+            break;
+        }
+        default:
+            break; // skip unknown records
+        }
+        pos += sizeof(TraceRecord) + padded(size);
+    }
+    munmap(map, st.st_size);
+    if (!valid)
+    {
+        DBG_LOG("Trace file %s has a corrupt record at offset %lu\n", filename.c_str(), (unsigned long)pos);
+    }
+    resample();
+    return valid;
+}
+
+void CollectorTraceReader::resample()
+{
+    const Metric* timing = find("timing", "time");
+    std::vector<int64_t> frames;
+    if (timing)
+    {
+        for (const CollectorValue& cv : timing->values) frames.push_back(cv.i64);
+    }
+    for (Metric& m : mMetrics)
+    {
+        if (m.times < 0 || m.values.empty())
+        {
+            continue;
+        }
+        CollectorValueList samples;
+        samples.type = m.type;
+        for (const CollectorValue& cv : m.values) samples.push_back(cv);
+        CollectorColumn<int64_t> times;
+        for (const CollectorValue& cv : mMetrics[m.times].values) times.push_back(cv.i64);
+        CollectorValueList out;
+        out.type = m.type;
+        if (samples.size() == times.size())
+        {
+            resampleTimed(samples, times, 0, frames, out);
+        }
+        else
+        {
+            resampleUniform(samples, frames, out);
+        }
+        m.values.clear();
+        out.for_each_sample([&m](CollectorValue cv) { m.values.push_back(cv); });
+    }
+}
+
+const CollectorTraceReader::Metric* CollectorTraceReader::find(const std::string& collector, const std::string& name) const
+{
+    for (const Metric& m : mMetrics)
+    {
+        if (m.collector == collector && m.name == name)
+        {
+            return &m;
+        }
+    }
+    return nullptr;
+}
+
+static void appendValue(Json::Value& list, CollectorValueList::vtype type, CollectorValue cv)
+{
+    switch (type)
+    {
+    case CollectorValueList::TYPE_FP64: list.append(cv.fp64); break;
+    case CollectorValueList::TYPE_U64: list.append(static_cast<Json::UInt64>(cv.u64)); break;
+    case CollectorValueList::TYPE_I64: list.append(static_cast<Json::Int64>(cv.i64)); break;
+    case CollectorValueList::TYPE_UNASSIGNED: assert(false); break;
+    }
+}
+
+Json::Value CollectorTraceReader::results() const
+{
+    Json::Value results;
+    for (const Metric& m : mMetrics)
+    {
+        if (m.collector == "timing" || m.collector == "sample_times") continue;
+        Json::Value& list = (m.collector == "custom" ? results["custom"][m.name] : results[m.collector][m.name]) = Json::arrayValue;
+        for (const CollectorValue& cv : m.values) appendValue(list, m.type, cv);
+    }
+    Json::Value v;
+    v["time"] = Json::arrayValue;
+    results["timing"] = v;
+    const Metric* timing = find("timing", "time");
+    if (timing)
+    {
+        int64_t sum = 0;
+        for (const CollectorValue& cv : timing->values)
+        {
+            results["timing"]["time"].append(static_cast<Json::Value::Int64>(cv.i64));
+            sum += cv.i64;
+        }
+        double timeInSeconds = (double)sum / 1000000.0;
+        results["timing"]["samples_per_second"] = (double)timing->values.size() / timeInSeconds;
+    }
+    for (const auto& pair : mJSON) // custom collector results, provenance and the like
+    {
+        results[pair.first] = pair.second;
+    }
+    return results;
+}
+
+bool CollectorTraceReader::writeJSON(const std::string& filename) const
+{
+    FILE *fp = fopen(filename.c_str(), "w");
+    if (!fp)
+    {
+        fprintf(stderr, "FAILED to open %s: %s\n", filename.c_str(), strerror(errno));
+        return false;
+    }
+    Json::StyledWriter writer;
+    fprintf(fp, "%s", writer.write(results()).c_str());
+    return (fclose(fp) == 0);
+}
+
+bool CollectorTraceReader::writeCSV(const std::string& filename) const
+{
+    OutputBuffer out;
+    if (!out.open(filename))
+    {
+        return false;
+    }
+    const Metric* timing = find("timing", "time");
+    const size_t rows = timing ? timing->values.size() : 0;
+    std::vector<const Metric*> columns; // custom values first, as Collection::writeCSV()
+    for (const Metric& m : mMetrics)
+    {
+        if (m.collector == "custom") columns.push_back(&m);
+    }
+    for (const Metric& m : mMetrics)
+    {
+        if (m.collector != "custom" && m.collector != "timing" && m.collector != "sample_times") columns.push_back(&m);
+    }
+    std::string header;
+    CsvLine line(header);
+    line.field(std::string("frametime"));
+    for (const Metric* m : columns)
+    {
+        line.field(m->collector == "custom" ? m->name : m->collector + ":" + m->name);
+    }
+    line.end();
+    out.write(header);
+    writeCsvRows(out, rows, [timing, &columns](CsvLine& line, size_t i)
+    {
+        line.field(timing->values[i].i64);
+        for (const Metric* m : columns)
+        {
+            if (i < m->values.size()) line.field(m->type, m->values[i]);
+            else line.field(std::string()); // keep later columns aligned
+        }
+    });
+    return out.close();
+}
+
+bool CollectorTraceReader::writeCSV_MTV(const std::string& filename) const
+{
+    OutputBuffer out;
+    if (!out.open(filename))
+    {
+        return false;
+    }
+    std::vector<const Metric*> lines;
+    for (const Metric& m : mMetrics)
+    {
+        if (m.collector != "custom" && m.collector != "timing" && m.collector != "sample_times") lines.push_back(&m);
+    }
+    writeCsvRows(out, lines.size(), [&lines](CsvLine& line, size_t row)
+    {
+        line.field(lines[row]->collector);
+        line.field(lines[row]->name);
+        for (const CollectorValue& cv : lines[row]->values) line.field(lines[row]->type, cv);
+    }, ", ", false, 1, 1);
+    std::string text;
+    CsvLine line(text);
+    line.field(std::string("frametime"));
+    line.field(std::string("time"));
+    const Metric* timing = find("timing", "time");
+    if (timing)
+    {
+        for (const CollectorValue& cv : timing->values) line.field(cv.i64);
+    }
+    for (const Metric& m : mMetrics)
+    {
+        if (m.collector != "custom") continue;
+        line.end();
+        line.field(std::string("custom"));
+        line.field(m.name);
+        for (const CollectorValue& cv : m.values) line.field(cv.i64);
+    }
+    out.write(text);
+    return out.close();
+}
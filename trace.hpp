@@ -0,0 +1,128 @@
+#pragma once
+
+#include "interface.hpp"
+
+#include <string>
+#include <vector>
+
+// Binary trace format
+//
+// A trace file starts with a TraceHeader, followed by records. Each record is a TraceRecord header
+// followed by its payload, padded to a multiple of 8 bytes. Records are only ever appended; the
+// header's 'committed' field is updated after the records before it are complete, and readers
+// ignore anything past it. So if the writing process dies, the file is still valid up to its last
+// commit.
+//
+// Record kinds:
+//  - TRACE_METRIC: uint32 id, uint32 value type, then "collector\0metric\0"
+//  - TRACE_CHUNK: uint32 id, uint32 count, then count 64-bit values of that metric
+//  - TRACE_JSON: "key\0" followed by JSON text, for results that are not sampled values
+//  - TRACE_SAMPLED_METRIC: uint32 id, uint32 value type, uint32 id of the metric holding its sample
+//    times, then "collector\0metric\0". Its values are samples taken from the sampling thread of
+//    a threaded collector, which readers map onto frames.
+//
+// Frame times are stored as metric "time" of collector "timing", and custom values as collector
+// "custom". The sample times of a threaded collector, in microseconds since the start of the
+// capture, are stored as the metric of collector "sample_times" named after it. Threaded
+// collectors are written along with the frames during capture, so a trace cut short still holds
+// their samples up to its last commit.
+
+#define TRACE_MAGIC "LCTRACE"
+#define TRACE_VERSION 1
+
+struct TraceHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t committed; // bytes of valid data in the file, including this header
+};
+
+struct TraceRecord
+{
+    uint32_t kind;
+    uint32_t size; // payload bytes, without padding
+};
+
+enum TraceRecordKind
+{
+    TRACE_METRIC = 1,
+    TRACE_CHUNK = 2,
+    TRACE_JSON = 3,
+    TRACE_SAMPLED_METRIC = 4,
+};
+
+// Append-only trace writer. The file is memory mapped, so writing values is a copy into the map.
+class CollectorTraceWriter
+{
+public:
+    CollectorTraceWriter() {}
+    ~CollectorTraceWriter() { close(); }
+
+    bool open(const std::string& filename);
+    /// Commit and trim the file to its final size. Also done when the file cannot grow any more,
+    /// for instance on a full disk, after which nothing more is written.
+    void close();
+    bool isOpen() const { return mFD >= 0; }
+
+    /// Define a new metric, returning its id for writeChunk().
+    uint32_t defineMetric(const std::string& collector, const std::string& metric, CollectorValueList::vtype type);
+    /// Define a new metric of samples taken at the times written to metric 'times'
+    uint32_t defineSampledMetric(const std::string& collector, const std::string& metric, CollectorValueList::vtype type, uint32_t times);
+    /// Write values [first, last) of a value list as one chunk
+    void writeChunk(uint32_t id, const CollectorValueList& list, size_t first, size_t last);
+    /// Write values [first, last) of a vector as one chunk
+    void writeChunk(uint32_t id, const std::vector<int64_t>& values, size_t first, size_t last);
+    /// Write times [first, last) of a column as one chunk, relative to 'base'
+    void writeChunk(uint32_t id, const CollectorColumn<int64_t>& times, size_t first, size_t last, int64_t base);
+    void writeJSON(const std::string& key, const Json::Value& value);
+    /// Make everything written so far visible to readers
+    void commit();
+
+private:
+    uint8_t* reserve(uint32_t kind, size_t size);
+    uint32_t define(uint32_t kind, const std::string& collector, const std::string& metric, CollectorValueList::vtype type, uint32_t times);
+    bool grow(size_t needed);
+
+    int mFD = -1;
+    uint8_t* mMap = nullptr;
+    size_t mCapacity = 0;
+    size_t mEnd = 0;
+    uint32_t mMetrics = 0;
+};
+
+// Reads back a trace file into the same layouts that Collection writes.
+class CollectorTraceReader
+{
+public:
+    struct Metric
+    {
+        std::string collector;
+        std::string name;
+        CollectorValueList::vtype type;
+        std::vector<CollectorValue> values;
+        int times; // index of the metric with the sample times of a threaded collector's samples, or -1
+    };
+
+    /// Parse all committed records of a trace file. The samples of threaded collectors are mapped
+    /// onto frames as Collection does when it stops.
+    bool open(const std::string& filename);
+
+    const std::vector<Metric>& metrics() const { return mMetrics; }
+
+    /// The results in the layout of Collection::results()
+    Json::Value results() const;
+
+    bool writeJSON(const std::string& filename) const;
+    /// Data in rows, as Collection::writeCSV()
+    bool writeCSV(const std::string& filename) const;
+    /// Data in columns, as Collection::writeCSV_MTV()
+    bool writeCSV_MTV(const std::string& filename) const;
+
+private:
+    const Metric* find(const std::string& collector, const std::string& name) const;
+    void resample();
+
+    std::vector<Metric> mMetrics;
+    std::vector<std::pair<std::string, Json::Value>> mJSON;
+};
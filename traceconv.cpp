@@ -0,0 +1,81 @@
+#include "trace.hpp"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <getopt.h>
+
+void usage(int status)
+{
+    static const char message[] =
+        "usage: traceconv [-h] [-f json|csv|mtv] TRACE OUTPUT\n\n"
+        "Converts a binary trace file, as written by libcollector when 'trace_file' is set in\n"
+        "its configuration, into the JSON or CSV layouts that libcollector writes directly.\n"
+        "Traces cut short by a crash are converted up to their last complete flush.\n"
+        "\n"
+        "    -h  Display this message\n"
+        "    -f  Output format: json (default), csv (data in rows) or mtv (data in columns).\n"
+        "\n";
+
+    fputs( message, stderr );
+    exit( status );
+}
+
+int main(int argc, char **argv)
+{
+    extern char *optarg;
+    extern int optind;
+    int c;
+
+    std::string format = "json";
+
+    while( ( c = getopt(argc, argv, "hf:") ) != -1 )
+    {
+        switch( c )
+        {
+            case 'h':
+                usage( 0 );
+                break;
+            case 'f':
+                format = optarg;
+                break;
+            default:
+                usage( 2 );
+                break;
+        }
+    }
+
+    if( argc - optind != 2 )
+    {
+        fprintf( stderr, "ERROR: a trace file and an output file are required\n" );
+        usage( 2 );
+    }
+
+    if( format != "json" && format != "csv" && format != "mtv" )
+    {
+        fprintf( stderr, "ERROR: unknown format %s\n", format.c_str() );
+        usage( 2 );
+    }
+
+    CollectorTraceReader reader;
+    if( !reader.open( argv[optind] ) )
+    {
+        return 1;
+    }
+
+    bool success = false;
+    if( format == "json" )
+    {
+        success = reader.writeJSON( argv[optind + 1] );
+    }
+    else if( format == "csv" )
+    {
+        success = reader.writeCSV( argv[optind + 1] );
+    }
+    else if( format == "mtv" )
+    {
+        success = reader.writeCSV_MTV( argv[optind + 1] );
+    }
+
+    return success ? 0 : 1;
+}